@@ -0,0 +1,84 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "histogram.h"
+
+static int histMsb(uint64_t v) {
+    int msb = 0;
+    while (v >>= 1) msb++;
+    return msb;
+}
+
+static int histIndex(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int shift = histMsb(v) - (HIST_SUB_BITS-1);
+    uint64_t sub = v >> shift;
+    return HIST_SUB + (shift-1)*(HIST_SUB/2) + (int)(sub - HIST_SUB/2);
+}
+
+/* Return the highest value that maps into the bucket at 'idx'. */
+static uint64_t histBucketMax(int idx) {
+    if (idx < HIST_SUB) return idx;
+    int shift = (idx-HIST_SUB)/(HIST_SUB/2)+1;
+    uint64_t sub = (idx-HIST_SUB)%(HIST_SUB/2) + HIST_SUB/2;
+    return ((sub+1) << shift) - 1;
+}
+
+void histReset(histogram *h) {
+    memset(h,0,sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void histAdd(histogram *h, uint64_t v) {
+    h->bucket[histIndex(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+}
+
+/* Return the value at the percentile 'p' (0-100). */
+uint64_t histPercentile(histogram *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t)ceil(p/100*h->count);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int j = 0; j < HIST_BUCKETS; j++) {
+        seen += h->bucket[j];
+        if (seen >= rank) {
+            uint64_t v = histBucketMax(j);
+            return v > h->max ? h->max : v;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,147 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Hardware performance counters for the benchmarks, using the Linux
+ * perf_event_open() system call. Counting is limited to the calling thread
+ * in user space, so the kernel does not need to allow more than the default
+ * perf_event_paranoid level.
+ *
+ * Counters are often not available at all, for instance inside containers
+ * or virtual machines not exposing the PMU: in this case the functions just
+ * report every counter as unavailable, and the benchmarks only report the
+ * time. On systems other than Linux no counter is ever available. */
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include "perfcount.h"
+
+static const char *PerfCounterNames[PERF_NUM_COUNTERS] = {
+    "instructions", "cycles", "cache-misses", "branch-misses"
+};
+
+static int PerfFd[PERF_NUM_COUNTERS] = {-1, -1, -1, -1};
+static const char *PerfError = "not initialized";
+
+#ifdef __linux__
+static const uint64_t PerfConfig[PERF_NUM_COUNTERS] = {
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+/* Open the counters not already open. Return the number of counters
+ * available. On failure the reason is available via perfCountersError(). */
+int perfCountersInit(void) {
+    int available = 0;
+    for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+        if (PerfFd[j] != -1) {
+            available++;
+            continue;
+        }
+        struct perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PerfConfig[j];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        PerfFd[j] = syscall(__NR_perf_event_open,&attr,0,-1,-1,0);
+        if (PerfFd[j] == -1) {
+            PerfError = strerror(errno);
+        } else {
+            available++;
+        }
+    }
+    if (available) PerfError = NULL;
+    return available;
+}
+
+void perfCountersStart(void) {
+    for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+        if (PerfFd[j] == -1) continue;
+        ioctl(PerfFd[j],PERF_EVENT_IOC_RESET,0);
+        ioctl(PerfFd[j],PERF_EVENT_IOC_ENABLE,0);
+    }
+}
+
+/* Stop the counters and store their value into 'values', that must have
+ * space for PERF_NUM_COUNTERS entries. Unavailable counters are set to 0.
+ * When the kernel multiplexed the counters because there are not enough
+ * hardware registers, the values are scaled to the whole time the counter
+ * was enabled. */
+void perfCountersStop(uint64_t *values) {
+    for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+        values[j] = 0;
+        if (PerfFd[j] == -1) continue;
+        ioctl(PerfFd[j],PERF_EVENT_IOC_DISABLE,0);
+        uint64_t data[3]; /* Value, time enabled, time running. */
+        if (read(PerfFd[j],data,sizeof(data)) != sizeof(data)) continue;
+        if (data[2] && data[2] < data[1])
+            data[0] = (uint64_t)((double)data[0]*data[1]/data[2]);
+        values[j] = data[0];
+    }
+}
+#else
+int perfCountersInit(void) {
+    PerfError = "only supported on Linux";
+    return 0;
+}
+
+void perfCountersStart(void) {}
+
+void perfCountersStop(uint64_t *values) {
+    memset(values,0,sizeof(uint64_t)*PERF_NUM_COUNTERS);
+}
+#endif
+
+/* Return the reason why no counter is available, or NULL. */
+const char *perfCountersError(void) {
+    return PerfError;
+}
+
+int perfCounterAvailable(int counter) {
+    return PerfFd[counter] != -1;
+}
+
+const char *perfCounterName(int counter) {
+    return PerfCounterNames[counter];
+}
@@ -0,0 +1,1283 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* rax-bench: configurable workload benchmark for Rax.
+ *
+ * The tree is first populated with --keys keys taken from one of the key
+ * distributions below, then --ops operations are performed according to
+ * the operation mix. Every single operation is timed, and the latency is
+ * accumulated into a log-linear histogram (HDR histogram style), so that
+ * percentiles are reported with a bounded relative error. The output is
+ * either human readable or, with --json, a JSON object that can be stored
+ * in order to track regressions.
+ *
+ * With --threads the benchmark instead measures how the throughput scales
+ * with the number of threads, see the "Threaded benchmark" section, and
+ * with --fork how much memory is copied on write while a forked child
+ * holds a snapshot, see the "Fork benchmark" section. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "rax.h"
+#include "rc4rand.h"
+#include "histogram.h"
+
+uint16_t crc16(const char *buf, int len); /* From crc16.c */
+
+/* --------------------------------------------------------------------------
+ * Key distributions. Every distribution maps the integer 'i' into a key
+ * in a deterministic way, so that the same key can be generated again
+ * for lookups and deletions without storing it.
+ * -------------------------------------------------------------------------*/
+
+/* Max length of the generated keys, with the exception of the "chain"
+ * distribution, whose keys are as long as the tree is big. */
+#define KEY_MAXLEN 256
+
+/* Mix the bits of 'x', see the splitmix64 generator. Used in order to
+ * derive random looking but reproducible keys from an integer. */
+static uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Decimal representation of 'i': sequential keys sharing long prefixes. */
+static size_t keySeq(unsigned char *s, uint64_t i) {
+    return snprintf((char*)s,KEY_MAXLEN,"%llu",(unsigned long long)i);
+}
+
+/* Random looking alphanumerical words. Used together with Zipf distributed
+ * accesses, so that hot keys are spread across the whole tree. */
+static size_t keyWord(unsigned char *s, uint64_t i) {
+    const char *set = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                      "abcdefghijklmnopqrstuvwxyz"
+                      "0123456789";
+    uint64_t x = mix64(i);
+    size_t len = 4 + i%9;
+    for (size_t j = 0; j < len; j++) {
+        s[j] = set[x%62];
+        x /= 62;
+        if (x == 0) x = mix64(i+j+1);
+    }
+    /* Make the key unique appending 'i' itself. */
+    return len + snprintf((char*)s+len,KEY_MAXLEN-len,"%llu",
+                          (unsigned long long)i);
+}
+
+/* Random UUIDv4 strings: 36 bytes with almost no shared prefix. */
+static size_t keyUUID(unsigned char *s, uint64_t i) {
+    uint64_t hi = mix64(i), lo = mix64(hi ^ i);
+    hi = (hi & ~0xF000ULL) | 0x4000ULL; /* Version 4. */
+    lo = (lo & ~(0x3ULL<<62)) | (0x2ULL<<62); /* Variant 1. */
+    return snprintf((char*)s,KEY_MAXLEN,
+        "%08llx-%04llx-%04llx-%04llx-%012llx",
+        (unsigned long long)(hi>>32),
+        (unsigned long long)((hi>>16)&0xffff),
+        (unsigned long long)(hi&0xffff),
+        (unsigned long long)(lo>>48),
+        (unsigned long long)(lo&0xffffffffffffULL));
+}
+
+/* URL like keys: few hosts, a few path components with a small set of
+ * values, and a unique final component. */
+static size_t keyURL(unsigned char *s, uint64_t i) {
+    static const char *sections[] = {"news","blog","shop","users","docs",
+                                     "static","api/v1","api/v2"};
+    uint64_t x = mix64(i);
+    return snprintf((char*)s,KEY_MAXLEN,
+        "https://www.site%d.example.com/%s/%d/item-%llu.html",
+        (int)(x%16), sections[(x>>8)%8], (int)((x>>16)%100),
+        (unsigned long long)i);
+}
+
+/* Stream IDs as Redis stores them into the radix tree: 128 bit big endian
+ * <milliseconds,sequence> pairs, with a few entries per millisecond. */
+static size_t keyStream(unsigned char *s, uint64_t i) {
+    uint64_t ms = 1500000000000ULL + i/4;
+    uint64_t seq = i%4;
+    for (int j = 0; j < 8; j++) {
+        s[j] = (ms >> (56-j*8)) & 0xff;
+        s[j+8] = (seq >> (56-j*8)) & 0xff;
+    }
+    return 16;
+}
+
+/* Keys prefixed by their Redis Cluster hash slot in big endian, like the
+ * slot to keys mapping of Redis Cluster. */
+static size_t keySlot(unsigned char *s, uint64_t i) {
+    size_t len = snprintf((char*)s+2,KEY_MAXLEN-2,"user:%llu:session",
+                          (unsigned long long)i);
+    uint16_t slot = crc16((char*)s+2,len) & 0x3FFF;
+    s[0] = slot >> 8;
+    s[1] = slot & 0xff;
+    return len+2;
+}
+
+/* Like KEY_CHAIN in rax-test.c: the key 'i' is i+1 times the character "A",
+ * so every key is a prefix of the next one. */
+static size_t keyChain(unsigned char *s, uint64_t i) {
+    memset(s,'A',i+1);
+    return i+1;
+}
+
+#define ACCESS_UNIFORM 0
+#define ACCESS_ZIPF 1
+
+typedef struct keyDist {
+    const char *name;
+    size_t (*gen)(unsigned char *s, uint64_t i);
+    int access;         /* How keys are picked in the operations phase. */
+    const char *desc;
+} keyDist;
+
+keyDist KeyDists[] = {
+    {"seq",keySeq,ACCESS_UNIFORM,"sequential integers as decimal strings"},
+    {"zipf",keyWord,ACCESS_ZIPF,"random words accessed with Zipf skew"},
+    {"uuid",keyUUID,ACCESS_UNIFORM,"random UUIDv4 strings"},
+    {"url",keyURL,ACCESS_UNIFORM,"URL like keys sharing host and path"},
+    {"stream",keyStream,ACCESS_UNIFORM,"128 bit big endian stream IDs"},
+    {"slot",keySlot,ACCESS_UNIFORM,"cluster hash slot prefixed keys"},
+    {"chain",keyChain,ACCESS_UNIFORM,"each key is a prefix of the next"},
+    {NULL,NULL,0,NULL}
+};
+
+/* The chain distribution is quadratic in the number of keys. */
+#define CHAIN_MAXKEYS 4000
+
+/* --------------------------------------------------------------------------
+ * Zipf distributed integers in the range [0,n), using the algorithm from
+ * "Quickly Generating Billion-Record Synthetic Databases", Gray et al.
+ * -------------------------------------------------------------------------*/
+
+typedef struct zipfGen {
+    uint64_t n;
+    double theta, alpha, zetan, eta;
+} zipfGen;
+
+static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) sum += 1/pow((double)i,theta);
+    return sum;
+}
+
+void zipfInit(zipfGen *z, uint64_t n, double theta) {
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1/(1-theta);
+    z->zetan = zeta(n,theta);
+    z->eta = (1-pow(2.0/n,1-theta))/(1-zeta(2,theta)/z->zetan);
+}
+
+static double randUnit(void) {
+    return (rc4rand64() >> 11) * (1.0/9007199254740992.0);
+}
+
+/* Map the uniform value 'u' in [0,1) into a Zipf distributed integer. */
+uint64_t zipfSample(zipfGen *z, double u) {
+    double uz = u*z->zetan;
+    if (uz < 1) return 0;
+    if (uz < 1+pow(0.5,z->theta)) return z->n > 1;
+    uint64_t r = (uint64_t)(z->n*pow(z->eta*u-z->eta+1,z->alpha));
+    return r >= z->n ? z->n-1 : r;
+}
+
+uint64_t zipfNext(zipfGen *z) {
+    return zipfSample(z,randUnit());
+}
+
+/* --------------------------------------------------------------------------
+ * Operations.
+ * -------------------------------------------------------------------------*/
+
+#define OP_INSERT 0     /* Insert or update an existing key. */
+#define OP_FIND 1       /* Lookup of an existing key. */
+#define OP_MISS 2       /* Lookup of a key that is not in the tree. */
+#define OP_REMOVE 3     /* Remove a key, that is then inserted back. */
+#define OP_SEEK 4       /* Seek a key, then iterate --scan elements. */
+#define OP_COUNT 5
+
+const char *OpNames[OP_COUNT] = {"insert","find","miss","remove","seek"};
+
+typedef struct benchConfig {
+    keyDist *dist;
+    uint64_t keys;          /* Keys inserted before the operations phase. */
+    uint64_t ops;           /* Operations performed after populating. */
+    unsigned mix[OP_COUNT]; /* Operations weights. */
+    unsigned scan;          /* Elements visited after every seek. */
+    double theta;           /* Zipf skew. */
+    uint64_t seed;
+    int reserve;            /* Call raxReserve() before populating. */
+} benchConfig;
+
+typedef struct benchPhase {
+    const char *name;
+    uint64_t ops;
+    double seconds;
+    histogram hist[OP_COUNT];
+} benchPhase;
+
+static uint64_t nstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned char *KeyBuf;
+
+/* Insert every key of the distribution, timing each insertion. */
+void benchPopulate(benchConfig *cfg, rax *t, benchPhase *ph) {
+    if (cfg->reserve) {
+        /* Estimate the average key length from the first keys. */
+        uint64_t sample = cfg->keys < 1000 ? cfg->keys : 1000, bytes = 0;
+        for (uint64_t i = 0; i < sample; i++)
+            bytes += cfg->dist->gen(KeyBuf,i);
+        raxReserve(t,cfg->keys,sample ? bytes/sample : 0);
+    }
+    uint64_t start = nstime();
+    for (uint64_t i = 0; i < cfg->keys; i++) {
+        size_t len = cfg->dist->gen(KeyBuf,i);
+        uint64_t t0 = nstime();
+        raxInsert(t,KeyBuf,len,(void*)(uintptr_t)i,NULL);
+        histAdd(&ph->hist[OP_INSERT],nstime()-t0);
+    }
+    ph->seconds = (double)(nstime()-start)/1e9;
+    ph->ops = cfg->keys;
+}
+
+/* Run the configured operations mix against the populated tree. Removed
+ * keys are inserted back immediately (not timed), so that the tree size
+ * stays the same for the whole phase. */
+void benchOperations(benchConfig *cfg, rax *t, benchPhase *ph) {
+    unsigned total = 0;
+    for (int j = 0; j < OP_COUNT; j++) total += cfg->mix[j];
+    if (total == 0) return;
+
+    zipfGen z;
+    if (cfg->dist->access == ACCESS_ZIPF) zipfInit(&z,cfg->keys,cfg->theta);
+
+    raxIterator ri;
+    raxStart(&ri,t);
+    uint64_t start = nstime();
+    for (uint64_t i = 0; i < cfg->ops; i++) {
+        unsigned r = rc4rand() % total;
+        int op = 0;
+        while (r >= cfg->mix[op]) r -= cfg->mix[op++];
+
+        uint64_t idx;
+        if (op == OP_MISS)
+            idx = cfg->keys + rc4rand64() % (cfg->keys ? cfg->keys : 1);
+        else if (cfg->dist->access == ACCESS_ZIPF)
+            idx = zipfNext(&z);
+        else
+            idx = cfg->keys ? rc4rand64() % cfg->keys : 0;
+        size_t len = cfg->dist->gen(KeyBuf,idx);
+        void *val = (void*)(uintptr_t)idx;
+
+        uint64_t t0 = nstime();
+        switch(op) {
+        case OP_INSERT: raxInsert(t,KeyBuf,len,val,NULL); break;
+        case OP_FIND: case OP_MISS: raxFind(t,KeyBuf,len); break;
+        case OP_REMOVE: raxRemove(t,KeyBuf,len,NULL); break;
+        case OP_SEEK:
+            raxSeek(&ri,">=",KeyBuf,len);
+            for (unsigned j = 0; j < cfg->scan && raxNext(&ri); j++);
+            break;
+        }
+        histAdd(&ph->hist[op],nstime()-t0);
+        if (op == OP_REMOVE) raxInsert(t,KeyBuf,len,val,NULL);
+    }
+    ph->seconds = (double)(nstime()-start)/1e9;
+    ph->ops = cfg->ops;
+    raxStop(&ri);
+}
+
+/* --------------------------------------------------------------------------
+ * Threaded benchmark.
+ *
+ * With --threads N the operations run with 1, 2, ... N threads in three
+ * scenarios, reporting the aggregate throughput and the speedup compared
+ * to a single thread:
+ *
+ * private:   every thread owns a tree populated with --keys keys, and runs
+ *            the operations mix against it. Nothing is shared, so this
+ *            measures how memory bandwidth and caches scale.
+ * shared-ro: all the threads run raxFind() against the same tree, without
+ *            locking, since lookups never modify the tree.
+ * shared-rw: all the threads run the operations mix against the same tree,
+ *            serialized by the lock selected with --lock: a mutex, or a
+ *            readers-writer lock taken in read mode for lookups and seeks.
+ *
+ * Every thread performs --ops operations, picking keys with its own PRNG.
+ * -------------------------------------------------------------------------*/
+
+#define MT_PRIVATE 0
+#define MT_SHARED_RO 1
+#define MT_SHARED_RW 2
+#define MT_COUNT 3
+
+const char *ScenarioNames[MT_COUNT] = {"private","shared-ro","shared-rw"};
+
+#define LOCK_MUTEX 0
+#define LOCK_RWLOCK 1
+
+const char *LockNames[] = {"mutex","rwlock"};
+
+#define MT_MAXTHREADS 256
+
+typedef struct benchThread {
+    pthread_t tid;
+    benchConfig *cfg;
+    int scenario;
+    int lock;
+    rax *t;                 /* Shared tree, or NULL to create one. */
+    pthread_barrier_t *barrier;
+    unsigned char *keybuf;
+    uint64_t rng;           /* Per thread PRNG state. */
+    uint64_t start, end;    /* Time the operations started and ended. */
+} benchThread;
+
+static pthread_mutex_t BenchMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t BenchRwlock = PTHREAD_RWLOCK_INITIALIZER;
+
+static uint64_t threadRand(benchThread *bt) {
+    return mix64(bt->rng++);
+}
+
+static void benchLock(int lock, int write) {
+    if (lock == LOCK_MUTEX)
+        pthread_mutex_lock(&BenchMutex);
+    else if (write)
+        pthread_rwlock_wrlock(&BenchRwlock);
+    else
+        pthread_rwlock_rdlock(&BenchRwlock);
+}
+
+static void benchUnlock(int lock) {
+    if (lock == LOCK_MUTEX)
+        pthread_mutex_unlock(&BenchMutex);
+    else
+        pthread_rwlock_unlock(&BenchRwlock);
+}
+
+void *benchThreadMain(void *arg) {
+    benchThread *bt = arg;
+    benchConfig *cfg = bt->cfg;
+    rax *t = bt->t;
+    unsigned total = 0;
+    for (int j = 0; j < OP_COUNT; j++) total += cfg->mix[j];
+
+    if (t == NULL) {
+        t = raxNew();
+        for (uint64_t i = 0; i < cfg->keys; i++) {
+            size_t len = cfg->dist->gen(bt->keybuf,i);
+            raxInsert(t,bt->keybuf,len,(void*)(uintptr_t)i,NULL);
+        }
+    }
+    zipfGen z;
+    if (cfg->dist->access == ACCESS_ZIPF) zipfInit(&z,cfg->keys,cfg->theta);
+    raxIterator ri;
+    raxStart(&ri,t);
+
+    /* Start all together, after the private trees are populated. */
+    pthread_barrier_wait(bt->barrier);
+    bt->start = nstime();
+    for (uint64_t i = 0; i < cfg->ops; i++) {
+        int op = OP_FIND;
+        if (bt->scenario != MT_SHARED_RO && total) {
+            unsigned r = threadRand(bt) % total;
+            op = 0;
+            while (r >= cfg->mix[op]) r -= cfg->mix[op++];
+        }
+
+        uint64_t idx, keys = cfg->keys ? cfg->keys : 1;
+        if (op == OP_MISS)
+            idx = cfg->keys + threadRand(bt) % keys;
+        else if (cfg->dist->access == ACCESS_ZIPF)
+            idx = zipfSample(&z,(threadRand(bt) >> 11) *
+                                (1.0/9007199254740992.0));
+        else
+            idx = threadRand(bt) % keys;
+        size_t len = cfg->dist->gen(bt->keybuf,idx);
+        void *val = (void*)(uintptr_t)idx;
+
+        int write = op == OP_INSERT || op == OP_REMOVE;
+        if (bt->scenario == MT_SHARED_RW) benchLock(bt->lock,write);
+        switch(op) {
+        case OP_INSERT: raxInsert(t,bt->keybuf,len,val,NULL); break;
+        case OP_FIND: case OP_MISS: raxFind(t,bt->keybuf,len); break;
+        case OP_REMOVE:
+            raxRemove(t,bt->keybuf,len,NULL);
+            raxInsert(t,bt->keybuf,len,val,NULL);
+            break;
+        case OP_SEEK:
+            raxSeek(&ri,">=",bt->keybuf,len);
+            for (unsigned j = 0; j < cfg->scan && raxNext(&ri); j++);
+            break;
+        }
+        if (bt->scenario == MT_SHARED_RW) benchUnlock(bt->lock);
+    }
+    bt->end = nstime();
+    raxStop(&ri);
+    if (bt->t == NULL) raxFree(t);
+    return NULL;
+}
+
+/* Run the scenario with 'numthreads' threads and return the aggregate
+ * throughput in operations per second. */
+double benchThreadedRun(benchConfig *cfg, int scenario, int lock,
+                        int numthreads, rax *shared, size_t bufsize)
+{
+    static benchThread threads[MT_MAXTHREADS];
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier,NULL,numthreads+1);
+    for (int j = 0; j < numthreads; j++) {
+        benchThread *bt = threads+j;
+        bt->cfg = cfg;
+        bt->scenario = scenario;
+        bt->lock = lock;
+        bt->t = scenario == MT_PRIVATE ? NULL : shared;
+        bt->barrier = &barrier;
+        bt->keybuf = malloc(bufsize);
+        bt->rng = mix64(cfg->seed + j);
+        if (bt->keybuf == NULL ||
+            pthread_create(&bt->tid,NULL,benchThreadMain,bt) != 0)
+        {
+            fprintf(stderr,"Can't create the benchmark threads\n");
+            exit(1);
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    uint64_t start = UINT64_MAX, end = 0;
+    for (int j = 0; j < numthreads; j++) {
+        pthread_join(threads[j].tid,NULL);
+        if (threads[j].start < start) start = threads[j].start;
+        if (threads[j].end > end) end = threads[j].end;
+    }
+    double seconds = (double)(end-start)/1e9;
+    pthread_barrier_destroy(&barrier);
+    for (int j = 0; j < numthreads; j++) free(threads[j].keybuf);
+    return seconds ? (double)cfg->ops*numthreads/seconds : 0;
+}
+
+/* Measure the throughput of every scenario from 1 to 'maxthreads' threads,
+ * storing it into 'tput', indexed by scenario and number of threads. */
+void benchThreaded(benchConfig *cfg, int maxthreads, int lock,
+                   size_t bufsize, double tput[][MT_MAXTHREADS+1])
+{
+    rax *shared = raxNew();
+    for (uint64_t i = 0; i < cfg->keys; i++) {
+        size_t len = cfg->dist->gen(KeyBuf,i);
+        raxInsert(shared,KeyBuf,len,(void*)(uintptr_t)i,NULL);
+    }
+    for (int s = 0; s < MT_COUNT; s++)
+        for (int n = 1; n <= maxthreads; n++)
+            tput[s][n] = benchThreadedRun(cfg,s,lock,n,shared,bufsize);
+    raxFree(shared);
+}
+
+/* --------------------------------------------------------------------------
+ * Scenarios.
+ *
+ * With --scenario the benchmark reproduces how Redis uses radix trees,
+ * starting from an empty tree and running --ops steps. Every tenth of the
+ * run the throughput of the last interval and the tree size (via
+ * raxAnalyze(), not timed) are sampled, so that both are reported over
+ * time.
+ *
+ * stream:  entries appended with increasing 128 bit IDs, trimmed from the
+ *          head to --keys entries like XADD MAXLEN, with XRANGE like
+ *          scans of up to --scan entries from a random ID.
+ * cluster: cluster slot prefixed keys added and removed at random, with
+ *          GETKEYSINSLOT like scans of a slot, as in fuzzTestCluster().
+ * pel:     consumer group pending entries list: IDs added in order,
+ *          acknowledged in random order, with frequent lookups of the
+ *          minimum pending ID. When --keys entries are pending, adding
+ *          one acknowledges the oldest.
+ * -------------------------------------------------------------------------*/
+
+#define SCENARIO_SAMPLES 10
+
+typedef struct scenarioState {
+    raxIterator ri;
+    uint64_t next;      /* Next ID to add. */
+    uint64_t lo;        /* Lowest ID possibly still in the tree. */
+} scenarioState;
+
+typedef struct scenarioSample {
+    uint64_t ops;       /* Steps performed so far. */
+    double ops_per_sec; /* Throughput in the last interval. */
+    uint64_t numele, numnodes, bytes;
+} scenarioSample;
+
+typedef struct benchScenario {
+    const char *name;
+    void (*step)(benchConfig *cfg, rax *t, scenarioState *st);
+    const char *desc;
+} benchScenario;
+
+/* Inverse of keyStream(). */
+static uint64_t streamIndex(unsigned char *s) {
+    uint64_t ms = 0, seq = 0;
+    for (int j = 0; j < 8; j++) {
+        ms = (ms << 8) | s[j];
+        seq = (seq << 8) | s[j+8];
+    }
+    return (ms-1500000000000ULL)*4 + seq;
+}
+
+void scenarioStream(benchConfig *cfg, rax *t, scenarioState *st) {
+    unsigned char id[16], end[16];
+    if (rc4rand() % 10 < 7) {
+        keyStream(id,st->next);
+        raxInsert(t,id,16,(void*)(uintptr_t)st->next,NULL);
+        st->next++;
+        if (raxSize(t) > cfg->keys) {
+            raxSeek(&st->ri,"^",NULL,0);
+            if (raxNext(&st->ri)) {
+                st->lo = streamIndex(st->ri.key)+1;
+                raxRemove(t,st->ri.key,st->ri.key_len,NULL);
+            }
+        }
+    } else if (st->next > st->lo) {
+        uint64_t start = st->lo + rc4rand64() % (st->next - st->lo);
+        keyStream(id,start);
+        keyStream(end,start+cfg->scan);
+        raxSeekRange(&st->ri,">=",id,16,"<",end,16);
+        while (raxNext(&st->ri));
+    }
+}
+
+void scenarioCluster(benchConfig *cfg, rax *t, scenarioState *st) {
+    unsigned char key[KEY_MAXLEN];
+    uint64_t keyspace = cfg->keys ? cfg->keys*2 : 1;
+    size_t len = keySlot(key,rc4rand64() % keyspace);
+    unsigned r = rc4rand() % 100;
+    if (r < 50) {
+        raxInsert(t,key,len,NULL,NULL);
+    } else if (r < 95) {
+        raxRemove(t,key,len,NULL);
+    } else {
+        raxSeek(&st->ri,">=",key,2);
+        for (unsigned j = 0; j < cfg->scan && raxNext(&st->ri) &&
+                             memcmp(st->ri.key,key,2) == 0; j++);
+    }
+}
+
+void scenarioPEL(benchConfig *cfg, rax *t, scenarioState *st) {
+    unsigned char id[16];
+    unsigned r = rc4rand() % 100;
+    if (r < 45) {
+        /* Too many pending entries: the oldest is claimed and acked. */
+        if (raxSize(t) >= cfg->keys) {
+            raxSeek(&st->ri,"^",NULL,0);
+            if (raxNext(&st->ri))
+                raxRemove(t,st->ri.key,st->ri.key_len,NULL);
+        }
+        keyStream(id,st->next);
+        raxInsert(t,id,16,(void*)(uintptr_t)st->next,NULL);
+        st->next++;
+    } else if (r < 80) {
+        if (st->next == st->lo) return;
+        keyStream(id,st->lo + rc4rand64() % (st->next - st->lo));
+        raxRemove(t,id,16,NULL);
+    } else {
+        raxSeek(&st->ri,"^",NULL,0);
+        if (raxNext(&st->ri)) st->lo = streamIndex(st->ri.key);
+    }
+}
+
+benchScenario Scenarios[] = {
+    {"stream",scenarioStream,"stream appends, trimming and range scans"},
+    {"cluster",scenarioCluster,"slot prefixed keys churn and slot scans"},
+    {"pel",scenarioPEL,"pending entries add, ack and min lookups"},
+    {NULL,NULL,NULL}
+};
+
+/* Run the scenario filling 'samples' with SCENARIO_SAMPLES samples.
+ * Returns the overall throughput. */
+double benchScenarioRun(benchConfig *cfg, benchScenario *sc,
+                        scenarioSample *samples)
+{
+    rax *t = raxNew();
+    scenarioState st;
+    memset(&st,0,sizeof(st));
+    raxStart(&st.ri,t);
+
+    uint64_t done = 0, elapsed = 0;
+    for (int s = 0; s < SCENARIO_SAMPLES; s++) {
+        uint64_t target = cfg->ops*(s+1)/SCENARIO_SAMPLES;
+        uint64_t start = nstime();
+        for (; done < target; done++) sc->step(cfg,t,&st);
+        uint64_t interval = nstime()-start;
+        elapsed += interval;
+
+        raxAnalysis a;
+        raxAnalyze(t,&a);
+        scenarioSample *sm = samples+s;
+        sm->ops = done;
+        sm->ops_per_sec = interval ?
+            (double)(target-(s ? samples[s-1].ops : 0))*1e9/interval : 0;
+        sm->numele = raxSize(t);
+        sm->numnodes = t->numnodes;
+        sm->bytes = a.bytes;
+    }
+    raxStop(&st.ri);
+    raxFree(t);
+    return elapsed ? (double)cfg->ops*1e9/elapsed : 0;
+}
+
+/* --------------------------------------------------------------------------
+ * Fork benchmark.
+ *
+ * With --fork the benchmark measures how many pages the operations mix
+ * copies while a forked child holds a snapshot of the memory, like Redis
+ * persisting the dataset with BGSAVE. After populating the tree the process
+ * forks, the child just waits, and the parent runs the operations. Pages
+ * still shared with the child are not accounted as private, so the growth
+ * of the Private_Dirty fields of /proc/self/smaps is the memory copied on
+ * write. The test runs with the nodes allocated by malloc(), with the tree
+ * arena compacted after populating (see raxArenaEnable()), and with the
+ * values array as well (see raxValuesEnable()).
+ * -------------------------------------------------------------------------*/
+
+#define FORK_MALLOC 0
+#define FORK_ARENA 1
+#define FORK_VALUES 2   /* Compacted arena and values array. */
+#define FORK_COUNT 3
+
+const char *ForkPolicies[FORK_COUNT] = {"malloc","arena","values"};
+
+typedef struct forkResult {
+    uint64_t memory_kb;     /* Private_Dirty growth caused by populating. */
+    uint64_t writes;        /* Insertions and removals performed. */
+    uint64_t dirty_pages;   /* Pages copied while the child was alive. */
+    double ops_per_sec;
+} forkResult;
+
+/* Sum the Private_Dirty fields of /proc/self/smaps, in kB. Returns -1 if
+ * the file can't be read. */
+static long smapsPrivateDirty(void) {
+    FILE *fp = fopen("/proc/self/smaps","r");
+    if (fp == NULL) return -1;
+    char line[256];
+    long total = 0, kb;
+    while (fgets(line,sizeof(line),fp))
+        if (sscanf(line,"Private_Dirty: %ld kB",&kb) == 1) total += kb;
+    fclose(fp);
+    return total;
+}
+
+static void benchForkMeasure(benchConfig *cfg, int policy, forkResult *res) {
+    static benchPhase ph;
+    for (int op = 0; op < OP_COUNT; op++) histReset(&ph.hist[op]);
+
+    long baseline = smapsPrivateDirty();
+    rax *t = raxNew();
+    if (policy != FORK_MALLOC) raxArenaEnable(t);
+    if (policy == FORK_VALUES) raxValuesEnable(t);
+    benchPopulate(cfg,t,&ph);
+    if (policy != FORK_MALLOC) raxArenaCompact(t);
+    for (int op = 0; op < OP_COUNT; op++) histReset(&ph.hist[op]);
+
+    long memory = smapsPrivateDirty();
+    if (baseline == -1 || memory == -1) {
+        fprintf(stderr,"Can't read /proc/self/smaps: %s\n", strerror(errno));
+        exit(1);
+    }
+    int pipefd[2];
+    pid_t pid;
+    if (pipe(pipefd) == -1 || (pid = fork()) == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        /* Wait for the parent to close the pipe, touching nothing. */
+        char c;
+        close(pipefd[1]);
+        while (read(pipefd[0],&c,1) == -1 && errno == EINTR);
+        _exit(0);
+    }
+    close(pipefd[0]);
+    long before = smapsPrivateDirty();
+    benchOperations(cfg,t,&ph);
+    long after = smapsPrivateDirty();
+    close(pipefd[1]);
+    waitpid(pid,NULL,0);
+
+    res->memory_kb = memory > baseline ? memory-baseline : 0;
+    /* Removed keys are inserted back, that's a second write. */
+    res->writes = ph.hist[OP_INSERT].count + ph.hist[OP_REMOVE].count*2;
+    res->dirty_pages = after > before ?
+        (uint64_t)(after-before)*1024/sysconf(_SC_PAGESIZE) : 0;
+    res->ops_per_sec = ph.seconds ? ph.ops/ph.seconds : 0;
+    raxFree(t);
+}
+
+/* Run the fork benchmark for the specified policy in a new process, so
+ * that the heap left by a run does not affect the memory of the next. */
+void benchForkRun(benchConfig *cfg, int policy, forkResult *res) {
+    int pipefd[2];
+    pid_t pid;
+    if (pipe(pipefd) == -1 || (pid = fork()) == -1) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(pipefd[0]);
+        benchForkMeasure(cfg,policy,res);
+        if (write(pipefd[1],res,sizeof(*res)) != sizeof(*res)) _exit(1);
+        _exit(0);
+    }
+    close(pipefd[1]);
+    ssize_t nread;
+    while ((nread = read(pipefd[0],res,sizeof(*res))) == -1 && errno == EINTR);
+    close(pipefd[0]);
+    waitpid(pid,NULL,0);
+    if (nread != sizeof(*res)) {
+        fprintf(stderr,"Fork benchmark worker failed\n");
+        exit(1);
+    }
+}
+
+/* --------------------------------------------------------------------------
+ * XRANGE benchmark.
+ *
+ * With --xrange the tree is populated with --keys stream IDs, then --ops
+ * scans of --scan entries from random IDs are performed, like XRANGE with
+ * an inclusive end ID: once checking every entry against the end with
+ * raxCompare(), once with the bounds fixed by raxSeekRange().
+ * -------------------------------------------------------------------------*/
+
+#define XRANGE_COMPARE 0
+#define XRANGE_SEEKRANGE 1
+#define XRANGE_COUNT 2
+
+const char *XrangeMethods[XRANGE_COUNT] = {"raxCompare","raxSeekRange"};
+
+typedef struct xrangeResult {
+    uint64_t entries;       /* Entries returned by all the scans. */
+    double seconds;
+} xrangeResult;
+
+void benchXrange(benchConfig *cfg, xrangeResult *res) {
+    unsigned char id[16], end[16];
+    uint64_t span = cfg->scan ? cfg->scan : 1;
+    rax *t = raxNew();
+    for (uint64_t j = 0; j < cfg->keys; j++) {
+        keyStream(id,j);
+        raxInsert(t,id,16,NULL,NULL);
+    }
+
+    raxIterator ri;
+    raxStart(&ri,t);
+    for (int m = 0; m < XRANGE_COUNT; m++) {
+        rc4srand(cfg->seed);
+        uint64_t entries = 0, start = nstime();
+        for (uint64_t j = 0; j < cfg->ops; j++) {
+            uint64_t first = cfg->keys ? rc4rand64() % cfg->keys : 0;
+            keyStream(id,first);
+            keyStream(end,first+span-1);
+            if (m == XRANGE_COMPARE) {
+                raxSeek(&ri,">=",id,16);
+                while (raxNext(&ri) && raxCompare(&ri,"<=",end,16))
+                    entries++;
+            } else {
+                raxSeekRange(&ri,">=",id,16,"<=",end,16);
+                while (raxNext(&ri)) entries++;
+            }
+        }
+        res[m].seconds = (nstime()-start)/1e9;
+        res[m].entries = entries;
+    }
+    raxStop(&ri);
+    raxFree(t);
+}
+
+/* --------------------------------------------------------------------------
+ * Reporting.
+ * -------------------------------------------------------------------------*/
+
+void reportText(benchConfig *cfg, rax *t, benchPhase *phases, int numphases,
+                int analyze)
+{
+    printf("Distribution %s (%s): %llu keys, %llu nodes\n",
+        cfg->dist->name, cfg->dist->desc,
+        (unsigned long long)t->numele, (unsigned long long)t->numnodes);
+    for (int p = 0; p < numphases; p++) {
+        benchPhase *ph = phases+p;
+        printf("  %-10s %10llu ops %9.3f sec %12.0f ops/sec\n", ph->name,
+            (unsigned long long)ph->ops, ph->seconds,
+            ph->seconds ? ph->ops/ph->seconds : 0);
+        for (int op = 0; op < OP_COUNT; op++) {
+            histogram *h = ph->hist+op;
+            if (h->count == 0) continue;
+            printf("    %-8s count %-10llu ns: min %-6llu p50 %-6llu "
+                   "p99 %-7llu p999 %-8llu max %llu\n", OpNames[op],
+                (unsigned long long)h->count,
+                (unsigned long long)h->min,
+                (unsigned long long)histPercentile(h,50),
+                (unsigned long long)histPercentile(h,99),
+                (unsigned long long)histPercentile(h,99.9),
+                (unsigned long long)h->max);
+        }
+    }
+    if (analyze) {
+        raxAnalysis a;
+        raxAnalyze(t,&a);
+        raxShowAnalysis(&a,0);
+    }
+}
+
+void reportJSON(benchConfig *cfg, rax *t, benchPhase *phases, int numphases,
+                int first, int analyze)
+{
+    printf("%s\n    {\"dist\":\"%s\",\"keys\":%llu,\"ops\":%llu,"
+           "\"seed\":%llu,\"scan\":%u,\"theta\":%g,", first ? "" : ",",
+        cfg->dist->name, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops, (unsigned long long)cfg->seed,
+        cfg->scan, cfg->theta);
+    printf("\"mix\":{");
+    for (int op = 0; op < OP_COUNT; op++)
+        printf("%s\"%s\":%u", op ? "," : "", OpNames[op], cfg->mix[op]);
+    printf("},\"numele\":%llu,\"numnodes\":%llu,\"phases\":[",
+        (unsigned long long)t->numele, (unsigned long long)t->numnodes);
+    for (int p = 0; p < numphases; p++) {
+        benchPhase *ph = phases+p;
+        printf("%s\n      {\"name\":\"%s\",\"ops\":%llu,\"seconds\":%.6f,"
+               "\"ops_per_sec\":%.1f,\"latency_ns\":{", p ? "," : "",
+            ph->name, (unsigned long long)ph->ops, ph->seconds,
+            ph->seconds ? ph->ops/ph->seconds : 0);
+        int firstop = 1;
+        for (int op = 0; op < OP_COUNT; op++) {
+            histogram *h = ph->hist+op;
+            if (h->count == 0) continue;
+            printf("%s\n        \"%s\":{\"count\":%llu,\"min\":%llu,"
+                   "\"mean\":%.1f,\"p50\":%llu,\"p99\":%llu,"
+                   "\"p999\":%llu,\"max\":%llu}",
+                firstop ? "" : ",", OpNames[op],
+                (unsigned long long)h->count, (unsigned long long)h->min,
+                h->sum/h->count,
+                (unsigned long long)histPercentile(h,50),
+                (unsigned long long)histPercentile(h,99),
+                (unsigned long long)histPercentile(h,99.9),
+                (unsigned long long)h->max);
+            firstop = 0;
+        }
+        printf("}}");
+    }
+    printf("]");
+    if (analyze) {
+        raxAnalysis a;
+        raxAnalyze(t,&a);
+        printf(",\n      \"analysis\":");
+        raxShowAnalysis(&a,1);
+    }
+    printf("}");
+}
+
+void reportThreadedText(benchConfig *cfg, int maxthreads, int lock,
+                        double tput[][MT_MAXTHREADS+1])
+{
+    printf("Distribution %s (%s): %llu keys, %llu ops per thread, %s\n",
+        cfg->dist->name, cfg->dist->desc, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops, LockNames[lock]);
+    printf("  %-10s %7s %14s %8s %10s\n", "scenario", "threads", "ops/sec",
+        "speedup", "efficiency");
+    for (int s = 0; s < MT_COUNT; s++) {
+        for (int n = 1; n <= maxthreads; n++) {
+            double speedup = tput[s][1] ? tput[s][n]/tput[s][1] : 0;
+            printf("  %-10s %7d %14.0f %8.2f %9.1f%%\n", ScenarioNames[s], n,
+                tput[s][n], speedup, speedup*100/n);
+        }
+    }
+}
+
+void reportThreadedJSON(benchConfig *cfg, int maxthreads, int lock,
+                        double tput[][MT_MAXTHREADS+1], int first)
+{
+    printf("%s\n    {\"dist\":\"%s\",\"keys\":%llu,\"ops\":%llu,"
+           "\"seed\":%llu,\"lock\":\"%s\",\"scaling\":{",
+        first ? "" : ",", cfg->dist->name, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops, (unsigned long long)cfg->seed,
+        LockNames[lock]);
+    for (int s = 0; s < MT_COUNT; s++) {
+        printf("%s\n      \"%s\":[", s ? "," : "", ScenarioNames[s]);
+        for (int n = 1; n <= maxthreads; n++) {
+            printf("%s{\"threads\":%d,\"ops_per_sec\":%.1f,"
+                   "\"speedup\":%.3f}", n > 1 ? "," : "", n, tput[s][n],
+                tput[s][1] ? tput[s][n]/tput[s][1] : 0);
+        }
+        printf("]");
+    }
+    printf("}}");
+}
+
+void reportForkText(benchConfig *cfg, forkResult *res) {
+    printf("Distribution %s (%s): %llu keys, %llu ops after fork\n",
+        cfg->dist->name, cfg->dist->desc, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops);
+    printf("  %-8s %12s %10s %12s %10s %14s\n", "policy", "memory MB",
+        "writes", "dirty pages", "dirty MB", "pages/1k writes");
+    for (int p = 0; p < FORK_COUNT; p++) {
+        forkResult *r = res+p;
+        printf("  %-8s %12.1f %10llu %12llu %10.1f %14.1f\n",
+            ForkPolicies[p], r->memory_kb/1024.0,
+            (unsigned long long)r->writes, (unsigned long long)r->dirty_pages,
+            r->dirty_pages*sysconf(_SC_PAGESIZE)/1048576.0,
+            r->writes ? r->dirty_pages*1000.0/r->writes : 0);
+    }
+}
+
+void reportForkJSON(benchConfig *cfg, forkResult *res, int first) {
+    printf("%s\n    {\"dist\":\"%s\",\"keys\":%llu,\"ops\":%llu,"
+           "\"seed\":%llu,\"fork\":[",
+        first ? "" : ",", cfg->dist->name, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops, (unsigned long long)cfg->seed);
+    for (int p = 0; p < FORK_COUNT; p++) {
+        forkResult *r = res+p;
+        printf("%s\n      {\"policy\":\"%s\",\"memory_kb\":%llu,"
+               "\"writes\":%llu,\"dirty_pages\":%llu,"
+               "\"ops_per_sec\":%.1f}",
+            p ? "," : "", ForkPolicies[p], (unsigned long long)r->memory_kb,
+            (unsigned long long)r->writes, (unsigned long long)r->dirty_pages,
+            r->ops_per_sec);
+    }
+    printf("]}");
+}
+
+void reportXrangeText(benchConfig *cfg, xrangeResult *res) {
+    printf("XRANGE: %llu stream IDs, %llu scans of up to %u entries\n",
+        (unsigned long long)cfg->keys, (unsigned long long)cfg->ops,
+        cfg->scan);
+    printf("  %-12s %10s %14s %10s %10s\n", "method", "seconds",
+        "scans/sec", "ns/scan", "ns/entry");
+    for (int m = 0; m < XRANGE_COUNT; m++) {
+        xrangeResult *r = res+m;
+        printf("  %-12s %10.3f %14.0f %10.1f %10.1f\n", XrangeMethods[m],
+            r->seconds, r->seconds ? cfg->ops/r->seconds : 0,
+            cfg->ops ? r->seconds*1e9/cfg->ops : 0,
+            r->entries ? r->seconds*1e9/r->entries : 0);
+    }
+}
+
+void reportXrangeJSON(benchConfig *cfg, xrangeResult *res) {
+    printf("{\"benchmark\":\"rax-bench\",\"xrange\":{\"keys\":%llu,"
+           "\"ops\":%llu,\"scan\":%u,\"seed\":%llu,\"methods\":[",
+        (unsigned long long)cfg->keys, (unsigned long long)cfg->ops,
+        cfg->scan, (unsigned long long)cfg->seed);
+    for (int m = 0; m < XRANGE_COUNT; m++) {
+        xrangeResult *r = res+m;
+        printf("%s\n    {\"method\":\"%s\",\"seconds\":%.6f,"
+               "\"entries\":%llu,\"scans_per_sec\":%.1f}",
+            m ? "," : "", XrangeMethods[m], r->seconds,
+            (unsigned long long)r->entries,
+            r->seconds ? cfg->ops/r->seconds : 0);
+    }
+    printf("\n]}}\n");
+}
+
+void reportScenarioText(benchConfig *cfg, benchScenario *sc, double tput,
+                        scenarioSample *samples)
+{
+    printf("Scenario %s (%s): %llu ops, %.0f ops/sec\n", sc->name, sc->desc,
+        (unsigned long long)cfg->ops, tput);
+    printf("  %12s %12s %10s %10s %12s %9s\n", "ops", "ops/sec", "keys",
+        "nodes", "bytes", "bytes/key");
+    for (int s = 0; s < SCENARIO_SAMPLES; s++) {
+        scenarioSample *sm = samples+s;
+        printf("  %12llu %12.0f %10llu %10llu %12llu %9.1f\n",
+            (unsigned long long)sm->ops, sm->ops_per_sec,
+            (unsigned long long)sm->numele, (unsigned long long)sm->numnodes,
+            (unsigned long long)sm->bytes,
+            sm->numele ? (double)sm->bytes/sm->numele : 0);
+    }
+}
+
+void reportScenarioJSON(benchConfig *cfg, benchScenario *sc, double tput,
+                        scenarioSample *samples, int first)
+{
+    printf("%s\n    {\"scenario\":\"%s\",\"keys\":%llu,\"ops\":%llu,"
+           "\"seed\":%llu,\"scan\":%u,\"ops_per_sec\":%.1f,\"samples\":[",
+        first ? "" : ",", sc->name, (unsigned long long)cfg->keys,
+        (unsigned long long)cfg->ops, (unsigned long long)cfg->seed,
+        cfg->scan, tput);
+    for (int s = 0; s < SCENARIO_SAMPLES; s++) {
+        scenarioSample *sm = samples+s;
+        printf("%s\n      {\"ops\":%llu,\"ops_per_sec\":%.1f,"
+               "\"numele\":%llu,\"numnodes\":%llu,\"bytes\":%llu}",
+            s ? "," : "", (unsigned long long)sm->ops, sm->ops_per_sec,
+            (unsigned long long)sm->numele, (unsigned long long)sm->numnodes,
+            (unsigned long long)sm->bytes);
+    }
+    printf("]}");
+}
+
+/* --------------------------------------------------------------------------
+ * Main.
+ * -------------------------------------------------------------------------*/
+
+void usage(void) {
+    fprintf(stderr,
+"Usage: rax-bench [options]\n"
+"  --dist <name|all>   Key distribution (default seq).\n"
+"  --keys <count>      Keys inserted before the operations (default 1000000).\n"
+"  --ops <count>       Operations to perform (default 1000000).\n"
+"  --mix <op=w,...>    Operations weights (default find=80,miss=5,insert=5,\n"
+"                      remove=5,seek=5). Operations: insert, find, miss,\n"
+"                      remove, seek.\n"
+"  --scan <count>      Elements visited after each seek (default 10).\n"
+"  --theta <value>     Zipf skew of the zipf distribution (default 0.99).\n"
+"  --seed <value>      PRNG seed (default 1234).\n"
+"  --json              Emit JSON instead of text.\n"
+"  --analyze           Also report the tree shape, see raxAnalyze().\n"
+"  --reserve           Call raxReserve() before populating the tree.\n"
+"  --threads <count>   Report the throughput scaling from 1 to <count>\n"
+"                      threads instead, see the threaded scenarios below.\n"
+"  --lock <type>       Lock used by the shared-rw scenario: mutex or rwlock\n"
+"                      (default rwlock).\n"
+"  --scenario <name|all> Run a Redis like scenario instead, see below.\n"
+"  --fork              Report the pages copied on write by the operations\n"
+"                      while a forked child is alive, with and without the\n"
+"                      tree arena and the values array, instead.\n"
+"  --xrange            Compare XRANGE like scans of --scan stream entries\n"
+"                      checked with raxCompare() or raxSeekRange() instead.\n"
+"Distributions:\n");
+    for (keyDist *d = KeyDists; d->name; d++)
+        fprintf(stderr,"  %-8s %s\n", d->name, d->desc);
+    fprintf(stderr,
+"Threaded scenarios (every thread performs --ops operations):\n"
+"  private    a tree with --keys keys per thread, running the mix.\n"
+"  shared-ro  lookups against a single tree, without locking.\n"
+"  shared-rw  the mix against a single tree, serialized by --lock.\n");
+    fprintf(stderr,"Scenarios (--keys is the target size of the tree):\n");
+    for (benchScenario *sc = Scenarios; sc->name; sc++)
+        fprintf(stderr,"  %-8s %s\n", sc->name, sc->desc);
+    exit(1);
+}
+
+/* Parse a mix like "find=90,insert=10". Operations not mentioned get a
+ * weight of zero. Returns 0 on success, -1 on syntax error. */
+int parseMix(benchConfig *cfg, const char *spec) {
+    memset(cfg->mix,0,sizeof(cfg->mix));
+    while (*spec) {
+        const char *eq = strchr(spec,'=');
+        if (eq == NULL) return -1;
+        int op;
+        for (op = 0; op < OP_COUNT; op++) {
+            if (strlen(OpNames[op]) == (size_t)(eq-spec) &&
+                !strncasecmp(OpNames[op],spec,eq-spec)) break;
+        }
+        if (op == OP_COUNT) return -1;
+        char *end;
+        cfg->mix[op] = strtoul(eq+1,&end,10);
+        if (end == eq+1 || (*end != ',' && *end != '\0')) return -1;
+        spec = *end ? end+1 : end;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    benchConfig cfg = {
+        .dist = NULL, .keys = 1000000, .ops = 1000000,
+        .mix = {5,80,5,5,5}, .scan = 10, .theta = 0.99, .seed = 1234
+    };
+    const char *distname = "seq";
+    const char *scenario = NULL;
+    int json = 0, analyze = 0, threads = 0, lock = LOCK_RWLOCK, forkbench = 0;
+    int xrange = 0;
+
+    for (int j = 1; j < argc; j++) {
+        int more = j+1 < argc;
+        if (!strcmp(argv[j],"--dist") && more) {
+            distname = argv[++j];
+        } else if (!strcmp(argv[j],"--keys") && more) {
+            cfg.keys = strtoull(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--ops") && more) {
+            cfg.ops = strtoull(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--mix") && more) {
+            if (parseMix(&cfg,argv[++j]) == -1) {
+                fprintf(stderr,"Invalid --mix '%s'\n", argv[j]);
+                usage();
+            }
+        } else if (!strcmp(argv[j],"--scan") && more) {
+            cfg.scan = atoi(argv[++j]);
+        } else if (!strcmp(argv[j],"--theta") && more) {
+            cfg.theta = atof(argv[++j]);
+        } else if (!strcmp(argv[j],"--seed") && more) {
+            cfg.seed = strtoull(argv[++j],NULL,10);
+        } else if (!strcmp(argv[j],"--json")) {
+            json = 1;
+        } else if (!strcmp(argv[j],"--analyze")) {
+            analyze = 1;
+        } else if (!strcmp(argv[j],"--fork")) {
+            forkbench = 1;
+        } else if (!strcmp(argv[j],"--xrange")) {
+            xrange = 1;
+        } else if (!strcmp(argv[j],"--reserve")) {
+            cfg.reserve = 1;
+        } else if (!strcmp(argv[j],"--scenario") && more) {
+            scenario = argv[++j];
+        } else if (!strcmp(argv[j],"--threads") && more) {
+            threads = atoi(argv[++j]);
+            if (threads < 1 || threads > MT_MAXTHREADS) {
+                fprintf(stderr,"--threads must be in the 1-%d range\n",
+                    MT_MAXTHREADS);
+                exit(1);
+            }
+        } else if (!strcmp(argv[j],"--lock") && more) {
+            j++;
+            if (!strcmp(argv[j],"mutex")) lock = LOCK_MUTEX;
+            else if (!strcmp(argv[j],"rwlock")) lock = LOCK_RWLOCK;
+            else usage();
+        } else {
+            usage();
+        }
+    }
+    if (cfg.theta <= 0 || cfg.theta >= 1) {
+        fprintf(stderr,"--theta must be in the (0,1) range\n");
+        exit(1);
+    }
+
+    if (xrange) {
+        xrangeResult res[XRANGE_COUNT];
+        benchXrange(&cfg,res);
+        if (json)
+            reportXrangeJSON(&cfg,res);
+        else
+            reportXrangeText(&cfg,res);
+        return 0;
+    }
+
+    if (scenario) {
+        int all = !strcmp(scenario,"all"), first = 1;
+        if (json) printf("{\"benchmark\":\"rax-bench\",\"scenarios\":[");
+        for (benchScenario *sc = Scenarios; sc->name; sc++) {
+            if (!all && strcmp(sc->name,scenario)) continue;
+            scenarioSample samples[SCENARIO_SAMPLES];
+            rc4srand(cfg.seed);
+            double tput = benchScenarioRun(&cfg,sc,samples);
+            if (json)
+                reportScenarioJSON(&cfg,sc,tput,samples,first);
+            else
+                reportScenarioText(&cfg,sc,tput,samples);
+            first = 0;
+        }
+        if (json) printf("\n]}\n");
+        if (first) {
+            fprintf(stderr,"Unknown scenario '%s'\n", scenario);
+            usage();
+        }
+        return 0;
+    }
+
+    int all = !strcmp(distname,"all");
+    int found = 0, first = 1;
+    if (json) printf("{\"benchmark\":\"rax-bench\",\"runs\":[");
+    for (keyDist *d = KeyDists; d->name; d++) {
+        if (!all && strcmp(d->name,distname)) continue;
+        found = 1;
+
+        benchConfig run = cfg;
+        run.dist = d;
+        size_t bufsize = KEY_MAXLEN;
+        if (d->gen == keyChain) {
+            if (run.keys > CHAIN_MAXKEYS) run.keys = CHAIN_MAXKEYS;
+            bufsize = run.keys*2+1; /* Misses use indexes up to 2*keys. */
+        }
+        KeyBuf = malloc(bufsize);
+        rc4srand(run.seed);
+
+        if (threads) {
+            static double tput[MT_COUNT][MT_MAXTHREADS+1];
+            benchThreaded(&run,threads,lock,bufsize,tput);
+            if (json)
+                reportThreadedJSON(&run,threads,lock,tput,first);
+            else
+                reportThreadedText(&run,threads,lock,tput);
+            first = 0;
+            free(KeyBuf);
+            continue;
+        }
+
+        if (forkbench) {
+            forkResult res[FORK_COUNT];
+            for (int p = 0; p < FORK_COUNT; p++) {
+                rc4srand(run.seed);
+                benchForkRun(&run,p,res+p);
+            }
+            if (json)
+                reportForkJSON(&run,res,first);
+            else
+                reportForkText(&run,res);
+            first = 0;
+            free(KeyBuf);
+            continue;
+        }
+
+        static benchPhase phases[2];
+        for (int p = 0; p < 2; p++)
+            for (int op = 0; op < OP_COUNT; op++)
+                histReset(&phases[p].hist[op]);
+        phases[0].name = "populate";
+        phases[1].name = "operations";
+
+        rax *t = raxNew();
+        benchPopulate(&run,t,&phases[0]);
+        benchOperations(&run,t,&phases[1]);
+        if (json)
+            reportJSON(&run,t,phases,2,first,analyze);
+        else
+            reportText(&run,t,phases,2,analyze);
+        first = 0;
+        raxFree(t);
+        free(KeyBuf);
+    }
+    if (json) printf("\n]}\n");
+    if (!found) {
+        fprintf(stderr,"Unknown distribution '%s'\n", distname);
+        usage();
+    }
+    return 0;
+}
@@ -0,0 +1,213 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Example of lookups interleaved by a C++20 coroutine scheduler, and
+ * benchmark against plain raxFind().
+ *
+ * Every worker coroutine looks up a share of the keys, suspending after
+ * each raxLookupStep(), that returns after prefetching the next node. The
+ * scheduler resumes the workers round robin, so while a worker waits for
+ * its node to reach the cache the others make progress. Lookups are also
+ * interleaved by a plain loop driving raxLookupState machines, in order to
+ * show the cost of the coroutines themselves. The output uses the Google
+ * Benchmark console format like rax-cpp-bench:
+ *
+ *   ./rax-coro [numkeys] [group]
+ *
+ * where 'group' is the number of lookups in flight (8 by default). */
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "rax.hpp"
+
+namespace rc = rax::c;
+
+/* Minimal coroutine type: it starts suspended, and the scheduler owns the
+ * handle, resuming it until done(). */
+struct task {
+    struct promise_type {
+        task get_return_object() {
+            return task{std::coroutine_handle<promise_type>::from_promise(
+                *this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+    std::coroutine_handle<promise_type> h;
+};
+
+/* Look up the keys at positions first, first+stride, ... of 'order',
+ * yielding to the scheduler every time the lookup waits for memory. */
+static task worker(rc::rax *t, const std::vector<std::string> &keys,
+                   const std::vector<size_t> &order, size_t first,
+                   size_t stride, uint64_t *sum) {
+    for (size_t j = first; j < order.size(); j += stride) {
+        const std::string &k = keys[order[j]];
+        rc::raxLookupState ls;
+        rc::raxLookupStart(&ls, t, (unsigned char*)k.data(), k.size());
+        while (rc::raxLookupStep(&ls)) co_await std::suspend_always{};
+        if (ls.value != rc::raxNotFound) *sum += (uintptr_t)ls.value;
+    }
+}
+
+/* Round robin scheduler: resumes every worker in turn until all are done.
+ * A real scheduler would interleave other work in the same way. */
+static void schedule(std::vector<task> &tasks) {
+    size_t active = tasks.size();
+    while (active) {
+        active = 0;
+        for (task &t : tasks) {
+            if (t.h.done()) continue;
+            t.h.resume();
+            active++;
+        }
+    }
+    for (task &t : tasks) t.h.destroy();
+}
+
+/* The same interleaving without coroutines: 'group' state machines, each
+ * one started with the next key as soon as its lookup is done. */
+static uint64_t interleave(rc::rax *t, const std::vector<std::string> &keys,
+                           const std::vector<size_t> &order, size_t group) {
+    std::vector<rc::raxLookupState> ls(group);
+    size_t next = 0, inflight = 0;
+    uint64_t sum = 0;
+
+    auto start = [&](rc::raxLookupState &s) {
+        const std::string &k = keys[order[next++]];
+        rc::raxLookupStart(&s, t, (unsigned char*)k.data(), k.size());
+    };
+    while (inflight < group && next < order.size()) start(ls[inflight++]);
+    while (inflight) {
+        for (size_t j = 0; j < inflight; j++) {
+            if (rc::raxLookupStep(&ls[j])) continue;
+            if (ls[j].value != rc::raxNotFound) sum += (uintptr_t)ls[j].value;
+            if (next < order.size()) {
+                start(ls[j]);
+            } else {
+                ls[j--] = ls[--inflight];
+            }
+        }
+    }
+    return sum;
+}
+
+/* Keep the compiler from optimizing away results. */
+static volatile uint64_t sink;
+
+/* Measures both wall clock and CPU time of a benchmark phase. */
+struct timer {
+    std::chrono::steady_clock::time_point wall;
+    std::clock_t cpu;
+    timer() { reset(); }
+    void reset() {
+        wall = std::chrono::steady_clock::now();
+        cpu = std::clock();
+    }
+};
+
+static void report(const char *bench, const char *method, size_t n,
+                   timer &t, size_t iterations) {
+    auto wall = std::chrono::steady_clock::now() - t.wall;
+    double cpu_ns = (double)(std::clock() - t.cpu) * 1e9 / CLOCKS_PER_SEC;
+    char name[128];
+    std::snprintf(name, sizeof(name), "BM_%s<%s>/%zu", bench, method, n);
+    std::printf("%-48s %10.1f ns %10.1f ns %12zu\n", name,
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(wall)
+            .count() / iterations,
+        cpu_ns / iterations, iterations);
+    t.reset();
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t group = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+    if (n == 0 || group == 0) {
+        std::fprintf(stderr, "Usage: %s [numkeys] [group]\n", argv[0]);
+        return 1;
+    }
+
+    /* Same keys of rax-cpp-bench, looked up in random order. */
+    std::mt19937_64 rng(1234);
+    std::vector<std::string> keys;
+    std::vector<size_t> order(n);
+    keys.reserve(n);
+    rc::rax *t = rc::raxNew();
+    for (size_t j = 0; j < n; j++) {
+        char buf[64];
+        std::snprintf(buf, sizeof(buf), "user:%llu:session",
+                      (unsigned long long)(rng() % (n*10)));
+        keys.push_back(buf);
+        rc::raxInsert(t, (unsigned char*)buf, keys.back().size(),
+                      (void*)(uintptr_t)(j+1), nullptr);
+        order[j] = j;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::printf("%-48s %13s %13s %12s\n", "Benchmark", "Time", "CPU",
+                "Iterations");
+    std::printf("%s\n", std::string(90, '-').c_str());
+
+    uint64_t expected = 0, sum;
+    timer tm;
+    for (size_t j = 0; j < n; j++) {
+        const std::string &k = keys[order[j]];
+        expected += (uintptr_t)rc::raxFind(t, (unsigned char*)k.data(),
+                                           k.size());
+    }
+    report("Lookup", "raxFind", n, tm, n);
+
+    sum = interleave(t, keys, order, group);
+    report("Lookup", "raxLookupStep", n, tm, n);
+    if (sum != expected) std::printf("Mismatch with raxFind()\n");
+
+    sum = 0;
+    std::vector<task> tasks;
+    for (size_t j = 0; j < group; j++)
+        tasks.push_back(worker(t, keys, order, j, group, &sum));
+    schedule(tasks);
+    report("Lookup", "coroutines", n, tm, n);
+    if (sum != expected) std::printf("Mismatch with raxFind()\n");
+
+    sink = sum;
+    rc::raxFree(t);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Benchmark of rax::map against std::map and std::unordered_map.
+ *
+ * The output follows the Google Benchmark console format, so that results
+ * can be compared with the usual tools, but the harness is self contained
+ * in order to avoid external dependencies:
+ *
+ *   ./rax-cpp-bench [numkeys]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rax.hpp"
+
+/* Adapters exposing the same operations for every container. */
+struct raxAdapter {
+    static constexpr const char *name = "rax::map";
+    rax::map<uint64_t> m;
+    void insert(const std::string &k, uint64_t v) { m.try_emplace(k, v); }
+    uint64_t find(const std::string &k) { return m.lookup(k).value_or(0); }
+    uint64_t iterate() {
+        uint64_t sum = 0;
+        for (auto [k, v] : m) sum += v;
+        return sum;
+    }
+    void erase(const std::string &k) { m.erase(k); }
+};
+
+struct stdMapAdapter {
+    static constexpr const char *name = "std::map";
+    std::map<std::string, uint64_t, std::less<>> m;
+    void insert(const std::string &k, uint64_t v) { m.try_emplace(k, v); }
+    uint64_t find(const std::string &k) {
+        auto it = m.find(k);
+        return it == m.end() ? 0 : it->second;
+    }
+    uint64_t iterate() {
+        uint64_t sum = 0;
+        for (auto &kv : m) sum += kv.second;
+        return sum;
+    }
+    void erase(const std::string &k) { m.erase(k); }
+};
+
+struct unorderedMapAdapter {
+    static constexpr const char *name = "std::unordered_map";
+    std::unordered_map<std::string, uint64_t> m;
+    void insert(const std::string &k, uint64_t v) { m.try_emplace(k, v); }
+    uint64_t find(const std::string &k) {
+        auto it = m.find(k);
+        return it == m.end() ? 0 : it->second;
+    }
+    uint64_t iterate() {
+        uint64_t sum = 0;
+        for (auto &kv : m) sum += kv.second;
+        return sum;
+    }
+    void erase(const std::string &k) { m.erase(k); }
+};
+
+/* Keep the compiler from optimizing away results. */
+static volatile uint64_t sink;
+
+/* Measures both wall clock and CPU time of a benchmark phase. */
+struct timer {
+    std::chrono::steady_clock::time_point wall;
+    std::clock_t cpu;
+    timer() { reset(); }
+    void reset() {
+        wall = std::chrono::steady_clock::now();
+        cpu = std::clock();
+    }
+};
+
+static void report(const char *bench, const char *container, size_t n,
+                   timer &t, size_t iterations) {
+    auto wall = std::chrono::steady_clock::now() - t.wall;
+    double cpu_ns = (double)(std::clock() - t.cpu) * 1e9 / CLOCKS_PER_SEC;
+    char name[128];
+    std::snprintf(name, sizeof(name), "BM_%s<%s>/%zu", bench, container, n);
+    std::printf("%-48s %10.1f ns %10.1f ns %12zu\n", name,
+        (double)std::chrono::duration_cast<std::chrono::nanoseconds>(wall)
+            .count() / iterations,
+        cpu_ns / iterations, iterations);
+    t.reset();
+}
+
+template <class Adapter>
+static void runBenchmarks(const std::vector<std::string> &keys,
+                          const std::vector<std::string> &missing,
+                          const std::vector<size_t> &order) {
+    Adapter a;
+    size_t n = keys.size();
+    uint64_t sum = 0;
+
+    timer t;
+    for (size_t j = 0; j < n; j++) a.insert(keys[j], j);
+    report("Insert", Adapter::name, n, t, n);
+
+    for (size_t j = 0; j < n; j++) sum += a.find(keys[order[j]]);
+    report("LookupHit", Adapter::name, n, t, n);
+
+    for (size_t j = 0; j < n; j++) sum += a.find(missing[j]);
+    report("LookupMiss", Adapter::name, n, t, n);
+
+    sum += a.iterate();
+    report("Iterate", Adapter::name, n, t, n);
+
+    for (size_t j = 0; j < n; j++) a.erase(keys[order[j]]);
+    report("Erase", Adapter::name, n, t, n);
+    sink = sum;
+}
+
+int main(int argc, char **argv) {
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    /* Keys share prefixes like real world keys, values are not important.
+     * Missing keys have the same shape but a different suffix. */
+    std::mt19937_64 rng(1234);
+    std::vector<std::string> keys, missing;
+    std::vector<size_t> order(n);
+    keys.reserve(n);
+    missing.reserve(n);
+    for (size_t j = 0; j < n; j++) {
+        char buf[64];
+        uint64_t r = rng();
+        std::snprintf(buf, sizeof(buf), "user:%llu:session",
+                      (unsigned long long)(r % (n*10)));
+        keys.push_back(buf);
+        std::snprintf(buf, sizeof(buf), "user:%llu:sessioN",
+                      (unsigned long long)(r % (n*10)));
+        missing.push_back(buf);
+        order[j] = j;
+    }
+    std::shuffle(order.begin(), order.end(), rng);
+
+    std::printf("%-48s %13s %13s %12s\n", "Benchmark", "Time", "CPU",
+                "Iterations");
+    std::printf("%s\n", std::string(90, '-').c_str());
+    runBenchmarks<raxAdapter>(keys, missing, order);
+    runBenchmarks<stdMapAdapter>(keys, missing, order);
+    runBenchmarks<unorderedMapAdapter>(keys, missing, order);
+    return 0;
+}
@@ -0,0 +1,178 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Tests for the rax::map C++ wrapper in rax.hpp. */
+
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+
+#include "rax.hpp"
+
+static int errors = 0;
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        errors++; \
+    } \
+} while(0)
+
+/* Count live instances to detect leaks and double destructions. */
+struct tracked {
+    static int live;
+    int v;
+    explicit tracked(int val) : v(val) { live++; }
+    tracked(tracked &&o) noexcept : v(o.v) { live++; }
+    tracked(const tracked &) = delete;
+    ~tracked() { live--; }
+};
+int tracked::live = 0;
+
+static void testInlineValues() {
+    rax::map<int> m;
+    static_assert(rax::map<int>::inline_values);
+    check(m.try_emplace("b", 2).second);
+    check(m.try_emplace("a", 1).second);
+    auto r = m.try_emplace("a", 100);
+    check(!r.second && r.first == 1);
+    check(!m.insert_or_assign("a", 10));
+    check(m.insert_or_assign("c", 0)); /* Zero uses the isnull encoding. */
+    check(m.at("a") == 10 && m.at("c") == 0 && m.size() == 3);
+    check(m.lookup("c") == 0 && !m.lookup("d"));
+
+    std::string keys;
+    for (auto [key, val] : m) { keys += key; (void)val; }
+    check(keys == "abc");
+
+    auto it = m.end();
+    --it;
+    check(it.key() == "c");
+    --it;
+    check(it.key() == "b" && it.value() == 2);
+    auto copy = it;
+    ++it;
+    check(copy.key() == "b" && it.key() == "c");
+
+    check(m.extract("b") == 2 && !m.extract("b"));
+    check(m.find("b") == m.end() && m.lower_bound("b").key() == "c");
+    auto next = m.erase(m.find("a"));
+    check(next.key() == "c" && m.size() == 1);
+}
+
+static void testMoveOnlyValues() {
+    {
+        rax::map<std::unique_ptr<tracked>> m;
+        static_assert(!rax::map<std::unique_ptr<tracked>>::inline_values);
+        m.try_emplace("x", std::make_unique<tracked>(1));
+        m.try_emplace("y", std::make_unique<tracked>(2));
+        /* Not inserted: the argument is left untouched. */
+        auto p = std::make_unique<tracked>(3);
+        check(!m.try_emplace("x", std::move(p)).second && p != nullptr);
+        p.reset();
+        check(tracked::live == 2);
+
+        auto v = m.extract("x");
+        check(v && (*v)->v == 1 && m.size() == 1);
+        v.reset();
+        check(tracked::live == 1);
+
+        rax::map<std::unique_ptr<tracked>> other(std::move(m));
+        check(other.at("y")->v == 2 && (*other.lookup("y"))->v == 2);
+        check(other.lookup("x") == nullptr);
+        m = std::move(other);
+        check(m.size() == 1 && tracked::live == 1);
+    }
+    check(tracked::live == 0);
+
+    {
+        rax::map<tracked> m;
+        m.try_emplace("k", 5);
+        m.insert_or_assign("k", tracked(6));
+        check(m.at("k").v == 6 && tracked::live == 1);
+        m.clear();
+        check(tracked::live == 0 && m.empty());
+    }
+}
+
+/* A moved from map is empty and can be used again. */
+static void testMovedFrom() {
+    rax::map<std::unique_ptr<tracked>> m;
+    m.try_emplace("a", std::make_unique<tracked>(1));
+    rax::map<std::unique_ptr<tracked>> other(std::move(m));
+    check(m.empty() && !m.contains("a") && !m.lookup("a"));
+    check(m.begin() == m.end() && m.find("a") == m.end());
+    check(m.erase("a") == 0 && !m.extract("a"));
+    m.clear();
+    check(m.try_emplace("b", std::make_unique<tracked>(2)).second);
+    check(m.size() == 1 && m.at("b")->v == 2);
+
+    other = std::move(m);
+    check(m.try_emplace("c", std::make_unique<tracked>(3)).second);
+    check(m.insert_or_assign("d", std::make_unique<tracked>(4)));
+    check(m.size() == 2 && m.begin().key() == "c");
+    check(other.size() == 1 && tracked::live == 3);
+
+    /* at() on a const map gives read only access to the value. */
+    const auto &cm = m;
+    static_assert(std::is_same_v<decltype(cm.at("c")),
+                                 const std::unique_ptr<tracked> &>);
+    check(cm.at("c")->v == 3);
+}
+
+static void testPmr() {
+    char buffer[4096];
+    std::pmr::monotonic_buffer_resource res(buffer, sizeof(buffer));
+    rax::pmr::map<std::string> m(&res);
+    m.try_emplace("hello", "world, long enough to avoid the small string");
+    check(m.at("hello").size() > 20);
+    check(m.get_allocator().resource() == &res);
+
+    /* Moving between maps with different resources moves element-wise. */
+    rax::pmr::map<std::string> other;
+    other = std::move(m);
+    check(other.at("hello").size() > 20 && m.empty());
+}
+
+int main() {
+    testInlineValues();
+    testMoveOnlyValues();
+    testMovedFrom();
+    check(tracked::live == 0);
+    testPmr();
+    if (errors) {
+        std::printf("!!! WARNING !!!: %d errors found\n", errors);
+        return 1;
+    }
+    std::printf("OK! \\o/\n");
+    return 0;
+}
@@ -0,0 +1,295 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* rax-gen: compile a fixed dictionary into a radix tree stored as constant
+ * data, so that keyword tables (commands, headers, ...) need no startup
+ * cost and no heap allocation at all.
+ *
+ * The tool reads a list of keys, optionally followed by a tab character and
+ * a C expression used as value, builds the tree with the normal raxInsert()
+ * code, and finally emits a C source file where every node is a static const
+ * object with exactly the same memory layout rax.c expects. The resulting
+ * tree can be used with raxFind(), raxSeek(), raxNext(), raxPrev(),
+ * raxCompare() and all the other read only functions.
+ *
+ * Input format, one element per line:
+ *
+ *   get\t&getCommand
+ *   set\t&setCommand
+ *   ping
+ *
+ * Lines without value are stored with a NULL value (so they use the isnull
+ * encoding and no value slot). Empty lines and lines starting with '#' are
+ * skipped. Keys are binary safe, the escapes \\, \t, \n, \r and \xHH can be
+ * used in order to represent arbitrary bytes.
+ *
+ * Usage: rax-gen <name> [input-file] > output.c
+ *
+ * The generated file defines 'const rax <name>'. Since the node headers are
+ * bitfields, the output is only valid for the same compiler, ABI and
+ * RAX_SMALL_HEADER setting used to build rax-gen itself: this is checked at
+ * compile time in the generated file. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "rax.h"
+
+/* Must match the padding rule used by rax.c in order to store child
+ * pointers at aligned addresses. With RAX_SMALL_HEADER there is no padding,
+ * and the node structures are emitted packed. */
+#ifdef RAX_SMALL_HEADER
+#define genPadding(nodesize) ((void)(nodesize),0)
+#define GEN_HDR_TYPE "uint16_t"
+#define GEN_HDR_FMT "0x%04lx"
+typedef uint16_t genHeader;
+#else
+#define genPadding(nodesize) ((sizeof(void*)-((nodesize+4) % sizeof(void*))) & (sizeof(void*)-1))
+#define GEN_HDR_TYPE "uint32_t"
+#define GEN_HDR_FMT "0x%08lx"
+typedef uint32_t genHeader;
+#endif
+
+/* Table of value expressions: the tree we build stores as value the
+ * index+1 of the expression in this table, so that zero means NULL. */
+static char **values = NULL;
+static size_t numvalues = 0;
+
+static const char *treename;
+static unsigned long nextid = 0;
+
+/* Read a full line from 'fp' into a heap allocated buffer, without the
+ * trailing newline. Returns NULL on EOF. */
+static char *genReadLine(FILE *fp, size_t *len) {
+    size_t cap = 128, used = 0;
+    char *buf = malloc(cap);
+    if (buf == NULL) return NULL;
+    while (fgets(buf+used,cap-used,fp) != NULL) {
+        used += strlen(buf+used);
+        if (used && buf[used-1] == '\n') break;
+        if (used == cap-1) {
+            cap *= 2;
+            char *newbuf = realloc(buf,cap);
+            if (newbuf == NULL) {
+                free(buf);
+                return NULL;
+            }
+            buf = newbuf;
+        }
+    }
+    if (used == 0 && feof(fp)) {
+        free(buf);
+        return NULL;
+    }
+    if (used && buf[used-1] == '\n') buf[--used] = '\0';
+    if (used && buf[used-1] == '\r') buf[--used] = '\0';
+    *len = used;
+    return buf;
+}
+
+/* Unescape the key in place, returning the new length, or -1 on invalid
+ * escape sequences. */
+static long genUnescape(char *s, size_t len) {
+    size_t i = 0, j = 0;
+    while (i < len) {
+        if (s[i] != '\\') {
+            s[j++] = s[i++];
+            continue;
+        }
+        if (i+1 == len) return -1;
+        switch(s[i+1]) {
+        case '\\': s[j++] = '\\'; i += 2; break;
+        case 't': s[j++] = '\t'; i += 2; break;
+        case 'n': s[j++] = '\n'; i += 2; break;
+        case 'r': s[j++] = '\r'; i += 2; break;
+        case 'x':
+            if (i+3 >= len || !isxdigit((unsigned char)s[i+2]) ||
+                                !isxdigit((unsigned char)s[i+3])) return -1;
+            {
+                char hex[3] = {s[i+2],s[i+3],'\0'};
+                s[j++] = (char)strtol(hex,NULL,16);
+            }
+            i += 4;
+            break;
+        default: return -1;
+        }
+    }
+    return j;
+}
+
+/* Emit the node 'n' and, before it, all its children, so that every object
+ * is defined before being referenced. Returns the id of the emitted node. */
+static unsigned long genEmitNode(FILE *out, raxNode *n) {
+    int numchildren = n->iscompr ? 1 : n->size;
+    int hasvalue = n->iskey && !n->isnull;
+    size_t datalen = n->size+genPadding(n->size);
+    raxNode **cp = (raxNode**)(n->data+datalen);
+    unsigned long *ids = NULL;
+
+    if (numchildren) {
+        ids = malloc(sizeof(unsigned long)*numchildren);
+        if (ids == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(1);
+        }
+        for (int j = 0; j < numchildren; j++) {
+            raxNode *child;
+            memcpy(&child,cp+j,sizeof(child));
+            ids[j] = genEmitNode(out,child);
+        }
+    }
+
+    /* The header is emitted as an opaque integer, copied from the
+     * in-memory representation of the bitfield. */
+    genHeader hdr;
+    memcpy(&hdr,n,sizeof(hdr));
+    unsigned long id = nextid++;
+
+    fprintf(out,"static const struct {\n    " GEN_HDR_TYPE " hdr;\n");
+    if (datalen) fprintf(out,"    unsigned char data[%zu];\n", datalen);
+    if (numchildren+hasvalue)
+        fprintf(out,"    const void *ptr[%d];\n", numchildren+hasvalue);
+    fprintf(out,"} %s_n%lu = {\n    " GEN_HDR_FMT ",\n", treename, id,
+        (unsigned long)hdr);
+    if (datalen) {
+        fprintf(out,"    {");
+        for (size_t j = 0; j < datalen; j++) {
+            if (j && (j % 16) == 0) fprintf(out,"\n     ");
+            fprintf(out,"%u%s", j < n->size ? n->data[j] : 0,
+                j == datalen-1 ? "" : ",");
+        }
+        fprintf(out,"},\n");
+    }
+    if (numchildren+hasvalue) {
+        fprintf(out,"    {");
+        for (int j = 0; j < numchildren; j++)
+            fprintf(out,"%s&%s_n%lu", j ? "," : "", treename, ids[j]);
+        if (hasvalue) {
+            void *data;
+            memcpy(&data,cp+numchildren,sizeof(data));
+            fprintf(out,"%s(const void*)(%s)", numchildren ? "," : "",
+                values[(size_t)data-1]);
+        }
+        fprintf(out,"}\n");
+    }
+    fprintf(out,"};\n\n");
+    free(ids);
+    return id;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr,"Usage: %s <name> [input-file] > output.c\n",argv[0]);
+        exit(1);
+    }
+    treename = argv[1];
+    FILE *in = stdin;
+    if (argc == 3) {
+        in = fopen(argv[2],"r");
+        if (in == NULL) {
+            perror("Opening input file");
+            exit(1);
+        }
+    }
+
+    rax *t = raxNew();
+    char *line;
+    size_t len;
+    unsigned long lineno = 0;
+    while ((line = genReadLine(in,&len)) != NULL) {
+        lineno++;
+        if (len == 0 || line[0] == '#') {
+            free(line);
+            continue;
+        }
+        char *tab = memchr(line,'\t',len);
+        size_t keylen = tab ? (size_t)(tab-line) : len;
+        void *data = NULL;
+        if (tab && tab[1] != '\0') {
+            char **newvalues = realloc(values,sizeof(char*)*(numvalues+1));
+            if (newvalues == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(1);
+            }
+            values = newvalues;
+            size_t vlen = len-keylen-1;
+            values[numvalues] = malloc(vlen+1);
+            if (values[numvalues] == NULL) {
+                fprintf(stderr,"Out of memory\n");
+                exit(1);
+            }
+            memcpy(values[numvalues],tab+1,vlen+1);
+            numvalues++;
+            data = (void*)numvalues;
+        }
+        long klen = genUnescape(line,keylen);
+        if (klen < 0) {
+            fprintf(stderr,"Invalid escape in key at line %lu\n",lineno);
+            exit(1);
+        }
+        if (raxInsert(t,(unsigned char*)line,klen,data,NULL) == 0) {
+            fprintf(stderr,"Warning: duplicated key at line %lu, "
+                           "the last value wins\n",lineno);
+        }
+        free(line);
+    }
+    if (in != stdin) fclose(in);
+
+    FILE *out = stdout;
+    fprintf(out,"/* Generated by rax-gen. Do not edit.\n"
+                " *\n"
+                " * Use it with: extern const rax %s;\n"
+                " * and pass (rax*)&%s to read only rax functions. */\n\n"
+                "#include <stdint.h>\n#include <stddef.h>\n#include \"rax.h\"\n\n",
+                treename, treename);
+    fprintf(out,"/* Check that the layout matches the one of the host "
+                "that generated the file. */\n"
+                "typedef char %s_layout_check[(sizeof(raxNode) == %zu && "
+                "sizeof(void*) == %zu) ? 1 : -1];\n\n",
+                treename, sizeof(raxNode), sizeof(void*));
+#ifdef RAX_SMALL_HEADER
+    fprintf(out,"#pragma pack(push,1)\n\n");
+#endif
+    unsigned long headid = genEmitNode(out,t->head);
+#ifdef RAX_SMALL_HEADER
+    fprintf(out,"#pragma pack(pop)\n\n");
+#endif
+    fprintf(out,"const rax %s = {.head = (raxNode*)&%s_n%lu,\n"
+                "    .numele = %llu, .numnodes = %llu};\n",
+        treename, treename, headid,
+        (unsigned long long)t->numele, (unsigned long long)t->numnodes);
+
+    raxFree(t);
+    for (size_t j = 0; j < numvalues; j++) free(values[j]);
+    free(values);
+    return 0;
+}
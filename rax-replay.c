@@ -0,0 +1,403 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* rax-replay: replay a workload recorded with raxRecordStart().
+ *
+ * The whole recording is loaded in memory, then the operations are
+ * performed again at full speed, timing every single one of them into a
+ * latency histogram per operation type. The result of every operation is
+ * compared with the recorded one: mismatches mean that the replayed tree
+ * does not match the recorded one, usually because the trees were already
+ * populated when the recording started.
+ *
+ * rax-replay.o only uses pointers to the rax structure, so it can be linked
+ * with any build of rax.c, for instance rax-stats.o in order to also report
+ * the operation counters. */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rax.h"
+#include "rax_record.h"
+#include "histogram.h"
+#include "perfcount.h"
+
+#define NUM_OPS (RAX_OP_FREE+1)
+
+static const char *OpNames[NUM_OPS] = {
+    "insert", "tryinsert", "remove", "find", "seek", "next", "prev",
+    "new", "free"
+};
+
+/* A recorded operation. Keys are stored in a single buffer. */
+typedef struct replayOp {
+    unsigned char op;
+    unsigned char result;
+    unsigned char seek;     /* Index in raxRecordSeekOps, 255 if invalid. */
+    uint32_t tree;
+    uint32_t iter;
+    size_t key_off;
+    size_t key_len;
+} replayOp;
+
+typedef struct replayIter {
+    raxIterator it;
+    uint32_t tree;
+    int started;
+} replayIter;
+
+static replayOp *Ops;
+static size_t NumOps;
+static unsigned char *Keys;
+static uint32_t NumTrees, NumIters;
+static rax **Trees;
+static replayIter **Iters;
+static raxStats Stats;
+static int HaveStats;
+
+static uint64_t nstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void *zrealloc(void *ptr, size_t size) {
+    ptr = realloc(ptr,size);
+    if (ptr == NULL) {
+        fprintf(stderr,"Out of memory loading the recording\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+/* Load the recording in memory. Exits on error. */
+void loadRecording(const char *filename) {
+    raxRecordReader r;
+    raxRecord rec;
+    size_t opsalloc = 0, keyslen = 0, keysalloc = 0;
+    int retval;
+
+    if (!raxRecordOpen(&r,filename)) {
+        fprintf(stderr,"Can't open the recording %s: %s\n", filename,
+            errno == EINVAL ? "not a Rax recording" : strerror(errno));
+        exit(1);
+    }
+    while ((retval = raxRecordNext(&r,&rec)) == 1) {
+        if (rec.tree >= UINT32_MAX || rec.iter >= UINT32_MAX) {
+            retval = -1;
+            break;
+        }
+        if (NumOps == opsalloc) {
+            opsalloc = opsalloc ? opsalloc*2 : 4096;
+            Ops = zrealloc(Ops,sizeof(replayOp)*opsalloc);
+        }
+        if (keyslen+rec.key_len > keysalloc) {
+            keysalloc = (keyslen+rec.key_len)*2+4096;
+            Keys = zrealloc(Keys,keysalloc);
+        }
+        replayOp *op = Ops+NumOps++;
+        op->op = rec.op;
+        op->result = rec.result;
+        op->seek = 255;
+        for (int j = 0; rec.seek_op && j < RAX_RECORD_SEEK_OPS; j++)
+            if (rec.seek_op == raxRecordSeekOps[j]) op->seek = j;
+        op->tree = rec.tree;
+        op->iter = rec.iter;
+        op->key_off = keyslen;
+        op->key_len = rec.key_len;
+        if (rec.key_len) memcpy(Keys+keyslen,rec.key,rec.key_len);
+        keyslen += rec.key_len;
+        if (rec.tree >= NumTrees) NumTrees = rec.tree+1;
+        if ((rec.op == RAX_OP_SEEK || rec.op == RAX_OP_NEXT ||
+             rec.op == RAX_OP_PREV) && rec.iter >= NumIters)
+            NumIters = rec.iter+1;
+    }
+    raxRecordClose(&r);
+    if (retval == -1) {
+        fprintf(stderr,"Recording %s is corrupted or truncated after "
+                       "%zu operations\n", filename, NumOps);
+        exit(1);
+    }
+}
+
+/* Add the operation counters of the tree to the totals, if the tree has
+ * them, then free it. */
+void freeTree(uint32_t id) {
+    raxStats st;
+    if (raxGetStats(Trees[id],&st)) {
+        Stats.walks += st.walks;
+        Stats.nodes_visited += st.nodes_visited;
+        Stats.compr_bytes += st.compr_bytes;
+        Stats.edge_bytes += st.edge_bytes;
+        Stats.addchild_reallocs += st.addchild_reallocs;
+        Stats.splits_algo1 += st.splits_algo1;
+        Stats.splits_algo2 += st.splits_algo2;
+        Stats.recompressions += st.recompressions;
+        Stats.recompressed_nodes += st.recompressed_nodes;
+        HaveStats = 1;
+    }
+    for (uint32_t j = 0; j < NumIters; j++) {
+        if (Iters[j]->started && Iters[j]->tree == id) {
+            raxStop(&Iters[j]->it);
+            Iters[j]->started = 0;
+        }
+    }
+    raxFree(Trees[id]);
+    Trees[id] = NULL;
+}
+
+/* Trees the recording refers to without having seen them created were
+ * created before the recording started: they are replayed starting from
+ * an empty tree. */
+static rax *getTree(uint32_t id) {
+    if (Trees[id] == NULL) Trees[id] = raxNew();
+    return Trees[id];
+}
+
+static raxIterator *getIter(uint32_t id, uint32_t tree) {
+    replayIter *ri = Iters[id];
+    if (ri->started && ri->tree != tree) {
+        raxStop(&ri->it);
+        ri->started = 0;
+    }
+    if (!ri->started) {
+        raxStart(&ri->it,getTree(tree));
+        ri->tree = tree;
+        ri->started = 1;
+    }
+    return &ri->it;
+}
+
+/* Replay all the operations. Returns the total time spent in operations,
+ * in nanoseconds. */
+uint64_t replay(histogram *hist, uint64_t *mismatches) {
+    uint64_t total = 0;
+    for (size_t j = 0; j < NumOps; j++) {
+        replayOp *op = Ops+j;
+        unsigned char *key = Keys+op->key_off;
+        const char *seekop = op->seek < RAX_RECORD_SEEK_OPS ?
+                             raxRecordSeekOps[op->seek] : "?";
+        raxIterator *it = NULL;
+        rax *t = NULL;
+        int result = 0;
+
+        /* Resolve trees and iterators before starting the clock. */
+        if (op->op == RAX_OP_NEW) {
+            if (Trees[op->tree]) freeTree(op->tree);
+        } else if (op->op == RAX_OP_SEEK || op->op == RAX_OP_NEXT ||
+                   op->op == RAX_OP_PREV) {
+            it = getIter(op->iter,op->tree);
+        } else {
+            t = getTree(op->tree);
+        }
+
+        uint64_t t0 = nstime();
+        switch(op->op) {
+        case RAX_OP_INSERT:
+            result = raxInsert(t,key,op->key_len,NULL,NULL);
+            break;
+        case RAX_OP_TRYINSERT:
+            result = raxTryInsert(t,key,op->key_len,NULL,NULL);
+            break;
+        case RAX_OP_REMOVE:
+            result = raxRemove(t,key,op->key_len,NULL);
+            break;
+        case RAX_OP_FIND:
+            result = raxFind(t,key,op->key_len) != raxNotFound;
+            break;
+        case RAX_OP_SEEK: result = raxSeek(it,seekop,key,op->key_len); break;
+        case RAX_OP_NEXT: result = raxNext(it); break;
+        case RAX_OP_PREV: result = raxPrev(it); break;
+        case RAX_OP_NEW:
+            Trees[op->tree] = raxNew();
+            result = Trees[op->tree] != NULL;
+            break;
+        case RAX_OP_FREE: freeTree(op->tree); break;
+        }
+        uint64_t elapsed = nstime()-t0;
+        histAdd(&hist[op->op],elapsed);
+        total += elapsed;
+        if (result != op->result) mismatches[op->op]++;
+    }
+    return total;
+}
+
+void usage(void) {
+    fprintf(stderr,
+"Usage: rax-replay [options] <recording>\n"
+"  --json              Emit JSON instead of text.\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *filename = NULL;
+    int json = 0;
+
+    for (int j = 1; j < argc; j++) {
+        if (!strcmp(argv[j],"--json")) {
+            json = 1;
+        } else if (argv[j][0] != '-' && filename == NULL) {
+            filename = argv[j];
+        } else {
+            usage();
+        }
+    }
+    if (filename == NULL) usage();
+
+    loadRecording(filename);
+    Trees = calloc(NumTrees ? NumTrees : 1,sizeof(rax*));
+    Iters = calloc(NumIters ? NumIters : 1,sizeof(replayIter*));
+    if (Trees == NULL || Iters == NULL) {
+        fprintf(stderr,"Out of memory\n");
+        exit(1);
+    }
+    for (uint32_t j = 0; j < NumIters; j++) {
+        Iters[j] = calloc(1,sizeof(replayIter));
+        if (Iters[j] == NULL) {
+            fprintf(stderr,"Out of memory\n");
+            exit(1);
+        }
+    }
+
+    static histogram hist[NUM_OPS];
+    uint64_t mismatches[NUM_OPS] = {0};
+    uint64_t counters[PERF_NUM_COUNTERS] = {0};
+    for (int op = 0; op < NUM_OPS; op++) histReset(&hist[op]);
+    int perf = perfCountersInit();
+    if (perf) perfCountersStart();
+    uint64_t total = replay(hist,mismatches);
+    if (perf) perfCountersStop(counters);
+    for (uint32_t j = 0; j < NumTrees; j++)
+        if (Trees[j]) freeTree(j);
+    double seconds = (double)total/1e9;
+
+    if (!json) {
+        printf("Replayed %zu operations on %u trees, %u iterators: "
+               "%.3f sec %.0f ops/sec\n", NumOps, NumTrees, NumIters,
+            seconds, seconds ? NumOps/seconds : 0);
+        for (int op = 0; op < NUM_OPS; op++) {
+            histogram *h = hist+op;
+            if (h->count == 0) continue;
+            printf("  %-9s count %-10llu ns: min %-6llu p50 %-6llu "
+                   "p99 %-7llu p999 %-8llu max %llu", OpNames[op],
+                (unsigned long long)h->count,
+                (unsigned long long)h->min,
+                (unsigned long long)histPercentile(h,50),
+                (unsigned long long)histPercentile(h,99),
+                (unsigned long long)histPercentile(h,99.9),
+                (unsigned long long)h->max);
+            if (mismatches[op])
+                printf(" MISMATCHES %llu", (unsigned long long)mismatches[op]);
+            printf("\n");
+        }
+        if (perf && NumOps) {
+            printf("Hardware counters per op:");
+            for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+                if (!perfCounterAvailable(j)) continue;
+                printf(" %s %.2f", perfCounterName(j),
+                    (double)counters[j]/NumOps);
+            }
+            printf("\n");
+        }
+        if (HaveStats && Stats.walks) {
+            printf("Tree counters per walk: nodes %.2f compr bytes %.2f "
+                   "edge bytes %.2f, addchild reallocs %llu splits %llu/%llu "
+                   "recompressions %llu\n",
+                (double)Stats.nodes_visited/Stats.walks,
+                (double)Stats.compr_bytes/Stats.walks,
+                (double)Stats.edge_bytes/Stats.walks,
+                (unsigned long long)Stats.addchild_reallocs,
+                (unsigned long long)Stats.splits_algo1,
+                (unsigned long long)Stats.splits_algo2,
+                (unsigned long long)Stats.recompressions);
+        }
+    } else {
+        printf("{\"benchmark\":\"rax-replay\",\"ops\":%zu,\"trees\":%u,"
+               "\"iterators\":%u,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+               "\"latency_ns\":{", NumOps, NumTrees, NumIters, seconds,
+            seconds ? NumOps/seconds : 0);
+        int first = 1;
+        for (int op = 0; op < NUM_OPS; op++) {
+            histogram *h = hist+op;
+            if (h->count == 0) continue;
+            printf("%s\n  \"%s\":{\"count\":%llu,\"min\":%llu,"
+                   "\"mean\":%.1f,\"p50\":%llu,\"p99\":%llu,"
+                   "\"p999\":%llu,\"max\":%llu,\"mismatches\":%llu}",
+                first ? "" : ",", OpNames[op],
+                (unsigned long long)h->count, (unsigned long long)h->min,
+                h->sum/h->count,
+                (unsigned long long)histPercentile(h,50),
+                (unsigned long long)histPercentile(h,99),
+                (unsigned long long)histPercentile(h,99.9),
+                (unsigned long long)h->max,
+                (unsigned long long)mismatches[op]);
+            first = 0;
+        }
+        printf("}");
+        if (perf) {
+            printf(",\n\"counters\":{");
+            first = 1;
+            for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+                if (!perfCounterAvailable(j)) continue;
+                printf("%s\"%s\":%llu", first ? "" : ",", perfCounterName(j),
+                    (unsigned long long)counters[j]);
+                first = 0;
+            }
+            printf("}");
+        }
+        if (HaveStats) {
+            printf(",\n\"stats\":{\"walks\":%llu,\"nodes_visited\":%llu,"
+                   "\"compr_bytes\":%llu,\"edge_bytes\":%llu,"
+                   "\"addchild_reallocs\":%llu,\"splits_algo1\":%llu,"
+                   "\"splits_algo2\":%llu,\"recompressions\":%llu,"
+                   "\"recompressed_nodes\":%llu}",
+                (unsigned long long)Stats.walks,
+                (unsigned long long)Stats.nodes_visited,
+                (unsigned long long)Stats.compr_bytes,
+                (unsigned long long)Stats.edge_bytes,
+                (unsigned long long)Stats.addchild_reallocs,
+                (unsigned long long)Stats.splits_algo1,
+                (unsigned long long)Stats.splits_algo2,
+                (unsigned long long)Stats.recompressions,
+                (unsigned long long)Stats.recompressed_nodes);
+        }
+        printf("}\n");
+    }
+
+    uint64_t errors = 0;
+    for (int op = 0; op < NUM_OPS; op++) errors += mismatches[op];
+    return errors ? 2 : 0;
+}
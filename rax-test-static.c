@@ -0,0 +1,374 @@
+/* Generated by rax-gen. Do not edit.
+ *
+ * Use it with: extern const rax raxTestStatic;
+ * and pass (rax*)&raxTestStatic to read only rax functions. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rax.h"
+
+/* Check that the layout matches the one of the host that generated the file. */
+typedef char raxTestStatic_layout_check[(sizeof(raxNode) == 4 && sizeof(void*) == 8) ? 1 : -1];
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n0 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(2)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n1 = {
+    0x00000014,
+    {101,110,0,0},
+    {&raxTestStatic_n0}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n2 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(1)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[12];
+    const void *ptr[2];
+} raxTestStatic_n3 = {
+    0x00000035,
+    {105,103,97,116,111,114,0,0,0,0,0,0},
+    {&raxTestStatic_n2,(const void*)(12)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n4 = {
+    0x00000010,
+    {105,108,0,0},
+    {&raxTestStatic_n1,&raxTestStatic_n3}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n5 = {
+    0x00000008,
+    {108,0,0,0},
+    {&raxTestStatic_n4}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n6 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(3)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n7 = {
+    0x00000027,
+    {108,111,111,110},
+    {&raxTestStatic_n6}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n8 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(15)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[12];
+    const void *ptr[1];
+} raxTestStatic_n9 = {
+    0x00000034,
+    {110,0,97,114,121,255,0,0,0,0,0,0},
+    {&raxTestStatic_n8}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n10 = {
+    0x00000010,
+    {97,105,0,0},
+    {&raxTestStatic_n7,&raxTestStatic_n9}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n11 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(4)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[12];
+    const void *ptr[1];
+} raxTestStatic_n12 = {
+    0x00000064,
+    {104,114,111,109,111,100,121,110,97,109,105,99},
+    {&raxTestStatic_n11}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n13 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(5)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n14 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(6)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n15 = {
+    0x00000008,
+    {115,0,0,0},
+    {&raxTestStatic_n14}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n16 = {
+    0x00000010,
+    {101,117,0,0},
+    {&raxTestStatic_n13,&raxTestStatic_n15}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n17 = {
+    0x00000008,
+    {110,0,0,0},
+    {&raxTestStatic_n16}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n18 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(7)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n19 = {
+    0x0000001c,
+    {108,117,115,0},
+    {&raxTestStatic_n18}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n20 = {
+    0x00000010,
+    {97,117,0,0},
+    {&raxTestStatic_n17,&raxTestStatic_n19}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n21 = {
+    0x00000008,
+    {109,0,0,0},
+    {&raxTestStatic_n20}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n22 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(8)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n23 = {
+    0x00000008,
+    {115,0,0,0},
+    {&raxTestStatic_n22}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n24 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(9)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n25 = {
+    0x00000010,
+    {110,114,0,0},
+    {&raxTestStatic_n23,&raxTestStatic_n24}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n26 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(10)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n27 = {
+    0x00000008,
+    {110,0,0,0},
+    {&raxTestStatic_n26}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n28 = {
+    0x00000001,
+    {0,0,0,0},
+    {(const void*)(11)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n29 = {
+    0x00000024,
+    {110,100,117,115},
+    {&raxTestStatic_n28}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n30 = {
+    0x00000010,
+    {111,117,0,0},
+    {&raxTestStatic_n27,&raxTestStatic_n29}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n31 = {
+    0x00000008,
+    {99,0,0,0},
+    {&raxTestStatic_n30}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[3];
+} raxTestStatic_n32 = {
+    0x00000011,
+    {101,105,0,0},
+    {&raxTestStatic_n25,&raxTestStatic_n31,(const void*)(13)}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[1];
+} raxTestStatic_n33 = {
+    0x00000008,
+    {98,0,0,0},
+    {&raxTestStatic_n32}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[2];
+} raxTestStatic_n34 = {
+    0x00000010,
+    {111,117,0,0},
+    {&raxTestStatic_n21,&raxTestStatic_n33}
+};
+
+static const struct {
+    uint32_t hdr;
+    unsigned char data[4];
+    const void *ptr[4];
+} raxTestStatic_n35 = {
+    0x00000020,
+    {97,98,99,114},
+    {&raxTestStatic_n5,&raxTestStatic_n10,&raxTestStatic_n12,&raxTestStatic_n34}
+};
+
+const rax raxTestStatic = {.head = (raxNode*)&raxTestStatic_n35,
+    .numele = 15, .numnodes = 36};
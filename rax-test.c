@@ -35,12 +35,28 @@
 #include <sys/time.h>
 #include <assert.h>
 #include <errno.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "rax.h"
+#include "rax_typed.h"
 #include "rc4rand.h"
+#include "perfcount.h"
+#include "rax_record.h"
+#include "rax_intern.h"
 
 uint16_t crc16(const char *buf, int len); /* From crc16.c */
 
+/* Type specialized trees used by the unit tests and the benchmark. */
+typedef struct typedTestVal {
+    uint64_t a, b, c;
+} typedTestVal;
+
+RAX_DEFINE(typedIntTree,uint32_t)
+RAX_DEFINE(typedStructTree,typedTestVal)
+RAX_DEFINE_FIXED(typedFixedTree,typedTestVal,8)
+
 /* ---------------------------------------------------------------------------
  * Simple hash table implementation, no rehashing, just chaining. This is
  * used in order to test the radix tree implementation against something that
@@ -201,6 +217,75 @@ long long ustime(void) {
     return ust;
 }
 
+/* When rax.c is compiled with the counting allocator (see the rax-test-count
+ * target), the benchmark also reports the number of allocator calls
+ * performed per operation. */
+#ifdef RAX_COUNT_MALLOC
+extern unsigned long long rax_malloc_calls, rax_realloc_calls, rax_free_calls;
+extern unsigned long long rax_alloc_bytes;
+
+/* Print the allocator calls per operation performed since the last call,
+ * if 'op' is not NULL, and reset the counters. */
+void allocCallsReport(const char *op, unsigned long ops) {
+    if (op) {
+        printf("%s allocator calls per op: malloc %.3f realloc %.3f "
+               "free %.3f\n", op,
+               (double)rax_malloc_calls/ops,
+               (double)rax_realloc_calls/ops,
+               (double)rax_free_calls/ops);
+    }
+    rax_malloc_calls = rax_realloc_calls = rax_free_calls = 0;
+}
+#else
+#define allocCallsReport(op,ops)
+#endif
+
+/* When compiled with RAX_STATS (see the rax-test-stats target), the
+ * benchmark also reports the operation counters of the tree per operation.
+ * Counters are reset at every call. */
+#ifdef RAX_STATS
+void treeStatsReport(rax *t, const char *op, unsigned long ops) {
+    raxStats st;
+    raxGetStats(t,&st);
+    raxResetStats(t);
+    if (!op) return;
+    printf("%s tree counters per op: nodes %.2f compr bytes %.2f "
+           "edge bytes %.2f addchild reallocs %.3f splits %.3f/%.3f "
+           "recompressions %.3f\n", op,
+           (double)st.nodes_visited/ops, (double)st.compr_bytes/ops,
+           (double)st.edge_bytes/ops, (double)st.addchild_reallocs/ops,
+           (double)st.splits_algo1/ops, (double)st.splits_algo2/ops,
+           (double)st.recompressions/ops);
+}
+#else
+#define treeStatsReport(t,op,ops)
+#endif
+
+/* Hardware performance counters of the benchmark phases. Counters are often
+ * not available, for instance in containers: in this case only the time
+ * of every phase is reported. */
+static int PerfAvailable = 0;
+
+void perfPhaseStart(void) {
+    if (PerfAvailable) perfCountersStart();
+}
+
+/* Report the counters per operation of the phase just completed. */
+void perfPhaseReport(const char *phase, unsigned long ops) {
+    if (!PerfAvailable) return;
+    uint64_t values[PERF_NUM_COUNTERS];
+    perfCountersStop(values);
+    printf("%s hardware counters per op:", phase);
+    for (int j = 0; j < PERF_NUM_COUNTERS; j++) {
+        if (!perfCounterAvailable(j)) continue;
+        printf(" %s %.2f", perfCounterName(j), (double)values[j]/ops);
+    }
+    if (values[PERF_CYCLES])
+        printf(" IPC %.2f", (double)values[PERF_INSTRUCTIONS]/
+                            values[PERF_CYCLES]);
+    printf("\n");
+}
+
 /* Turn the integer 'i' into a key according to 'mode'.
  * KEY_INT: Just represents the integer as a string.
  * KEY_UNIQUE_ALPHA: Turn it into a random-looking alphanumerical string
@@ -690,6 +775,1309 @@ int tryInsertUnitTests(void) {
     return 0;
 }
 
+/* Test that the const tree generated by rax-gen from rax-test-static.txt
+ * can be accessed with the read only API. */
+extern const rax raxTestStatic;
+
+int staticTreeUnitTests(void) {
+    rax *t = (rax*)&raxTestStatic;
+    char *keys[] = {"alligator","alien","baloon","chromodynamic","romane","romanus","romulus","rubens","ruber","rubicon","rubicundus","all","rub",NULL};
+
+    for (long i = 0; keys[i] != NULL; i++) {
+        void *val = raxFind(t,(unsigned char*)keys[i],strlen(keys[i]));
+        if (val != (void*)(i+1)) {
+            printf("Static tree: %s has value %p instead of %p\n",
+                keys[i], val, (void*)(i+1));
+            return 1;
+        }
+    }
+    if (raxFind(t,(unsigned char*)"ba",2) != NULL ||
+        raxFind(t,(unsigned char*)"bin\000ary\377",8) != (void*)15 ||
+        raxFind(t,(unsigned char*)"rom",3) != raxNotFound)
+    {
+        printf("Static tree: NULL, binary or missing key lookup failed\n");
+        return 1;
+    }
+
+    raxIterator iter;
+    raxStart(&iter,t);
+    raxSeek(&iter,"^",NULL,0);
+    uint64_t count = 0;
+    unsigned char prev[64];
+    size_t prevlen = 0;
+    while(raxNext(&iter)) {
+        if (count && compareAB(prev,prevlen,iter.key,iter.key_len) >= 0) {
+            printf("Static tree: iterator returned keys out of order\n");
+            return 1;
+        }
+        memcpy(prev,iter.key,iter.key_len);
+        prevlen = iter.key_len;
+        count++;
+    }
+    if (count != raxSize(t)) {
+        printf("Static tree: iterated %lu keys instead of %lu\n",
+            (unsigned long)count, (unsigned long)raxSize(t));
+        return 1;
+    }
+    raxSeek(&iter,">",(unsigned char*)"rub",3);
+    if (!raxNext(&iter) || iter.key_len != 6 || memcmp(iter.key,"rubens",6)) {
+        printf("Static tree: seek > rub failed\n");
+        return 1;
+    }
+    raxStop(&iter);
+    return 0;
+}
+
+/* Test the trees generated by RAX_DEFINE() and RAX_DEFINE_FIXED(), with
+ * values stored inline and out of line. */
+int typedTreeUnitTests(void) {
+    typedIntTree it;
+    typedStructTree st;
+    typedFixedTree ft;
+    typedIntTreeInit(&it);
+    typedStructTreeInit(&st);
+    typedFixedTreeInit(&ft);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        unsigned char key[8];
+        memcpy(key,&i,sizeof(i));
+        memcpy(key+4,&i,sizeof(i));
+        typedTestVal v = {i, i*2, i*3};
+        typedIntTreeInsert(&it,key,4,i);
+        typedStructTreeInsert(&st,key,4,v);
+        typedFixedTreeInsert(&ft,key,v);
+    }
+
+    /* Overwrite and non overwriting insert. */
+    unsigned char zero[8] = {0};
+    typedTestVal v = {7,7,7};
+    typedStructTreeInsert(&st,zero,4,v);
+    v.a = 8;
+    if (typedStructTreeTryInsert(&st,zero,4,v) != 0 ||
+        typedStructTreeInsert(&st,zero,4,v) != 0)
+    {
+        printf("Typed tree: insert of existing key returned 1\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        unsigned char key[8];
+        memcpy(key,&i,sizeof(i));
+        memcpy(key+4,&i,sizeof(i));
+        uint32_t ival;
+        typedTestVal sval, fval;
+        if (!typedIntTreeFind(&it,key,4,&ival) ||
+            !typedStructTreeFind(&st,key,4,&sval) ||
+            !typedFixedTreeFind(&ft,key,&fval))
+        {
+            printf("Typed tree: key %u not found\n", (unsigned)i);
+            return 1;
+        }
+        /* Key zero was overwritten with {8,7,7} above. */
+        int sval_ok = i ? (sval.a == i && sval.c == (uint64_t)i*3) :
+                          (sval.a == 8 && sval.c == 7);
+        if (ival != i || !sval_ok || fval.a != i || fval.b != (uint64_t)i*2)
+        {
+            printf("Typed tree: value mismatch for key %u\n", (unsigned)i);
+            return 1;
+        }
+    }
+
+    /* Iteration returns decoded values in key order. */
+    typedFixedTreeIterator iter;
+    typedFixedTreeStart(&iter,&ft);
+    typedFixedTreeSeek(&iter,"^",NULL);
+    uint64_t count = 0;
+    while(typedFixedTreeNext(&iter)) {
+        uint32_t i;
+        memcpy(&i,iter.key,sizeof(i));
+        if (iter.key_len != 8 || iter.val.a != i) {
+            printf("Typed tree: iterator value mismatch\n");
+            return 1;
+        }
+        count++;
+    }
+    typedFixedTreeStop(&iter);
+    if (count != typedFixedTreeSize(&ft)) {
+        printf("Typed tree: iterator reported %lu keys\n",
+            (unsigned long)count);
+        return 1;
+    }
+
+    /* Removal returns the old value and releases the copy. */
+    typedTestVal old;
+    if (!typedStructTreeRemove(&st,zero,4,&old) || old.a != 8 ||
+        typedStructTreeFind(&st,zero,4,NULL))
+    {
+        printf("Typed tree: remove failed\n");
+        return 1;
+    }
+
+    typedIntTreeFree(&it);
+    typedStructTreeFree(&st);
+    typedFixedTreeFree(&ft);
+    return 0;
+}
+
+/* Test the operation counters collected when compiled with RAX_STATS.
+ * Without RAX_STATS raxGetStats() must just report zero counters. */
+int statsUnitTests(void) {
+    rax *t = raxNew();
+    raxStats st;
+    int enabled = raxGetStats(t,&st);
+#ifdef RAX_STATS
+    if (!enabled) {
+        printf("raxGetStats() reports no counters with RAX_STATS\n");
+        return 1;
+    }
+#else
+    if (enabled || st.walks) {
+        printf("raxGetStats() reports counters without RAX_STATS\n");
+        return 1;
+    }
+    raxFree(t);
+    return 0;
+#endif
+
+    /* "abcdef" is a single compressed node, inserting "abcxyz" splits
+     * it at a mismatch (ALGO 1), and "ab" splits it again since the
+     * key ends inside the compressed node (ALGO 2). */
+    raxInsert(t,(unsigned char*)"abcdef",6,NULL,NULL);
+    raxInsert(t,(unsigned char*)"abcxyz",6,NULL,NULL);
+    raxInsert(t,(unsigned char*)"ab",2,NULL,NULL);
+    raxGetStats(t,&st);
+    if (st.walks != 3 || st.splits_algo1 != 1 || st.splits_algo2 != 1 ||
+        st.addchild_reallocs != 1)
+    {
+        printf("Wrong insert counters: walks %llu splits %llu/%llu "
+               "addchild reallocs %llu\n",
+            (unsigned long long)st.walks,
+            (unsigned long long)st.splits_algo1,
+            (unsigned long long)st.splits_algo2,
+            (unsigned long long)st.addchild_reallocs);
+        return 1;
+    }
+
+    /* Removing "abcxyz" leaves "d" and "ef" as a chain to compress. */
+    raxRemove(t,(unsigned char*)"abcxyz",6,NULL);
+    raxGetStats(t,&st);
+    if (st.recompressions != 1 || st.recompressed_nodes != 2) {
+        printf("Wrong remove counters: recompressions %llu nodes %llu\n",
+            (unsigned long long)st.recompressions,
+            (unsigned long long)st.recompressed_nodes);
+        return 1;
+    }
+
+    /* Now the tree is "ab" -> [c] -> "def": the lookup compares five
+     * bytes in the two compressed nodes, and scans one edge byte. */
+    raxResetStats(t);
+    raxFind(t,(unsigned char*)"abcdef",6);
+    raxGetStats(t,&st);
+    if (st.walks != 1 || st.nodes_visited != 3 || st.compr_bytes != 5 ||
+        st.edge_bytes != 1)
+    {
+        printf("Wrong lookup counters: walks %llu nodes %llu "
+               "compr bytes %llu edge bytes %llu\n",
+            (unsigned long long)st.walks,
+            (unsigned long long)st.nodes_visited,
+            (unsigned long long)st.compr_bytes,
+            (unsigned long long)st.edge_bytes);
+        return 1;
+    }
+    raxFree(t);
+    return 0;
+}
+
+/* Test raxAnalyze() against a small tree of known shape:
+ *
+ *  "ab" -> [c]=ab -> [dx]
+ *                     `-(d) "ef" -> []=abcdef
+ *                     `-(x) "yz" -> []=abcxyz
+ */
+int analyzeUnitTests(void) {
+    rax *t = raxNew();
+    raxInsert(t,(unsigned char*)"abcdef",6,NULL,NULL);
+    raxInsert(t,(unsigned char*)"abcxyz",6,NULL,NULL);
+    raxInsert(t,(unsigned char*)"ab",2,NULL,NULL);
+
+    raxAnalysis a;
+    raxAnalyze(t,&a);
+    if (a.keys != 3 || a.key_bytes != 14 || a.nodes != 7 ||
+        a.compr_nodes != 3 || a.empty_leaves != 2 || a.max_depth != 4)
+    {
+        printf("Wrong raxAnalyze() totals: keys %llu key bytes %llu "
+               "nodes %llu compressed %llu empty leaves %llu depth %llu\n",
+            (unsigned long long)a.keys, (unsigned long long)a.key_bytes,
+            (unsigned long long)a.nodes, (unsigned long long)a.compr_nodes,
+            (unsigned long long)a.empty_leaves,
+            (unsigned long long)a.max_depth);
+        return 1;
+    }
+    if (a.depth[1] != 1 || a.depth[4] != 2 || a.fanout[0] != 2 ||
+        a.fanout[1] != 1 || a.fanout[2] != 1 || a.runs[1] != 3)
+    {
+        printf("Wrong raxAnalyze() histograms\n");
+        return 1;
+    }
+    /* 9 edge bytes, 6 child pointers, no value since values are NULL. */
+    if (a.bytes != t->numnodes*sizeof(raxNode)+a.padding_bytes+
+                   9+6*sizeof(void*))
+    {
+        printf("Wrong raxAnalyze() nodes size: %llu\n",
+            (unsigned long long)a.bytes);
+        return 1;
+    }
+    raxFree(t);
+    return 0;
+}
+
+/* Test the trace callback when compiled with RAX_TRACE (see the
+ * rax-test-trace target): every operation must be reported between a
+ * begin and an end event, together with the splits, reallocations and
+ * recompressions it performs. */
+#define TRACE_MAX_EVENTS 64
+static raxTraceEvent TraceEvents[TRACE_MAX_EVENTS];
+static int TraceNumEvents;
+
+void traceTestCallback(const raxTraceEvent *e, void *privdata) {
+    (void)privdata;
+    if (TraceNumEvents < TRACE_MAX_EVENTS) TraceEvents[TraceNumEvents++] = *e;
+}
+
+/* Return the number of events of the specified type, op and count. */
+int traceCountEvents(int type, int op, uint64_t count) {
+    int found = 0;
+    for (int j = 0; j < TraceNumEvents; j++) {
+        if (TraceEvents[j].type == type && TraceEvents[j].op == op &&
+            TraceEvents[j].count == count) found++;
+    }
+    return found;
+}
+
+int traceUnitTests(void) {
+    TraceNumEvents = 0;
+    if (!raxSetTraceCallback(traceTestCallback,NULL)) return 0;
+
+    rax *t = raxNew();
+    raxInsert(t,(unsigned char*)"abcdef",6,NULL,NULL);
+    raxInsert(t,(unsigned char*)"abcxyz",6,NULL,NULL);
+    raxTryInsert(t,(unsigned char*)"ab",2,NULL,NULL);
+    raxRemove(t,(unsigned char*)"abcxyz",6,NULL);
+    raxFind(t,(unsigned char*)"ab",2);
+    raxFind(t,(unsigned char*)"xyz",3);
+    raxSetTraceCallback(NULL,NULL);
+    raxFind(t,(unsigned char*)"ab",2); /* Not traced. */
+
+    int err = 0;
+    if (TraceNumEvents < 2) {
+        err = 10; /* The callback was not called for every operation. */
+    } else {
+        raxTraceEvent *last = TraceEvents+TraceNumEvents-1;
+        if (TraceEvents[0].type != RAX_TRACE_OP_END ||
+            TraceEvents[0].op != RAX_OP_NEW) err = 1;
+        if (TraceEvents[1].type != RAX_TRACE_OP_BEGIN ||
+            TraceEvents[1].op != RAX_OP_INSERT ||
+            TraceEvents[1].key_len != 6 ||
+            memcmp(TraceEvents[1].key,"abcdef",6) != 0) err = 1;
+        if (last->type != RAX_TRACE_OP_END || last->op != RAX_OP_FIND ||
+            last->count != 0) err = 2;
+    }
+    if (traceCountEvents(RAX_TRACE_OP_END,RAX_OP_INSERT,1) != 2 ||
+        traceCountEvents(RAX_TRACE_OP_END,RAX_OP_TRYINSERT,1) != 1 ||
+        traceCountEvents(RAX_TRACE_OP_END,RAX_OP_REMOVE,1) != 1 ||
+        traceCountEvents(RAX_TRACE_OP_END,RAX_OP_FIND,1) != 1) err = 3;
+    /* "abcdef" split at a mismatch, then "abc" split by "ab". */
+    if (traceCountEvents(RAX_TRACE_SPLIT,RAX_OP_INSERT,1) != 1 ||
+        traceCountEvents(RAX_TRACE_SPLIT,RAX_OP_TRYINSERT,2) != 1) err = 4;
+    if (traceCountEvents(RAX_TRACE_REALLOC,RAX_OP_INSERT,2) != 1) err = 5;
+    if (traceCountEvents(RAX_TRACE_RECOMPRESS,RAX_OP_REMOVE,2) != 1) err = 6;
+    for (int j = 0; j < TraceNumEvents; j++) {
+        raxTraceEvent *e = TraceEvents+j;
+        if (e->rax != t) err = 7;
+        if (e->type == RAX_TRACE_SPLIT &&
+            e->size != (e->count == 1 ? 6 : 3)) err = 8;
+        if (e->type == RAX_TRACE_RECOMPRESS && e->size != 3) err = 9;
+    }
+    if (err) {
+        printf("Trace test failed with error %d, %d events\n",
+            err, TraceNumEvents);
+        return 1;
+    }
+    raxFree(t);
+    return 0;
+}
+
+/* Check the visits counted by the sampled access heat, when compiled with
+ * RAX_HEAT, both sampling every lookup and one every four. Without
+ * RAX_HEAT raxHeatEnable() must fail and the test is skipped. */
+int heatUnitTests(void) {
+    rax *t = raxNew();
+    if (!raxHeatEnable(t,1,4)) {
+        raxFree(t);
+        return 0; /* Not compiled with RAX_HEAT. */
+    }
+    const char *keys[] = {"user:1000","user:1001","user:2000","item:1"};
+    for (int j = 0; j < 4; j++)
+        raxInsert(t,(unsigned char*)keys[j],strlen(keys[j]),NULL,NULL);
+    for (int j = 0; j < 16; j++) {
+        const char *key = j < 10 ? keys[0] : (j < 15 ? keys[2] : keys[3]);
+        raxFind(t,(unsigned char*)key,strlen(key));
+    }
+
+    /* The head is visited by every lookup, then the "u" branch leading
+     * to the compressed node "ser:" by 15 of them. */
+    int err = 0;
+    size_t count;
+    raxHotPrefix *hp = raxHotPrefixes(t,3,&count);
+    if (hp == NULL || count != 3) {
+        err = 1;
+    } else {
+        if (hp[0].len != 0 || hp[0].visits != 16 || hp[0].rate != 1) err = 2;
+        if (hp[1].len != 1 || memcmp(hp[1].prefix,"u",1) != 0 ||
+            hp[1].visits != 15) err = 3;
+        if (hp[2].len != 5 || memcmp(hp[2].prefix,"user:",5) != 0 ||
+            hp[2].visits != 15) err = 4;
+        raxFreeHotPrefixes(hp,count);
+    }
+
+    /* Sample one lookup every four. */
+    raxHeatEnable(t,4,1);
+    for (int j = 0; j < 16; j++)
+        raxFind(t,(unsigned char*)keys[0],strlen(keys[0]));
+    hp = raxHotPrefixes(t,10,&count);
+    if (hp == NULL || count != 1 || hp[0].visits != 4) err = 5;
+    if (hp) raxFreeHotPrefixes(hp,count);
+
+    raxHeatEnable(t,0,0);
+    if (raxHotPrefixes(t,10,&count) != NULL || count != 0) err = 6;
+    raxFree(t);
+    if (err) {
+        printf("Heat test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Check that the tree 'p' has the same content of the reference tree 't',
+ * iterating both in both directions and seeking 'key' with every operator.
+ * Returns 0 on success, otherwise an error code. */
+int compareTrees(rax *p, rax *t, unsigned char *key, size_t len) {
+    const char *ops[] = {"==",">",">=","<","<=","^","$"};
+    raxIterator pi, ti;
+    int err = 0;
+
+    if (raxSize(p) != raxSize(t)) return 1;
+    raxStart(&pi,p);
+    raxStart(&ti,t);
+    for (int dir = 0; dir < 2 && !err; dir++) {
+        raxSeek(&pi,dir ? "$" : "^",NULL,0);
+        raxSeek(&ti,dir ? "$" : "^",NULL,0);
+        while (!err) {
+            int pr = dir ? raxPrev(&pi) : raxNext(&pi);
+            int tr = dir ? raxPrev(&ti) : raxNext(&ti);
+            if (pr != tr) err = 2;
+            else if (pr && (pi.key_len != ti.key_len ||
+                     memcmp(pi.key,ti.key,ti.key_len) != 0 ||
+                     pi.data != ti.data)) err = 3;
+            if (!pr) break;
+        }
+    }
+    for (int j = 0; j < 7 && !err; j++) {
+        raxSeek(&pi,ops[j],key,len);
+        raxSeek(&ti,ops[j],key,len);
+        int pr = raxNext(&pi), tr = raxNext(&ti);
+        if (pr != tr) err = 4;
+        else if (pr && (pi.key_len != ti.key_len ||
+                 memcmp(pi.key,ti.key,ti.key_len) != 0)) err = 5;
+        /* And one step back. */
+        pr = raxPrev(&pi);
+        tr = raxPrev(&ti);
+        if (pr != tr) err = 6;
+        else if (pr && (pi.key_len != ti.key_len ||
+                 memcmp(pi.key,ti.key,ti.key_len) != 0)) err = 7;
+    }
+    raxStop(&pi);
+    raxStop(&ti);
+    return err;
+}
+
+static long packedFreed;
+static void packedFreeCallback(void *data) {
+    (void)data;
+    packedFreed++;
+}
+
+/* Key 'j' of the packed boundary tests: three binary bytes, the keys
+ * sorting like their index. */
+static size_t packedBoundaryKey(unsigned char *key, int j) {
+    key[0] = 0xff;
+    key[1] = j >> 2;
+    key[2] = (j & 3) * 0x55;
+    return 3;
+}
+
+/* Random operations on a tree created with raxNewPacked(), compared with
+ * a normal tree, while it stays small and after it is converted to nodes. */
+int packedUnitTests(void) {
+    rax *p = raxNewPacked(), *t = raxNew();
+    unsigned char key[8], lkey[256];
+    raxAnalysis a;
+    int err = 0;
+
+    raxAnalyze(p,&a);
+    if (a.nodes != 0 || a.keys != 0) err = 10;
+
+    /* Keys of up to 4 chars of "ab": they share prefixes, the empty key is
+     * in the set too, and being 31 at most the tree stays packed. */
+    for (long j = 0; j < 5000 && !err; j++) {
+        size_t len = rand() % 5;
+        for (size_t i = 0; i < len; i++) key[i] = "ab"[rand()%2];
+        void *data = (rand() % 4) ? (void*)(j+1) : NULL;
+        void *pold = NULL, *told = NULL;
+        int pr, tr;
+        switch(rand() % 4) {
+        case 0: pr = raxInsert(p,key,len,data,&pold);
+                tr = raxInsert(t,key,len,data,&told); break;
+        case 1: pr = raxTryInsert(p,key,len,data,&pold);
+                tr = raxTryInsert(t,key,len,data,&told); break;
+        default: pr = raxRemove(p,key,len,&pold);
+                 tr = raxRemove(t,key,len,&told); break;
+        }
+        if (pr != tr || pold != told) err = 11;
+        else if (raxFind(p,key,len) != raxFind(t,key,len)) err = 12;
+        else if (j % 10 == 0) err = compareTrees(p,t,key,len);
+    }
+    raxAnalyze(p,&a);
+    if (!err && a.nodes != 0) err = 13; /* Should be still packed. */
+
+    /* Keep iterating while the tree changes: the iterator continues from
+     * the key it was on. */
+    raxIterator it, ti;
+    raxStart(&it,p);
+    raxStart(&ti,t);
+    raxInsert(p,(unsigned char*)"zz",2,NULL,NULL);
+    raxInsert(t,(unsigned char*)"zz",2,NULL,NULL);
+    raxSeek(&it,"^",NULL,0);
+    raxNext(&it);
+    raxInsert(p,(unsigned char*)"zzz",3,NULL,NULL);
+    raxInsert(t,(unsigned char*)"zzz",3,NULL,NULL);
+    raxSeek(&ti,">",it.key,it.key_len);
+    if (!err && (!raxNext(&it) || !raxNext(&ti) || it.key_len != ti.key_len ||
+        memcmp(it.key,ti.key,ti.key_len) != 0)) err = 14;
+    raxStop(&ti);
+
+    /* Grow over the key count limit, and later add a key too long for the
+     * packed encoding, checking that the content survives. */
+    for (long j = 0; j < 64 && !err; j++) {
+        snprintf((char*)key,sizeof(key),"k%ld",j);
+        raxInsert(p,key,strlen((char*)key),(void*)j,NULL);
+        raxInsert(t,key,strlen((char*)key),(void*)j,NULL);
+        err = compareTrees(p,t,key,strlen((char*)key));
+    }
+    if (!err && !raxNext(&it)) err = 15; /* Seeks again on nodes. */
+    raxStop(&it);
+    raxAnalyze(p,&a);
+    if (!err && a.nodes == 0) err = 16;
+    raxFree(p);
+    raxFree(t);
+
+    unsigned char longkey[300];
+    memset(longkey,'x',sizeof(longkey));
+    p = raxNewPacked();
+    raxInsert(p,(unsigned char*)"short",5,(void*)1,NULL);
+    raxInsert(p,longkey,sizeof(longkey),(void*)2,NULL);
+    raxAnalyze(p,&a);
+    if (!err && (a.nodes == 0 || raxFind(p,longkey,sizeof(longkey)) !=
+        (void*)2 || raxFind(p,(unsigned char*)"short",5) != (void*)1))
+        err = 17;
+    raxFree(p);
+
+    /* The free callback is called for the non NULL values only. */
+    p = raxNewPacked();
+    raxInsert(p,(unsigned char*)"a",1,(void*)1,NULL);
+    raxInsert(p,(unsigned char*)"b",1,NULL,NULL);
+    raxInsert(p,(unsigned char*)"c",1,(void*)3,NULL);
+    packedFreed = 0;
+    raxFreeWithCallback(p,packedFreeCallback);
+    if (!err && packedFreed != 2) err = 18;
+
+    /* Binary keys made of a common prefix followed by up to 15 bytes of
+     * 0x00, 0x01, 0xfe and 0xff, with a prefix long enough to reach the
+     * maximum key length of 255 bytes. The trees are kept at 16 keys at
+     * most, two restart blocks, that even with the longest keys fit the
+     * 1024 bytes of entries: they must stay packed. */
+    size_t plens[] = {0,64,240};
+    for (int k = 0; k < 3 && !err; k++) {
+        p = raxNewPacked();
+        t = raxNew();
+        for (size_t i = 0; i < plens[k]; i++) lkey[i] = (i & 1) ? 0xff : 0;
+        for (long j = 0; j < 3000 && !err; j++) {
+            size_t len = plens[k] + rand() % 16;
+            for (size_t i = plens[k]; i < len; i++)
+                lkey[i] = "\x00\x01\xfe\xff"[rand()%4];
+            void *pold = NULL, *told = NULL;
+            int pr, tr;
+            if (raxSize(t) < 16 && rand() % 2) {
+                pr = raxInsert(p,lkey,len,(void*)(j+1),&pold);
+                tr = raxInsert(t,lkey,len,(void*)(j+1),&told);
+            } else {
+                /* Remove the first key >= the random one, so that most
+                 * removals hit. */
+                raxIterator ri;
+                raxStart(&ri,t);
+                raxSeek(&ri,">=",lkey,len);
+                if (!raxNext(&ri)) {
+                    raxSeek(&ri,"^",NULL,0);
+                    raxNext(&ri);
+                }
+                len = ri.key_len;
+                memcpy(lkey,ri.key,len);
+                raxStop(&ri);
+                pr = raxRemove(p,lkey,len,&pold);
+                tr = raxRemove(t,lkey,len,&told);
+            }
+            if (pr != tr || pold != told) err = 19;
+            else if (raxFind(p,lkey,len) != raxFind(t,lkey,len)) err = 20;
+            else if (j % 10 == 0) err = compareTrees(p,t,lkey,len);
+        }
+        raxAnalyze(p,&a);
+        if (!err && a.nodes != 0) err = 21;
+        raxFree(p);
+        raxFree(t);
+    }
+
+    /* Removals and insertions at every position of trees with a number of
+     * keys around the multiples of the restart interval, 8, so that the
+     * restart entries move and the front coding of the entries next to
+     * them changes. The inserted key is the empty one, going first, or a
+     * key followed by a zero byte, going right after it. */
+    int sizes[] = {7,8,9,15,16,17,24,25,31};
+    for (int s = 0; s < 9 && !err; s++) {
+        int n = sizes[s];
+        for (int pos = 0; pos <= n && !err; pos++) {
+            for (int del = 0; del < 2 && !err; del++) {
+                if (del && pos == n) continue;
+                p = raxNewPacked();
+                t = raxNew();
+                for (int j = 0; j < n; j++) {
+                    size_t len = packedBoundaryKey(key,j);
+                    raxInsert(p,key,len,(void*)(long)(j+1),NULL);
+                    raxInsert(t,key,len,(void*)(long)(j+1),NULL);
+                }
+                size_t len = pos == n ? 0 : packedBoundaryKey(key,pos);
+                int pr, tr;
+                if (del) {
+                    pr = raxRemove(p,key,len,NULL);
+                    tr = raxRemove(t,key,len,NULL);
+                } else {
+                    if (len) key[len++] = 0;
+                    pr = raxInsert(p,key,len,(void*)-1L,NULL);
+                    tr = raxInsert(t,key,len,(void*)-1L,NULL);
+                }
+                if (pr != 1 || tr != 1) err = 22;
+                for (int j = 0; j < n && !err; j++) {
+                    size_t klen = packedBoundaryKey(key,j);
+                    if (raxFind(p,key,klen) != raxFind(t,key,klen)) err = 23;
+                }
+                if (!err) err = compareTrees(p,t,key,len);
+                raxAnalyze(p,&a);
+                if (!err && a.nodes != 0) err = 24;
+                raxFree(p);
+                raxFree(t);
+            }
+        }
+    }
+
+    /* Keys sharing a 180 bytes prefix, inserted in order: restart entries
+     * store the key whole, the others just the last byte. The tree must be
+     * converted exactly when the entries no longer fit 1024 bytes, with
+     * 8 bytes pointers in the middle of the fourth restart block, and keep
+     * its content while shrinking back to empty, staying with nodes. */
+    p = raxNewPacked();
+    t = raxNew();
+    memset(lkey,0xff,180);
+    size_t bytes = 0;
+    for (int j = 0; j < 40 && !err; j++) {
+        lkey[180] = j;
+        bytes += 2 + (j % 8 ? 1 : 181) + sizeof(void*);
+        raxInsert(p,lkey,181,(void*)(long)(j+1),NULL);
+        raxInsert(t,lkey,181,(void*)(long)(j+1),NULL);
+        raxAnalyze(p,&a);
+        if ((bytes <= 1024) != (a.nodes == 0)) err = 25;
+        else err = compareTrees(p,t,lkey,181);
+    }
+    for (int j = 0; j < 40 && !err; j++) {
+        lkey[180] = (j*7) % 40;
+        void *pold = NULL, *told = NULL;
+        int pr = raxRemove(p,lkey,181,&pold);
+        int tr = raxRemove(t,lkey,181,&told);
+        if (pr != 1 || tr != 1 || pold != told) err = 26;
+        else err = compareTrees(p,t,lkey,181);
+    }
+    raxAnalyze(p,&a);
+    if (!err && (raxSize(p) != 0 || a.nodes == 0)) err = 27;
+    raxFree(p);
+    raxFree(t);
+
+    /* The exact limits: keys of 255 bytes and trees of 32 keys are still
+     * packed, even overwriting a key of a full tree, one more byte or one
+     * more key are not. */
+    p = raxNewPacked();
+    memset(lkey,0,sizeof(lkey));
+    raxInsert(p,lkey,255,(void*)1,NULL);
+    raxAnalyze(p,&a);
+    if (!err && a.nodes != 0) err = 28;
+    raxInsert(p,lkey,256,(void*)2,NULL);
+    raxAnalyze(p,&a);
+    if (!err && (a.nodes == 0 || raxFind(p,lkey,255) != (void*)1 ||
+        raxFind(p,lkey,256) != (void*)2)) err = 29;
+    raxFree(p);
+
+    p = raxNewPacked();
+    for (int j = 0; j < 32; j++)
+        raxInsert(p,key,packedBoundaryKey(key,j),(void*)(long)(j+1),NULL);
+    raxInsert(p,key,packedBoundaryKey(key,0),(void*)-1L,NULL);
+    raxAnalyze(p,&a);
+    if (!err && (a.nodes != 0 ||
+        raxFind(p,key,packedBoundaryKey(key,0)) != (void*)-1L)) err = 30;
+    raxInsert(p,key,packedBoundaryKey(key,32),(void*)33,NULL);
+    raxAnalyze(p,&a);
+    if (!err && (a.nodes == 0 || raxSize(p) != 33)) err = 31;
+    for (int j = 1; j <= 32 && !err; j++) {
+        if (raxFind(p,key,packedBoundaryKey(key,j)) != (void*)(long)(j+1))
+            err = 32;
+    }
+    raxFree(p);
+
+    if (err) {
+        printf("Packed test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Random operations on a tree allocating the nodes in an arena, compared
+ * with a normal tree, compacting it from time to time. */
+int arenaUnitTests(void) {
+    rax *t = raxNew(), *ref = raxNew();
+    unsigned char key[3000];
+    raxArenaInfo info;
+    int err = 0;
+
+    if (raxArenaGetInfo(t,&info) != 0 || info.pages != 0) err = 1;
+
+    /* Nodes allocated before enabling the arena are moved by compaction. */
+    for (int j = 0; j < 1000; j++) {
+        int len = snprintf((char*)key,sizeof(key),"key:%d",j);
+        raxInsert(t,key,len,(void*)(long)j,NULL);
+        raxInsert(ref,key,len,(void*)(long)j,NULL);
+    }
+    raxArenaEnable(t);
+    raxArenaCompact(t);
+    raxArenaGetInfo(t,&info);
+    if (!err && (info.nodes != t->numnodes || info.cold_pages == 0 ||
+        info.hot_pages != 0)) err = 2;
+
+    /* Some keys are long enough to be stored in nodes too large for the
+     * arena, that are allocated with rax_malloc(). */
+    for (long j = 0; j < 20000 && !err; j++) {
+        size_t len = (rand() % 100) ? (size_t)(1+rand()%10) : sizeof(key);
+        for (size_t i = 0; i < len; i++) key[i] = "abcdefgh"[rand()%8];
+        int r1, r2;
+        if (rand() % 2) {
+            r1 = raxInsert(t,key,len,(void*)j,NULL);
+            r2 = raxInsert(ref,key,len,(void*)j,NULL);
+        } else {
+            r1 = raxRemove(t,key,len,NULL);
+            r2 = raxRemove(ref,key,len,NULL);
+        }
+        if (r1 != r2) err = 3;
+        if (j % 5000 == 4999) {
+            raxArenaCompact(t);
+            raxArenaGetInfo(t,&info);
+            /* Chunks left empty by the compaction are released. */
+            if (info.nodes > t->numnodes || info.hot_pages != 0 ||
+                info.free_pages >= 64) err = 4;
+            if (!err) err = compareTrees(t,ref,key,len);
+        }
+    }
+    if (!err) err = compareTrees(t,ref,key,1);
+    raxArenaGetInfo(t,&info);
+    if (!err && (info.nodes == 0 || info.nodes > t->numnodes)) err = 5;
+    raxFree(t);
+    raxFree(ref);
+
+    /* A packed tree converted to nodes uses the arena as well. */
+    t = raxNewPacked();
+    raxArenaEnable(t);
+    for (int j = 0; j < 100; j++) {
+        int len = snprintf((char*)key,sizeof(key),"%d",j);
+        raxInsert(t,key,len,NULL,NULL);
+    }
+    raxArenaGetInfo(t,&info);
+    if (!err && (t->numnodes == 0 || info.nodes != t->numnodes)) err = 6;
+    raxFree(t);
+
+    if (err) {
+        printf("Arena test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Callbacks for valuesUnitTests(). */
+static void valuesCollect(void *value, void *privdata) {
+    long **pos = privdata;
+    *(*pos)++ = (long)value;
+}
+
+static long valuesFreed;
+static void valuesFree(void *value) {
+    valuesFreed += (long)value;
+}
+
+/* Random operations on a tree with a values array and on a normal tree
+ * must return the same values, and scans after raxValuesCompact() must
+ * visit the values in key order. */
+int valuesUnitTests(void) {
+    rax *t = raxNew(), *ref = raxNew();
+    unsigned char key[8];
+    static long scanned[5000], expected[5000];
+    int err = 0;
+
+    if (!raxValuesEnable(t)) err = 1;
+    for (long j = 1; j <= 50000 && !err; j++) {
+        size_t len = 1+rand()%4;
+        for (size_t i = 0; i < len; i++) key[i] = "abcdefgh"[rand()%8];
+        void *v = (rand()%10) ? (void*)j : NULL;
+        void *o1 = (void*)-1, *o2 = (void*)-1;
+        int r1, r2;
+        switch(rand()%4) {
+        case 0:
+            r1 = raxInsert(t,key,len,v,&o1);
+            r2 = raxInsert(ref,key,len,v,&o2);
+            break;
+        case 1:
+            r1 = raxTryInsert(t,key,len,v,&o1);
+            r2 = raxTryInsert(ref,key,len,v,&o2);
+            break;
+        case 2:
+            r1 = raxRemove(t,key,len,&o1);
+            r2 = raxRemove(ref,key,len,&o2);
+            break;
+        default:
+            o1 = raxFind(t,key,len);
+            o2 = raxFind(ref,key,len);
+            r1 = r2 = 0;
+            break;
+        }
+        if (r1 != r2 || o1 != o2) err = 2;
+        if (!err && j % 10000 == 0) {
+            if (!raxValuesCompact(t)) err = 3;
+            /* The scan matches the values iterated in key order. */
+            long *pos = scanned;
+            raxValuesScan(t,valuesCollect,&pos);
+            raxIterator ri;
+            raxStart(&ri,ref);
+            raxSeek(&ri,"^",NULL,0);
+            size_t count = 0;
+            while (raxNext(&ri)) expected[count++] = (long)ri.data;
+            raxStop(&ri);
+            if ((size_t)(pos-scanned) != count ||
+                memcmp(scanned,expected,sizeof(long)*count)) err = 4;
+        }
+    }
+    if (!err) err = compareTrees(t,ref,key,1);
+    if (!err && raxValuesEnable(ref)) err = 5;
+
+    long sum = 0;
+    raxIterator ri;
+    raxStart(&ri,ref);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) sum += (long)ri.data;
+    raxStop(&ri);
+    valuesFreed = 0;
+    raxFreeWithCallback(t,valuesFree);
+    if (!err && valuesFreed != sum) err = 6;
+    raxFree(ref);
+
+    if (err) {
+        printf("Values test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Drive groups of stepwise lookups in turn, like a scheduler would, and
+ * check that they return what raxFind() returns. */
+int lookupUnitTests(void) {
+    static unsigned char keys[1000][8];
+    static size_t lens[1000];
+    int err = 0;
+
+    for (int mode = 0; mode < 3 && !err; mode++) {
+        /* Nodes, values array and packed trees. */
+        rax *t = mode == 2 ? raxNewPacked() : raxNew();
+        int numkeys = mode == 2 ? 10 : 1000;
+        if (mode == 1) raxValuesEnable(t);
+        for (int j = 0; j < numkeys; j++) {
+            lens[j] = rand()%9;
+            for (size_t i = 0; i < lens[j]; i++)
+                keys[j][i] = "abcd"[rand()%4];
+            /* Only some keys are added, the others are looked up missing. */
+            if (rand()%2)
+                raxInsert(t,keys[j],lens[j],rand()%4 ? (void*)(long)j : NULL,
+                          NULL);
+        }
+
+        raxLookupState ls[8];
+        int inflight = 0, next = 0, done = 0, idx[8];
+        while (done < numkeys && !err) {
+            /* Refill, then step every lookup once. */
+            while (inflight < 8 && next < numkeys) {
+                idx[inflight] = next;
+                raxLookupStart(&ls[inflight],t,keys[next],lens[next]);
+                inflight++;
+                next++;
+            }
+            for (int j = 0; j < inflight; j++) {
+                if (raxLookupStep(&ls[j])) continue;
+                int k = idx[j];
+                if (ls[j].value != raxFind(t,keys[k],lens[k])) err = 1;
+                done++;
+                inflight--;
+                ls[j] = ls[inflight];
+                idx[j] = idx[inflight];
+                j--;
+            }
+        }
+        raxFree(t);
+    }
+
+    if (err) {
+        printf("Lookup test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Callback for jobUnitTests(): sums the values visited. */
+static int jobScan(unsigned char *key, size_t len, void *data,
+                   void *privdata)
+{
+    (void)key;
+    (void)len;
+    *(long*)privdata += (long)data;
+    return 1;
+}
+
+/* Sum the values of the keys of 't' in the specified range, removing them
+ * from the tree if 'del' is true. */
+static long jobRangeSum(rax *t, const char *lo_op, unsigned char *lo,
+                        size_t lo_len, const char *hi_op, unsigned char *hi,
+                        size_t hi_len, int del)
+{
+    raxIterator ri;
+    long sum = 0;
+    raxStart(&ri,t);
+    raxSeekRange(&ri,lo_op,lo,lo_len,hi_op,hi,hi_len);
+    while (raxNext(&ri)) {
+        sum += (long)ri.data;
+        if (del) {
+            raxRemove(t,ri.key,ri.key_len,NULL);
+            raxSeekRange(&ri,">",ri.key,ri.key_len,hi_op,hi,hi_len);
+        }
+    }
+    raxStop(&ri);
+    return sum;
+}
+
+/* Run jobs with small budgets, modifying the tree between the runs, and
+ * compare the results with the same operations performed at once. Keys
+ * contain 255 bytes in order to check the prefix upper bound. */
+int jobUnitTests(void) {
+    unsigned char key[8], lo[4], hi[4], prefix[2];
+    int err = 0;
+
+    for (int mode = 0; mode < 3 && !err; mode++) {
+        /* Nodes, values array and packed trees. */
+        rax *t = mode == 2 ? raxNewPacked() : raxNew(), *ref = raxNew();
+        int numkeys = mode == 2 ? 20 : 5000;
+        raxJob job;
+        size_t len;
+        long sum;
+
+        if (mode == 1) raxValuesEnable(t);
+        for (long j = 1; j <= numkeys; j++) {
+            len = 1+rand()%8;
+            for (size_t i = 0; i < len; i++) key[i] = "ab\xff"[rand()%3];
+            raxInsert(t,key,len,(void*)j,NULL);
+            raxInsert(ref,key,len,(void*)j,NULL);
+        }
+
+        /* Scan, removing the last key visited between the runs. */
+        sum = 0;
+        long expected = jobRangeSum(ref,"^",NULL,0,"$",NULL,0,0);
+        if (!raxScanJob(&job,t,jobScan,&sum)) err = 1;
+        int runs = 0;
+        while (!err && raxJobRun(&job,3,0)) {
+            memcpy(key,job.it.key,job.it.key_len);
+            raxRemove(t,key,job.it.key_len,NULL);
+            raxRemove(ref,key,job.it.key_len,NULL);
+            runs++;
+        }
+        if (!err && (sum != expected || runs < (int)raxSize(ref)/3))
+            err = 2;
+        if (!err) err = compareTrees(t,ref,key,1) ? 3 : 0;
+
+        /* Remove a prefix, adding keys out of the prefix between runs. */
+        size_t plen = 1+rand()%2;
+        for (size_t i = 0; i < plen; i++) prefix[i] = "ab\xff"[rand()%3];
+        valuesFreed = 0;
+        if (!err && !raxRemovePrefixJob(&job,t,prefix,plen,valuesFree))
+            err = 4;
+        while (!err && raxJobRun(&job,5,0)) {
+            len = 1+rand()%8;
+            for (size_t i = 0; i < len; i++) key[i] = "ab\xff"[rand()%3];
+            if (len >= plen && memcmp(key,prefix,plen) == 0) continue;
+            raxInsert(t,key,len,(void*)1,NULL);
+            raxInsert(ref,key,len,(void*)1,NULL);
+        }
+        raxIterator ri;
+        raxStart(&ri,ref);
+        raxSeek(&ri,">=",prefix,plen);
+        sum = 0;
+        while (raxNext(&ri) && ri.key_len >= plen &&
+               memcmp(ri.key,prefix,plen) == 0)
+        {
+            sum += (long)ri.data;
+            raxRemove(ref,ri.key,ri.key_len,NULL);
+            raxSeek(&ri,">",ri.key,ri.key_len);
+        }
+        raxStop(&ri);
+        if (!err && valuesFreed != sum) err = 5;
+        if (!err) err = compareTrees(t,ref,prefix,plen) ? 6 : 0;
+
+        /* Remove a range with a time budget. */
+        for (size_t i = 0; i < 4; i++) {
+            lo[i] = "ab\xff"[rand()%3];
+            hi[i] = "ab\xff"[rand()%3];
+        }
+        valuesFreed = 0;
+        if (!err && !raxRemoveRangeJob(&job,t,">",lo,2,"<=",hi,3,valuesFree))
+            err = 7;
+        while (!err && raxJobRun(&job,0,1));
+        sum = jobRangeSum(ref,">",lo,2,"<=",hi,3,1);
+        if (!err && valuesFreed != sum) err = 8;
+        if (!err) err = compareTrees(t,ref,lo,2) ? 9 : 0;
+        if (!err && raxRemoveRangeJob(&job,t,"==",lo,2,"$",NULL,0,NULL))
+            err = 10;
+
+        /* Free, stopping the job half way for the packed tree. */
+        expected = jobRangeSum(ref,"^",NULL,0,"$",NULL,0,0);
+        valuesFreed = 0;
+        raxFreeJob(&job,t,valuesFree);
+        runs = 0;
+        while (raxJobRun(&job,50,0)) {
+            if (mode == 2) raxJobStop(&job);
+            runs++;
+        }
+        if (!err && (valuesFreed != expected || job.rt != NULL)) err = 11;
+        if (!err && mode != 2 && runs < 10) err = 12;
+        raxFree(ref);
+    }
+
+    if (err) {
+        printf("Job test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Insert keys after reserving room for them: with the counting allocator
+ * the insertions must perform no allocator call. */
+int reserveUnitTests(void) {
+    int err = 0;
+    for (int keylen = 4; keylen <= 32 && !err; keylen *= 2) {
+        rax *t = raxNew();
+        int numkeys = 20000;
+        unsigned char key[32];
+        raxArenaInfo info;
+
+        if (!raxReserve(t,numkeys,keylen)) err = 1;
+        raxArenaGetInfo(t,&info);
+        if (!err && (info.free_pages == 0 || info.pages != info.free_pages))
+            err = 2;
+#ifdef RAX_COUNT_MALLOC
+        unsigned long long calls = rax_malloc_calls+rax_realloc_calls;
+#endif
+        /* Random keys of 4 bytes may repeat: count the ones added. */
+        uint64_t added = 0;
+        for (int j = 0; j < numkeys; j++) {
+            for (int i = 0; i < keylen; i++) key[i] = rand();
+            added += raxInsert(t,key,keylen,NULL,NULL);
+        }
+#ifdef RAX_COUNT_MALLOC
+        if (!err && rax_malloc_calls+rax_realloc_calls != calls) {
+            printf("%llu allocator calls inserting %d keys of %d bytes\n",
+                rax_malloc_calls+rax_realloc_calls-calls, numkeys, keylen);
+            err = 3;
+        }
+#endif
+        /* Some reserved pages are left, and released on demand. */
+        raxArenaGetInfo(t,&info);
+        if (!err && (info.nodes > t->numnodes || info.free_pages == 0))
+            err = 4;
+        raxReserveRelease(t);
+        raxArenaGetInfo(t,&info);
+        if (!err && info.free_pages >= 64) err = 5;
+        if (!err && raxSize(t) != added) err = 6;
+        raxFree(t);
+    }
+
+    if (err) {
+        printf("Reserve test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Compare raxSeekRange() iterations with raxSeek() followed by raxCompare()
+ * checks, on random ranges of random keys, both with nodes and packed. */
+int seekRangeUnitTests(void) {
+    const char *loops[] = {">",">=","^"}, *hiops[] = {"<","<=","$"};
+    static unsigned char keys[2000][8];
+    static size_t lens[2000];
+    int err = 0;
+
+    for (int packed = 0; packed < 2 && !err; packed++) {
+        rax *t = packed ? raxNewPacked() : raxNew();
+        int numkeys = packed ? 20 : 2000;
+        unsigned char key[8], lo[8], hi[8];
+        for (int j = 0; j < numkeys; j++) {
+            size_t len = 1+rand()%6;
+            for (size_t i = 0; i < len; i++) key[i] = "abcd"[rand()%4];
+            raxInsert(t,key,len,NULL,NULL);
+        }
+        if (packed && t->numnodes != 0) err = 1;
+
+        raxIterator ri, ref;
+        raxStart(&ri,t);
+        raxStart(&ref,t);
+        for (int j = 0; j < 2000 && !err; j++) {
+            size_t lolen = rand()%5, hilen = rand()%5;
+            for (size_t i = 0; i < lolen; i++) lo[i] = "abcd"[rand()%4];
+            for (size_t i = 0; i < hilen; i++) hi[i] = "abcd"[rand()%4];
+            const char *loop = loops[rand()%3], *hiop = hiops[rand()%3];
+            if (!raxSeekRange(&ri,loop,lo,lolen,hiop,hi,hilen)) err = 2;
+            raxSeek(&ref,loop,lo,lolen);
+
+            /* Walk forward, then back from the last element of the range,
+             * that must stop at the lower bound. */
+            int count = 0;
+            while (!err) {
+                int r1 = raxNext(&ri);
+                int r2 = raxNext(&ref) &&
+                         (hiop[0] == '$' || raxCompare(&ref,hiop,hi,hilen));
+                if (r1 != r2) err = 3;
+                else if (r1 && (ri.key_len != ref.key_len ||
+                         memcmp(ri.key,ref.key,ri.key_len))) err = 4;
+                if (!r1) break;
+                memcpy(keys[count],ri.key,ri.key_len);
+                lens[count++] = ri.key_len;
+            }
+            if (err || count == 0) continue;
+            raxSeekRange(&ri,loop,lo,lolen,hiop,hi,hilen);
+            for (int i = 0; i < count; i++) raxNext(&ri);
+            for (int i = count-2; i >= 0 && !err; i--) {
+                if (!raxPrev(&ri) || ri.key_len != lens[i] ||
+                    memcmp(ri.key,keys[i],lens[i])) err = 5;
+            }
+            if (!err && raxPrev(&ri)) err = 6;
+
+            /* Random mix of steps in both directions, so that each bound
+             * is checked after the key changed in the other direction. */
+            raxSeekRange(&ri,loop,lo,lolen,hiop,hi,hilen);
+            raxNext(&ri);
+            int pos = 0;
+            for (int i = 0; i < 30 && !err; i++) {
+                int next = rand()%2;
+                int r = next ? raxNext(&ri) : raxPrev(&ri);
+                pos += next ? 1 : -1;
+                if (pos < 0 || pos == count) {
+                    if (r) err = 9;
+                    break;
+                }
+                if (!r || ri.key_len != lens[pos] ||
+                    memcmp(ri.key,keys[pos],lens[pos])) err = 10;
+            }
+        }
+        /* Syntax errors. */
+        if (!err && raxSeekRange(&ri,"<",lo,1,"<",hi,1)) err = 7;
+        if (!err && raxSeekRange(&ri,">",lo,1,"==",hi,1)) err = 8;
+        raxStop(&ri);
+        raxStop(&ref);
+        raxFree(t);
+    }
+
+    if (err) {
+        printf("Seek range test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Intern strings, some of them repeated, and check that the IDs are dense,
+ * stable, and map back to the same strings. */
+int internUnitTests(void) {
+    raxIntern *in = raxInternNew();
+    char buf[64];
+    int err = 0;
+
+    if (raxInternFind(in,(unsigned char*)"a",1) != RAX_INTERN_NONE) err = 1;
+    for (int j = 0; j < 10000 && !err; j++) {
+        int len = snprintf(buf,sizeof(buf),"field:%d",j%3000);
+        uint32_t id = raxInternAdd(in,(unsigned char*)buf,len);
+        if (id != (uint32_t)(j%3000)) err = 2;
+    }
+    if (!err && in->count != 3000) err = 3;
+
+    /* The empty string is a string like the others. */
+    if (!err && raxInternAdd(in,(unsigned char*)"",0) != 3000) err = 4;
+
+    /* Batch, with a string repeated and one interned already. */
+    const unsigned char *strs[4] = {(unsigned char*)"x",
+        (unsigned char*)"field:7", (unsigned char*)"yy", (unsigned char*)"x"};
+    size_t lens[4] = {1,7,2,1};
+    uint32_t ids[4];
+    if (!err && raxInternBatch(in,strs,lens,4,ids) != 4) err = 5;
+    if (!err && (ids[0] != 3001 || ids[1] != 7 || ids[2] != 3002 ||
+                 ids[3] != 3001)) err = 6;
+
+    for (uint32_t id = 0; id < in->count && !err; id++) {
+        size_t len;
+        const unsigned char *s = raxInternString(in,id,&len);
+        if (s == NULL) err = 7;
+        else if (raxInternFind(in,s,len) != id) err = 8;
+    }
+    size_t len;
+    if (!err && raxInternString(in,in->count,&len) != NULL) err = 9;
+    if (!err && (raxInternString(in,3000,&len) == NULL || len != 0)) err = 10;
+    raxInternFree(in);
+
+    if (err) {
+        printf("Intern test failed with error %d\n", err);
+        return 1;
+    }
+    return 0;
+}
+
+/* Record a small workload and read it back. Recording needs RAX_TRACE,
+ * so the test is skipped by the builds without it. */
+int recordUnitTests(void) {
+    const char *filename = "rax-test-record.tmp";
+    if (!raxRecordStart(filename,0)) {
+        if (errno == ENOTSUP) return 0;
+        printf("Can't start recording: %s\n", strerror(errno));
+        return 1;
+    }
+    rax *t = raxNew();
+    raxInsert(t,(unsigned char*)"alpha",5,NULL,NULL);
+    raxInsert(t,(unsigned char*)"alps",4,NULL,NULL);
+    raxInsert(t,(unsigned char*)"beta",4,NULL,NULL);
+    raxTryInsert(t,(unsigned char*)"alpha",5,NULL,NULL);
+    raxRemove(t,(unsigned char*)"beta",4,NULL);
+    raxFind(t,(unsigned char*)"alps",4);
+    raxFind(t,(unsigned char*)"zzz",3);
+    raxIterator ri;
+    raxStart(&ri,t);
+    raxSeek(&ri,">=",(unsigned char*)"al",2);
+    while(raxNext(&ri));
+    raxStop(&ri);
+    raxFree(t);
+    if (!raxRecordStop()) {
+        printf("Error writing the recording\n");
+        return 1;
+    }
+
+    struct {
+        int op, result;
+        const char *seek_op, *key;
+    } expected[] = {
+        {RAX_OP_NEW,1,NULL,NULL},
+        {RAX_OP_INSERT,1,NULL,"alpha"},
+        {RAX_OP_INSERT,1,NULL,"alps"},
+        {RAX_OP_INSERT,1,NULL,"beta"},
+        {RAX_OP_TRYINSERT,0,NULL,"alpha"},
+        {RAX_OP_REMOVE,1,NULL,"beta"},
+        {RAX_OP_FIND,1,NULL,"alps"},
+        {RAX_OP_FIND,0,NULL,"zzz"},
+        {RAX_OP_SEEK,1,">=","al"},
+        {RAX_OP_NEXT,1,NULL,NULL},
+        {RAX_OP_NEXT,1,NULL,NULL},
+        {RAX_OP_NEXT,0,NULL,NULL},
+        {RAX_OP_FREE,0,NULL,NULL}
+    };
+    int numexpected = sizeof(expected)/sizeof(expected[0]);
+
+    raxRecordReader r;
+    raxRecord rec;
+    int count = 0, err = 0, retval;
+    if (!raxRecordOpen(&r,filename)) {
+        printf("Can't open the recording: %s\n", strerror(errno));
+        remove(filename);
+        return 1;
+    }
+    while((retval = raxRecordNext(&r,&rec)) == 1) {
+        if (count >= numexpected) {
+            err = 1;
+            break;
+        }
+        const char *key = expected[count].key;
+        if (rec.op != expected[count].op ||
+            rec.result != expected[count].result ||
+            rec.tree != 0 || rec.iter != 0) err = 2;
+        if (expected[count].seek_op &&
+            (rec.seek_op == NULL ||
+             strcmp(rec.seek_op,expected[count].seek_op) != 0)) err = 3;
+        if (key && (rec.key_len != strlen(key) ||
+                    memcmp(rec.key,key,rec.key_len) != 0)) err = 4;
+        if (err) break;
+        count++;
+    }
+    raxRecordClose(&r);
+    if (retval == -1) err = 5;
+    if (!err && count != numexpected) err = 6;
+
+    /* Hashed keys keep their length and the prefixes they share. */
+    if (!err) {
+        raxRecordStart(filename,RAX_RECORD_HASH_KEYS);
+        t = raxNew();
+        raxInsert(t,(unsigned char*)"abc",3,NULL,NULL);
+        raxInsert(t,(unsigned char*)"abd",3,NULL,NULL);
+        raxFree(t);
+        raxRecordStop();
+        unsigned char keys[2][3];
+        count = 0;
+        raxRecordOpen(&r,filename);
+        while(raxRecordNext(&r,&rec) == 1) {
+            if (rec.op != RAX_OP_INSERT) continue;
+            if (rec.key_len != 3) err = 7;
+            else memcpy(keys[count++],rec.key,3);
+        }
+        if (!(r.flags & RAX_RECORD_HASH_KEYS)) err = 8;
+        raxRecordClose(&r);
+        if (!err && (count != 2 || memcmp(keys[0],keys[1],2) != 0 ||
+                     keys[0][2] == keys[1][2])) err = 9;
+    }
+    remove(filename);
+    if (err) {
+        printf("Record test failed with error %d at record %d\n", err, count);
+        return 1;
+    }
+    return 0;
+}
+
 /* Regression test #1: Iterator wrong element returned after seek. */
 int regtest1(void) {
     rax *rax = raxNew();
@@ -799,21 +2187,32 @@ int regtest5(void) {
 }
 
 void benchmark(void) {
+    PerfAvailable = perfCountersInit();
+    if (!PerfAvailable) {
+        printf("Hardware performance counters not available: %s\n",
+            perfCountersError());
+    }
     for (int mode = 0; mode < 2; mode++) {
         printf("Benchmark with %s keys:\n",
             (mode == 0) ? "integer" : "alphanumerical");
         rax *t = raxNew();
+        allocCallsReport(NULL,0);
         long long start = ustime();
+        perfPhaseStart();
         for (int i = 0; i < 5000000; i++) {
             char buf[64];
             int len = int2key(buf,sizeof(buf),i,mode);
             raxInsert(t,(unsigned char*)buf,len,(void*)(long)i,NULL);
         }
         printf("Insert: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Insert",5000000);
+        treeStatsReport(t,"Insert",5000000);
+        allocCallsReport("Insert",5000000);
         printf("%llu total nodes\n", (unsigned long long)t->numnodes);
         printf("%llu total elements\n", (unsigned long long)t->numele);
 
         start = ustime();
+        perfPhaseStart();
         for (int i = 0; i < 5000000; i++) {
             char buf[64];
             int len = int2key(buf,sizeof(buf),i,mode);
@@ -824,8 +2223,11 @@ void benchmark(void) {
             }
         }
         printf("Linear lookup: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Linear lookup",5000000);
+        treeStatsReport(t,"Linear lookup",5000000);
 
         start = ustime();
+        perfPhaseStart();
         for (int i = 0; i < 5000000; i++) {
             char buf[64];
             int r = rc4rand() % 5000000;
@@ -837,8 +2239,11 @@ void benchmark(void) {
             }
         }
         printf("Random lookup: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Random lookup",5000000);
+        treeStatsReport(t,"Random lookup",5000000);
 
         start = ustime();
+        perfPhaseStart();
         for (int i = 0; i < 5000000; i++) {
             char buf[64];
             int len = int2key(buf,sizeof(buf),i,mode);
@@ -849,8 +2254,11 @@ void benchmark(void) {
             }
         }
         printf("Failed lookup: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Failed lookup",5000000);
+        treeStatsReport(t,"Failed lookup",5000000);
 
         start = ustime();
+        perfPhaseStart();
         raxIterator ri;
         raxStart(&ri,t);
         raxSeek(&ri,"^",NULL,0);
@@ -859,8 +2267,12 @@ void benchmark(void) {
         if (iter != 5000000) printf("** Warning iteration is incomplete\n");
         raxStop(&ri);
         printf("Full iteration: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Full iteration",5000000);
 
+        allocCallsReport(NULL,0);
+        treeStatsReport(t,NULL,0);
         start = ustime();
+        perfPhaseStart();
         for (int i = 0; i < 5000000; i++) {
             char buf[64];
             int len = int2key(buf,sizeof(buf),i,mode);
@@ -868,6 +2280,9 @@ void benchmark(void) {
             assert(retval == 1);
         }
         printf("Deletion: %f\n", (double)(ustime()-start)/1000000);
+        perfPhaseReport("Deletion",5000000);
+        treeStatsReport(t,"Deletion",5000000);
+        allocCallsReport("Deletion",5000000);
 
         printf("%llu total nodes\n", (unsigned long long)t->numnodes);
         printf("%llu total elements\n", (unsigned long long)t->numele);
@@ -875,13 +2290,565 @@ void benchmark(void) {
     }
 }
 
-/* Compressed nodes can only hold (2^29)-1 characters, so it is important
- * to test for keys bigger than this amount, in order to make sure that
- * the code to handle this edge case works as expected.
+/* Compare the generic API, where values larger than a pointer need to be
+ * allocated by the caller, with the trees generated by RAX_DEFINE(). */
+void typedBenchmark(void) {
+    printf("Benchmark of typed trees vs generic API:\n");
+    for (int typed = 0; typed < 2; typed++) {
+        rax *t = raxNew();
+        typedStructTree st;
+        typedStructTreeInit(&st);
+        long long start = ustime();
+        for (int i = 0; i < 5000000; i++) {
+            char buf[64];
+            int len = int2key(buf,sizeof(buf),i,KEY_INT);
+            typedTestVal v = {i, i, i};
+            if (typed) {
+                typedStructTreeInsert(&st,(unsigned char*)buf,len,v);
+            } else {
+                typedTestVal *copy = malloc(sizeof(*copy));
+                *copy = v;
+                raxInsert(t,(unsigned char*)buf,len,copy,NULL);
+            }
+        }
+        printf("%s insert: %f\n", typed ? "Typed" : "Generic",
+            (double)(ustime()-start)/1000000);
+
+        start = ustime();
+        uint64_t sum = 0;
+        for (int i = 0; i < 5000000; i++) {
+            char buf[64];
+            int r = rc4rand() % 5000000;
+            int len = int2key(buf,sizeof(buf),r,KEY_INT);
+            if (typed) {
+                typedTestVal v;
+                typedStructTreeFind(&st,(unsigned char*)buf,len,&v);
+                sum += v.a;
+            } else {
+                typedTestVal *v = raxFind(t,(unsigned char*)buf,len);
+                sum += v->a;
+            }
+        }
+        printf("%s random lookup: %f (checksum %llu)\n",
+            typed ? "Typed" : "Generic",
+            (double)(ustime()-start)/1000000, (unsigned long long)sum);
+
+        start = ustime();
+        raxFreeWithCallback(t,free);
+        typedStructTreeFree(&st);
+        printf("%s free: %f\n", typed ? "Typed" : "Generic",
+            (double)(ustime()-start)/1000000);
+    }
+}
+
+/* Return the number of bytes the allocator reserved for 'ptr', that was
+ * obtained asking for 'size' bytes. When the libc can't report it, just
+ * the requested size is used. */
+size_t usableSize(void *ptr, size_t size) {
+#ifdef __GLIBC__
+    (void)size;
+    return malloc_usable_size(ptr);
+#else
+    (void)ptr;
+    return size;
+#endif
+}
+
+/* Memory used by a radix tree, computed walking all its nodes. The
+ * 'requested' field is the sum of all the parts below, plus the rax
+ * structure itself. */
+typedef struct memStats {
+    uint64_t nodes;
+    uint64_t header;    /* Node headers. */
+    uint64_t edges;     /* Edge characters or compressed string bytes. */
+    uint64_t padding;   /* Padding to align the child pointers. */
+    uint64_t children;  /* Child pointers. */
+    uint64_t values;    /* Value pointers (keys with a NULL value have none). */
+    uint64_t requested; /* Bytes requested to the allocator. */
+    uint64_t usable;    /* Bytes actually reserved by the allocator. */
+} memStats;
+
+static memStats MemStats;
+
+/* Account the node 'n' into MemStats. The layout computation must match
+ * the one of rax.c. */
+void memStatsAddNode(raxNode *n) {
+#ifdef RAX_SMALL_HEADER
+    size_t padding = 0;
+#else
+    size_t padding = (sizeof(void*)-((n->size+4)%sizeof(void*))) &
+                     (sizeof(void*)-1);
+#endif
+    size_t children = n->iscompr ? 1 : n->size;
+    size_t values = (n->iskey && !n->isnull) ? sizeof(void*) : 0;
+    size_t len = sizeof(raxNode)+n->size+padding+
+                 children*sizeof(raxNode*)+values;
+    MemStats.nodes++;
+    MemStats.header += sizeof(raxNode);
+    MemStats.edges += n->size;
+    MemStats.padding += padding;
+    MemStats.children += children*sizeof(raxNode*);
+    MemStats.values += values;
+    MemStats.requested += len;
+    MemStats.usable += usableSize(n,len);
+}
+
+int memStatsNodeCallback(raxNode **noderef) {
+    memStatsAddNode(*noderef);
+    return 0;
+}
+
+/* Compute the memory used by 't' into MemStats. The node callback of the
+ * iterator visits every node but the head. */
+void memStatsCompute(rax *t) {
+    memset(&MemStats,0,sizeof(MemStats));
+    MemStats.requested = sizeof(rax);
+    MemStats.usable = usableSize(t,sizeof(rax));
+    memStatsAddNode(t->head);
+
+    raxIterator ri;
+    raxStart(&ri,t);
+    ri.node_cb = memStatsNodeCallback;
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri));
+    raxStop(&ri);
+}
+
+/* Return the bytes used by the reference hash table. */
+uint64_t htMemory(hashtable *ht) {
+    uint64_t bytes = usableSize(ht,sizeof(*ht));
+    for (int j = 0; j < HT_TABLE_SIZE; j++) {
+        for (htNode *n = ht->table[j]; n; n = n->next) {
+            bytes += usableSize(n,sizeof(*n));
+            bytes += usableSize(n->key,n->keylen);
+        }
+    }
+    return bytes;
+}
+
+/* Measure the memory used by rax to store keys of different distributions
+ * and tree sizes, each key having a non NULL value, and compare it with
+ * the hash table and the sorted array implementations used by the fuzz
+ * tests to store the same keys and values. */
+void memoryBenchmark(void) {
+    const char *modenames[] = {"integer", "unique alphanumerical",
+                               "random alphanumerical", "random binary"};
+    int modes[] = {KEY_INT, KEY_UNIQUE_ALPHA, KEY_RANDOM_ALPHA, KEY_RANDOM};
+    size_t sizes[] = {1000, 100000, 1000000};
+
+    printf("Memory benchmark (bytes per key):\n");
+    for (int m = 0; m < 4; m++) {
+        for (int s = 0; s < 3; s++) {
+            size_t count = sizes[s];
+#ifdef RAX_COUNT_MALLOC
+            unsigned long long allocated = rax_alloc_bytes;
+#endif
+            rax *t = raxNew();
+            hashtable *ht = htNew();
+            arrayItem *array = malloc(sizeof(arrayItem)*count);
+            void **values = malloc(sizeof(void*)*count);
+            uint64_t keybytes = 0;
+            size_t numele = 0;
+
+            for (size_t i = 0; i < count; i++) {
+                char buf[64];
+                size_t len = int2key(buf,sizeof(buf),i,modes[m]);
+                void *val = (void*)(uintptr_t)(i+1);
+                if (!raxInsert(t,(unsigned char*)buf,len,val,NULL))
+                    continue;
+                htAdd(ht,(unsigned char*)buf,len,val);
+                array[numele].key = malloc(len ? len : 1);
+                memcpy(array[numele].key,buf,len);
+                array[numele].key_len = len;
+                values[numele] = val;
+                keybytes += len;
+                numele++;
+            }
+            qsort(array,numele,sizeof(arrayItem),compareArrayItems);
+
+            memStatsCompute(t);
+            uint64_t htbytes = htMemory(ht);
+            uint64_t arraybytes = usableSize(array,sizeof(arrayItem)*count)+
+                                  usableSize(values,sizeof(void*)*count);
+            for (size_t i = 0; i < numele; i++)
+                arraybytes += usableSize(array[i].key,
+                                         array[i].key_len ? array[i].key_len : 1);
+
+            double n = numele ? numele : 1;
+            printf("%s keys, %zu keys (%.1f bytes avg), %llu nodes:\n",
+                modenames[m], numele, keybytes/n,
+                (unsigned long long)MemStats.nodes);
+            printf("  rax: %.1f requested, %.1f allocated "
+                   "(header %.1f, edges %.1f, padding %.1f, "
+                   "children %.1f, values %.1f)\n",
+                MemStats.requested/n, MemStats.usable/n,
+                MemStats.header/n, MemStats.edges/n, MemStats.padding/n,
+                MemStats.children/n, MemStats.values/n);
+#ifdef RAX_COUNT_MALLOC
+            printf("  rax: %.1f allocated according to the allocator\n",
+                (rax_alloc_bytes-allocated)/n);
+#endif
+            printf("  hash table: %.1f allocated (%d buckets)\n",
+                htbytes/n, HT_TABLE_SIZE);
+            printf("  sorted array: %.1f allocated\n", arraybytes/n);
+
+            for (size_t i = 0; i < numele; i++) free(array[i].key);
+            free(array);
+            free(values);
+            htFree(ht);
+            raxFree(t);
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------------
+ * Worst case workload finder (--fuzz-worst).
+ *
+ * Instead of checking correctness, this fuzzer mutates sequences of
+ * operations looking for the ones maximizing the time per operation and,
+ * when compiled with the counting allocator (rax-test-count), the allocator
+ * calls per operation. The search starts from random sequences and from the
+ * known pathological patterns of radix trees: a node grown one child at a
+ * time by raxAddChild() up to 256 children, the same compressed node split
+ * and recompressed over and over, and a chain of keys each prefix of the
+ * next, deep enough to move the raxStack of the walks to the heap.
+ *
+ * The worst sequences found are reported, and the worst one for every
+ * objective is saved as a recording (see rax_record.h), so that it can be
+ * replayed with rax-replay as a benchmark regression.
+ * ------------------------------------------------------------------------ */
+
+#define WORST_MAXOPS 512
+#define WORST_MINOPS 16
+#define WORST_MAXKEYLEN 128
+#define WORST_ITERATIONS 3000
+#define WORST_REPEAT 8          /* Runs of the sequence per time sample. */
+#define WORST_SAMPLES 5         /* Time samples, the fastest is used. */
+#define WORST_TOP 3             /* Sequences reported per objective. */
+
+#define WORST_LATENCY 0
+#define WORST_ALLOCS 1
+#define WORST_OBJECTIVES 2
+
+static const char *WorstObjectives[WORST_OBJECTIVES] = {"latency","allocs"};
+static const char *WorstUnits[WORST_OBJECTIVES] = {"ns/op","calls/op"};
+
+typedef struct worstOp {
+    unsigned char op;   /* RAX_OP_INSERT, REMOVE, FIND or SEEK. */
+    unsigned char len;
+    unsigned char key[WORST_MAXKEYLEN];
+} worstOp;
+
+typedef struct worstSeq {
+    const char *origin;     /* Pattern the sequence was derived from. */
+    int numops;
+    double cost;
+    worstOp ops[WORST_MAXOPS];
+} worstSeq;
+
+static const unsigned char WorstOpTypes[] = {
+    RAX_OP_INSERT, RAX_OP_REMOVE, RAX_OP_FIND, RAX_OP_SEEK
+};
+
+static void worstAddOp(worstSeq *seq, int op, const void *key, size_t len) {
+    worstOp *o = seq->ops+seq->numops++;
+    o->op = op;
+    o->len = len;
+    memcpy(o->key,key,len);
+}
+
+/* Keys from a tiny alphabet, so that random keys share prefixes. */
+static void worstRandomKey(worstOp *o) {
+    o->len = 1 + rc4rand() % 16;
+    for (int j = 0; j < o->len; j++) o->key[j] = 'a' + rc4rand() % 4;
+}
+
+static void worstSeedRandom(worstSeq *seq) {
+    seq->origin = "random";
+    seq->numops = WORST_MAXOPS/2;
+    for (int j = 0; j < seq->numops; j++) {
+        seq->ops[j].op = WorstOpTypes[rc4rand() % 4];
+        worstRandomKey(seq->ops+j);
+    }
+}
+
+/* A node growing to 256 children one by one, then shrinking. */
+static void worstSeedWide(worstSeq *seq) {
+    seq->origin = "wide node";
+    seq->numops = 0;
+    for (int op = 0; op < 2; op++) {
+        for (int b = 0; b < 256; b++) {
+            unsigned char key[2] = {'w', (unsigned char)b};
+            worstAddOp(seq,op ? RAX_OP_REMOVE : RAX_OP_INSERT,key,2);
+        }
+    }
+}
+
+/* A long compressed node split in the middle, then recompressed by the
+ * removal of the key causing the split, again and again. */
+static void worstSeedSplit(worstSeq *seq) {
+    unsigned char key[64];
+    for (int j = 0; j < 64; j++) key[j] = 'a' + j % 26;
+    seq->origin = "split/recompress";
+    seq->numops = 0;
+    worstAddOp(seq,RAX_OP_INSERT,key,64);
+    key[32] = 'X';
+    while (seq->numops+2 <= WORST_MAXOPS) {
+        worstAddOp(seq,RAX_OP_INSERT,key,33);
+        worstAddOp(seq,RAX_OP_REMOVE,key,33);
+    }
+}
+
+/* Keys each prefix of the next, deeper than RAX_STACK_STATIC_ITEMS, inserted
+ * then removed starting from the shortest. */
+static void worstSeedChain(worstSeq *seq) {
+    unsigned char key[WORST_MAXKEYLEN];
+    memset(key,'A',sizeof(key));
+    seq->origin = "deep chain";
+    seq->numops = 0;
+    for (int op = 0; op < 2; op++)
+        for (int len = 1; len < WORST_MAXKEYLEN; len++)
+            worstAddOp(seq,op ? RAX_OP_REMOVE : RAX_OP_INSERT,key,len);
+}
+
+/* Apply a few random mutations to the sequence. */
+static void worstMutate(worstSeq *seq) {
+    int mutations = 1 + rc4rand() % 4;
+    while(mutations--) {
+        worstOp *o = seq->ops + rc4rand() % seq->numops;
+        worstOp *other = seq->ops + rc4rand() % seq->numops;
+        switch(rc4rand() % 8) {
+        case 0: /* Change the operation type. */
+            o->op = WorstOpTypes[rc4rand() % 4];
+            break;
+        case 1: /* Change a key byte. */
+            if (o->len) o->key[rc4rand() % o->len] = rc4rand() % 2 ?
+                        'a' + rc4rand() % 4 : rc4rand() % 256;
+            break;
+        case 2: /* Make the key longer or shorter. */
+            if (rc4rand() % 2 && o->len < WORST_MAXKEYLEN)
+                o->key[o->len++] = 'a' + rc4rand() % 4;
+            else
+                o->len = rc4rand() % (o->len+1);
+            break;
+        case 3: /* Reuse the key of another operation. */
+            *o = *other;
+            o->op = WorstOpTypes[rc4rand() % 4];
+            break;
+        case 4: /* Share a prefix with another key. */
+            o->len = rc4rand() % (other->len+1);
+            memcpy(o->key,other->key,o->len);
+            while (o->len < WORST_MAXKEYLEN && rc4rand() % 2)
+                o->key[o->len++] = rc4rand() % 256;
+            break;
+        case 5: { /* Swap two operations. */
+            worstOp tmp = *o;
+            *o = *other;
+            *other = tmp;
+            break;
+        }
+        case 6: { /* Copy a block of operations somewhere else. */
+            int from = o - seq->ops, to = other - seq->ops;
+            int len = 1 + rc4rand() % 32;
+            if (from+len > seq->numops) len = seq->numops-from;
+            if (to+len > seq->numops) len = seq->numops-to;
+            memmove(seq->ops+to,seq->ops+from,sizeof(worstOp)*len);
+            break;
+        }
+        case 7: { /* Add or remove an operation. */
+            int pos = o - seq->ops;
+            if (rc4rand() % 2 && seq->numops < WORST_MAXOPS) {
+                memmove(seq->ops+pos+1,seq->ops+pos,
+                        sizeof(worstOp)*(seq->numops-pos));
+                seq->numops++;
+            } else if (seq->numops > WORST_MINOPS) {
+                memmove(seq->ops+pos,seq->ops+pos+1,
+                        sizeof(worstOp)*(seq->numops-pos-1));
+                seq->numops--;
+            }
+            break;
+        }
+        }
+    }
+}
+
+/* Run the sequence against a new tree. Seeks are followed by a raxNext()
+ * call. If 'results' is not NULL, the results of every operation (and of
+ * the raxNext() following seeks) are stored there. Returns the time spent
+ * running the operations, in microseconds. */
+static long long worstRun(worstSeq *seq, unsigned char (*results)[2]) {
+    rax *t = raxNew();
+    raxIterator ri;
+    raxStart(&ri,t);
+    long long start = ustime();
+    for (int j = 0; j < seq->numops; j++) {
+        worstOp *o = seq->ops+j;
+        int r = 0, next = 0;
+        switch(o->op) {
+        case RAX_OP_INSERT: r = raxInsert(t,o->key,o->len,NULL,NULL); break;
+        case RAX_OP_REMOVE: r = raxRemove(t,o->key,o->len,NULL); break;
+        case RAX_OP_FIND: r = raxFind(t,o->key,o->len) != raxNotFound; break;
+        case RAX_OP_SEEK:
+            r = raxSeek(&ri,">=",o->key,o->len);
+            next = raxNext(&ri);
+            break;
+        }
+        if (results) {
+            results[j][0] = r;
+            results[j][1] = next;
+        }
+    }
+    long long elapsed = ustime()-start;
+    raxStop(&ri);
+    raxFree(t);
+    return elapsed;
+}
+
+static double worstCost(worstSeq *seq, int objective) {
+    if (objective == WORST_ALLOCS) {
+#ifdef RAX_COUNT_MALLOC
+        unsigned long long calls = rax_malloc_calls+rax_realloc_calls;
+        worstRun(seq,NULL);
+        calls = rax_malloc_calls+rax_realloc_calls-calls;
+        return (double)calls/seq->numops;
+#else
+        return 0;
+#endif
+    }
+    long long best = -1;
+    for (int s = 0; s < WORST_SAMPLES; s++) {
+        long long elapsed = 0;
+        for (int r = 0; r < WORST_REPEAT; r++) elapsed += worstRun(seq,NULL);
+        if (best == -1 || elapsed < best) best = elapsed;
+    }
+    return (double)best*1000/(WORST_REPEAT*seq->numops);
+}
+
+/* Add the sequence to the 'top' array, sorted by decreasing cost, if it is
+ * among the worst found so far. */
+static void worstTopAdd(worstSeq *top, int *numtop, worstSeq *seq) {
+    int pos = *numtop;
+    while (pos > 0 && top[pos-1].cost < seq->cost) pos--;
+    if (pos == WORST_TOP) return;
+    int tomove = (*numtop < WORST_TOP ? *numtop : WORST_TOP-1) - pos;
+    memmove(top+pos+1,top+pos,sizeof(worstSeq)*tomove);
+    top[pos] = *seq;
+    if (*numtop < WORST_TOP) (*numtop)++;
+}
+
+/* Save the sequence as a recording replaying it against a new tree. */
+static int worstSave(worstSeq *seq, const char *filename) {
+    static unsigned char results[WORST_MAXOPS][2];
+    raxRecordWriter w;
+    raxRecord rec;
+
+    worstRun(seq,results);
+    if (!raxRecordCreate(&w,filename,0)) return 0;
+    memset(&rec,0,sizeof(rec));
+    rec.op = RAX_OP_NEW;
+    rec.result = 1;
+    raxRecordWrite(&w,&rec);
+    for (int j = 0; j < seq->numops; j++) {
+        worstOp *o = seq->ops+j;
+        rec.op = o->op;
+        rec.result = results[j][0];
+        rec.seek_op = ">=";
+        rec.key = o->key;
+        rec.key_len = o->len;
+        raxRecordWrite(&w,&rec);
+        if (o->op == RAX_OP_SEEK) {
+            rec.op = RAX_OP_NEXT;
+            rec.result = results[j][1];
+            raxRecordWrite(&w,&rec);
+        }
+    }
+    memset(&rec,0,sizeof(rec));
+    rec.op = RAX_OP_FREE;
+    raxRecordWrite(&w,&rec);
+    return raxRecordFinish(&w);
+}
+
+static void worstReport(worstSeq *seq, int rank, int objective) {
+    int count[RAX_OP_SEEK+1] = {0};
+    double keylen = 0;
+    for (int j = 0; j < seq->numops; j++) {
+        count[seq->ops[j].op]++;
+        keylen += seq->ops[j].len;
+    }
+    printf("  #%d %.2f %s, %d ops (insert %d remove %d find %d seek %d), "
+           "avg key len %.1f, from %s\n", rank, seq->cost,
+           WorstUnits[objective], seq->numops, count[RAX_OP_INSERT],
+           count[RAX_OP_REMOVE], count[RAX_OP_FIND], count[RAX_OP_SEEK],
+           keylen/seq->numops, seq->origin);
+}
+
+int fuzzWorstTest(void) {
+    static worstSeq top[WORST_TOP], cand;
+    void (*seeds[])(worstSeq *) = {
+        worstSeedRandom, worstSeedWide, worstSeedSplit, worstSeedChain
+    };
+    int numseeds = sizeof(seeds)/sizeof(seeds[0]);
+    int objectives = 1;
+#ifdef RAX_COUNT_MALLOC
+    objectives = 2;
+#endif
+
+    for (int o = 0; o < objectives; o++) {
+        int numtop = 0;
+        double random_cost = 0;
+        printf("Searching the worst %s sequences: ", WorstObjectives[o]);
+        fflush(stdout);
+        for (int s = 0; s < numseeds; s++) {
+            seeds[s](&cand);
+            cand.cost = worstCost(&cand,o);
+            if (seeds[s] == worstSeedRandom) random_cost = cand.cost;
+            worstTopAdd(top,&numtop,&cand);
+        }
+        for (int i = 0; i < WORST_ITERATIONS; i++) {
+            cand = top[rc4rand() % numtop];
+            worstMutate(&cand);
+            cand.cost = worstCost(&cand,o);
+            worstTopAdd(top,&numtop,&cand);
+            if (i && !(i % (WORST_ITERATIONS/10))) {
+                printf(".");
+                fflush(stdout);
+            }
+        }
+        /* Measure the winners again: timings are noisy, and the search
+         * favors the sequences that were measured as slower by chance. */
+        for (int j = 0; j < numtop; j++) top[j].cost = worstCost(top+j,o);
+        for (int j = 1; j < numtop; j++) {
+            for (int k = j; k > 0 && top[k].cost > top[k-1].cost; k--) {
+                cand = top[k];
+                top[k] = top[k-1];
+                top[k-1] = cand;
+            }
+        }
+        printf("\nWorst %s sequences (random sequence: %.2f %s):\n",
+            WorstObjectives[o], random_cost, WorstUnits[o]);
+        for (int j = 0; j < numtop; j++) worstReport(top+j,j+1,o);
+
+        char filename[64];
+        snprintf(filename,sizeof(filename),"rax-worst-%s.rec",
+            WorstObjectives[o]);
+        if (!worstSave(top,filename)) {
+            printf("Can't save %s: %s\n", filename, strerror(errno));
+            return 1;
+        }
+        printf("Worst sequence saved to %s, replay it with rax-replay.\n",
+            filename);
+    }
+    return 0;
+}
+
+/* Compressed nodes can only hold RAX_NODE_MAX_SIZE characters, (2^29)-1,
+ * so it is important to test for keys bigger than this amount, in order to
+ * make sure that the code to handle this edge case works as expected.
  *
- * This test is disabled by default because it uses a lot of memory. */
+ * This test is disabled by default because it uses a lot of memory, unless
+ * compiled with RAX_SMALL_HEADER, where the limit is just 8191. */
 int testHugeKey(void) {
-    size_t max_keylen = ((1<<29)-1) + 100;
+    size_t max_keylen = (size_t)RAX_NODE_MAX_SIZE + 100;
     unsigned char *key = malloc(max_keylen);
     if (key == NULL) goto oom;
 
@@ -895,11 +2862,12 @@ int testHugeKey(void) {
     if (retval == 0 && errno == ENOMEM) goto oom;
     void *value1 = raxFind(rax,(unsigned char*)"aaabbb",6);
     void *value2 = raxFind(rax,key,max_keylen);
+    raxFree(rax);
+    free(key);
     if (value1 != (void*)5678L || value2 != (void*)1234L) {
         printf("Huge key test failed\n");
         return 1;
     }
-    raxFree(rax);
     return 0;
 
 oom:
@@ -912,8 +2880,10 @@ int main(int argc, char **argv) {
 
     /* Tests to run by default are set here. */
     int do_benchmark = 0;
+    int do_memory_benchmark = 0;
     int do_units = 1;
     int do_fuzz_cluster = 0;
+    int do_fuzz_worst = 0;
     int do_fuzz = 1;
     int do_regression = 1;
     int do_hugekey = 0;
@@ -928,8 +2898,12 @@ int main(int argc, char **argv) {
         for (int i = 1; i < argc; i++) {
             if (!strcmp(argv[i],"--bench")) {
                 do_benchmark = 1;
+            } else if (!strcmp(argv[i],"--bench-memory")) {
+                do_memory_benchmark = 1;
             } else if (!strcmp(argv[i],"--fuzz-cluster")) {
                 do_fuzz_cluster = 1;
+            } else if (!strcmp(argv[i],"--fuzz-worst")) {
+                do_fuzz_worst = 1;
             } else if (!strcmp(argv[i],"--fuzz")) {
                 do_fuzz = 1;
             } else if (!strcmp(argv[i],"--units")) {
@@ -941,7 +2915,9 @@ int main(int argc, char **argv) {
             } else {
                 fprintf(stderr, "Usage: %s <options>:\n"
                                 "          [--bench         (default off)]\n"
+                                "          [--bench-memory  (default off)]\n"
                                 "          [--fuzz-cluster] (default off)\n"
+                                "          [--fuzz-worst]   (default off)\n"
                                 "          [--fuzz]         (default on)\n"
                                 "          [--units]        (default on)\n"
                                 "          [--regression]   (default on)\n"
@@ -961,6 +2937,25 @@ int main(int argc, char **argv) {
         if (randomWalkTest()) errors++;
         if (iteratorUnitTests()) errors++;
         if (tryInsertUnitTests()) errors++;
+        if (staticTreeUnitTests()) errors++;
+        if (typedTreeUnitTests()) errors++;
+        if (statsUnitTests()) errors++;
+        if (analyzeUnitTests()) errors++;
+        if (traceUnitTests()) errors++;
+        if (recordUnitTests()) errors++;
+        if (heatUnitTests()) errors++;
+        if (packedUnitTests()) errors++;
+        if (arenaUnitTests()) errors++;
+        if (internUnitTests()) errors++;
+        if (seekRangeUnitTests()) errors++;
+        if (reserveUnitTests()) errors++;
+        if (valuesUnitTests()) errors++;
+        if (jobUnitTests()) errors++;
+        if (lookupUnitTests()) errors++;
+#ifdef RAX_SMALL_HEADER
+        /* Cheap here, since compressed nodes are limited to 8191 bytes. */
+        if (testHugeKey()) errors++;
+#endif
         if (errors == 0) printf("OK\n");
     }
 
@@ -987,6 +2982,10 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (do_fuzz_worst) {
+        if (fuzzWorstTest()) errors++;
+    }
+
     if (do_fuzz) {
         for (int i = 0; i < 10; i++) {
             double alpha = (double)rc4rand() / RAND_MAX;
@@ -1028,8 +3027,11 @@ int main(int argc, char **argv) {
 
     if (do_benchmark) {
         benchmark();
+        typedBenchmark();
     }
 
+    if (do_memory_benchmark) memoryBenchmark();
+
     if (errors) {
         printf("!!! WARNING !!!: %d errors found\n", errors);
     } else {
@@ -28,12 +28,18 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _POSIX_C_SOURCE 199309L /* For clock_gettime(). */
+
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#ifdef RAX_TRACE_USDT
+#include <sys/sdt.h>
+#endif
 #include "rax.h"
 
 #ifndef RAX_MALLOC_INCLUDE
@@ -42,6 +48,197 @@
 
 #include RAX_MALLOC_INCLUDE
 
+/* Out of memory handling.
+ *
+ * By default every allocation failure is reported to the caller, and the
+ * tree is always left in a consistent state, which requires some rollback
+ * code in the insertion path. Applications that just abort on out of memory
+ * (like Redis) can compile with RAX_NO_OOM_RECOVERY defined: in that case
+ * raxMalloc() and raxRealloc() abort the process on failure and raxOOM()
+ * is constant false, so that the compiler removes all the recovery code. */
+#ifdef RAX_NO_OOM_RECOVERY
+static void raxAbortOOM(void) {
+    fprintf(stderr,"Rax: out of memory\n");
+    fflush(stderr);
+    abort();
+}
+
+static inline void *raxCheckAlloc(void *ptr) {
+    if (ptr == NULL) raxAbortOOM();
+    return ptr;
+}
+
+#define raxMalloc(size) raxCheckAlloc(rax_malloc(size))
+#define raxRealloc(ptr,size) raxCheckAlloc(rax_realloc(ptr,size))
+#define raxOOM(cond) 0
+#else
+#define raxMalloc(size) rax_malloc(size)
+#define raxRealloc(ptr,size) rax_realloc(ptr,size)
+#define raxOOM(cond) (cond)
+#endif
+
+/* Operation counters, see raxGetStats(). When RAX_STATS is not defined
+ * the counters are not compiled at all. */
+#ifdef RAX_STATS
+#define raxStatsIncr(rax,field,n) do { \
+    if ((rax)->stats) (rax)->stats->field += (n); \
+} while(0)
+#else
+#define raxStatsIncr(rax,field,n)
+#endif
+
+/* Sampled access heat, see raxHeatEnable(). When RAX_HEAT is not defined
+ * the sampling is not compiled at all. */
+#ifdef RAX_HEAT
+#define RAX_HEAT_MAX_PREFIXES 65536 /* Side table size limit. */
+
+typedef struct raxHeat {
+    uint32_t every;         /* Sample one lookup every 'every'. */
+    uint32_t countdown;     /* Lookups left before the next sample. */
+    int levels;             /* Nodes tracked from the head. */
+    uint64_t samples;       /* Sampled lookups. */
+    rax *prefixes;          /* Node prefix -> sampled visits. */
+} raxHeat;
+
+static void raxHeatSample(rax *rax, unsigned char *s, size_t len);
+#define raxHeatTick(rax,s,len) do { \
+    if ((rax)->heat && --(rax)->heat->countdown == 0) \
+        raxHeatSample(rax,s,len); \
+} while(0)
+#else
+#define raxHeatTick(rax,s,len)
+#endif
+
+/* Packed encoding of small trees, see raxNewPacked(). Instead of a head
+ * node, rax->head points to a single buffer holding all the keys sorted in
+ * lexicographical order and front coded, each followed by its value:
+ *
+ * [shared][suffix len][suffix ...][value pointer]
+ *
+ * Where 'shared' is the number of bytes the key has in common with the
+ * previous one. Every RAX_PACKED_RESTART entries the key is stored whole
+ * (shared is zero): a lookup performs a binary search of such restart
+ * entries, then decodes at most RAX_PACKED_RESTART entries linearly.
+ *
+ * A packed tree has no nodes, so it is recognized by rax->numnodes being
+ * zero. Once it would grow over RAX_PACKED_MAX_KEYS keys or
+ * RAX_PACKED_MAX_BYTES bytes of entries, or a key longer than
+ * RAX_PACKED_MAX_KEYLEN is inserted, the tree is converted to nodes, and
+ * stays so even if later it shrinks. */
+#define RAX_PACKED_MAX_KEYS 32
+#define RAX_PACKED_MAX_BYTES 1024
+#define RAX_PACKED_MAX_KEYLEN 255   /* 'shared' and 'suffix len' are bytes. */
+#define RAX_PACKED_RESTART 8
+#define RAX_PACKED_RESTARTS (RAX_PACKED_MAX_KEYS/RAX_PACKED_RESTART)
+
+typedef struct raxPacked {
+    uint32_t version;   /* Incremented at every change of the keys, so that
+                           iterators can detect they need to seek again. */
+    uint16_t numkeys;
+    uint16_t bytes;     /* Length of entries[]. */
+    uint16_t restart[RAX_PACKED_RESTARTS]; /* Offsets of restart entries. */
+    unsigned char entries[];
+} raxPacked;
+
+#define raxIsPacked(r) ((r)->numnodes == 0)
+#define raxPackedOf(r) ((raxPacked*)(void*)(r)->head)
+
+static int raxPackedInsert(rax *rax, unsigned char *s, size_t len, void *data,
+                           void **old, int overwrite);
+static int raxPackedConvert(rax *rax);
+static int raxPackedRemove(rax *rax, unsigned char *s, size_t len,
+                           void **old);
+static void *raxPackedFind(rax *rax, unsigned char *s, size_t len);
+static void raxPackedFree(rax *rax, void (*free_callback)(void*));
+
+/* Tracing, see raxSetTraceCallback(). When RAX_TRACE is not defined the
+ * tracing code is not compiled at all, otherwise when no callback is
+ * registered the cost is a branch per traced site.
+ *
+ * Compiling with RAX_TRACE_USDT as well, every event also fires the USDT
+ * static probe rax:event(type,op,size,count,duration), so that it can be
+ * captured with tools like bpftrace without registering a callback. Since
+ * the probe can't tell the library if it is enabled, in this case the
+ * timestamps are always taken. */
+#ifdef RAX_TRACE
+static raxTraceCallback raxTraceCb = NULL;
+static void *raxTracePrivdata = NULL;
+
+static uint64_t raxTraceTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+#ifdef RAX_TRACE_USDT
+#define raxTraceActive() 1
+#else
+#define raxTraceActive() (raxTraceCb != NULL)
+#endif
+
+static void raxTraceEmitEvent(raxTraceEvent *e, uint64_t start) {
+    e->duration = start ? raxTraceTime()-start : 0;
+#ifdef RAX_TRACE_USDT
+    DTRACE_PROBE5(rax,event,e->type,e->op,e->size,e->count,e->duration);
+#endif
+    if (raxTraceCb) raxTraceCb(e,raxTracePrivdata);
+}
+
+static void raxTraceEmit(int type, int op, rax *rax, unsigned char *s,
+                         size_t len, void *data, size_t size, uint64_t count,
+                         uint64_t start)
+{
+    raxTraceEvent e;
+    e.type = type;
+    e.op = op;
+    e.rax = rax;
+    e.iter = NULL;
+    e.seek_op = NULL;
+    e.key = s;
+    e.key_len = len;
+    e.data = data;
+    e.size = size;
+    e.count = count;
+    raxTraceEmitEvent(&e,start);
+}
+
+/* Like raxTraceEmit() but for iterator operations. */
+static void raxTraceEmitIter(int type, int op, raxIterator *it,
+                             const char *seek_op, unsigned char *s,
+                             size_t len, uint64_t count, uint64_t start)
+{
+    raxTraceEvent e;
+    e.type = type;
+    e.op = op;
+    e.rax = it->rt;
+    e.iter = it;
+    e.seek_op = seek_op;
+    e.key = s;
+    e.key_len = len;
+    e.data = NULL;
+    e.size = 0;
+    e.count = count;
+    raxTraceEmitEvent(&e,start);
+}
+
+/* Declare the variable 'var' holding the start time of a traced event. */
+#define raxTraceStart(var) uint64_t var = raxTraceActive() ? raxTraceTime() : 0
+#define raxTrace(...) do { \
+    if (raxTraceActive()) raxTraceEmit(__VA_ARGS__); \
+} while(0)
+#define raxTraceIter(...) do { \
+    if (raxTraceActive()) raxTraceEmitIter(__VA_ARGS__); \
+} while(0)
+#else
+#define raxTraceStart(var)
+#define raxTrace(...)
+#define raxTraceIter(...)
+#endif
+
+/* Trace operation code of raxGenericInsert(). */
+#define raxInsertOp(overwrite) \
+    ((overwrite) ? RAX_OP_INSERT : RAX_OP_TRYINSERT)
+
 /* This is a special pointer that is guaranteed to never have the same value
  * of a radix tree node. It's used in order to report "not found" error without
  * requiring the function to have multiple return values. */
@@ -100,8 +297,8 @@ static inline void raxStackInit(raxStack *ts) {
 static inline int raxStackPush(raxStack *ts, void *ptr) {
     if (ts->items == ts->maxitems) {
         if (ts->stack == ts->static_items) {
-            ts->stack = rax_malloc(sizeof(void*)*ts->maxitems*2);
-            if (ts->stack == NULL) {
+            ts->stack = raxMalloc(sizeof(void*)*ts->maxitems*2);
+            if (raxOOM(ts->stack == NULL)) {
                 ts->stack = ts->static_items;
                 ts->oom = 1;
                 errno = ENOMEM;
@@ -109,8 +306,8 @@ static inline int raxStackPush(raxStack *ts, void *ptr) {
             }
             memcpy(ts->stack,ts->static_items,sizeof(void*)*ts->maxitems);
         } else {
-            void **newalloc = rax_realloc(ts->stack,sizeof(void*)*ts->maxitems*2);
-            if (newalloc == NULL) {
+            void **newalloc = raxRealloc(ts->stack,sizeof(void*)*ts->maxitems*2);
+            if (raxOOM(newalloc == NULL)) {
                 ts->oom = 1;
                 errno = ENOMEM;
                 return 0;
@@ -151,8 +348,12 @@ static inline void raxStackFree(raxStack *ts) {
 /* Return the padding needed in the characters section of a node having size
  * 'nodesize'. The padding is needed to store the child pointers to aligned
  * addresses. Note that we add 4 to the node size because the node has a four
- * bytes header. */
+ * bytes header. With RAX_SMALL_HEADER pointers are not aligned at all. */
+#ifdef RAX_SMALL_HEADER
+#define raxPadding(nodesize) ((void)(nodesize),0)
+#else
 #define raxPadding(nodesize) ((sizeof(void*)-((nodesize+4) % sizeof(void*))) & (sizeof(void*)-1))
+#endif
 
 /* Return the pointer to the last child pointer in a node. For the compressed
  * nodes this is the only child pointer. */
@@ -179,16 +380,305 @@ static inline void raxStackFree(raxStack *ts) {
     (((n)->iskey && !(n)->isnull)*sizeof(void*)) \
 )
 
+/* Node arena, see raxArenaEnable(). Nodes are allocated in pages of
+ * RAX_ARENA_PAGE bytes, taken from chunks of RAX_ARENA_CHUNK_PAGES pages
+ * allocated with rax_malloc(). Nodes larger than RAX_ARENA_MAX_ALLOC bytes
+ * are allocated with rax_malloc() directly.
+ *
+ * New nodes, and nodes moved by a reallocation, are allocated in "hot"
+ * pages: every hot page holds slots of a single size, and the free slots
+ * are linked in a list stored inside the slots themselves. Instead
+ * raxArenaCompact() moves all the nodes in "cold" pages, one after the
+ * other in depth first order, so that the nodes of a subtree share the
+ * same pages. The space of the nodes freed in cold pages is not reused
+ * until the next compaction, so that nothing is written there: after a
+ * fork() only the cold pages holding nodes modified in place are copied,
+ * while new nodes go to the hot pages. The page metadata is kept outside
+ * the pages for the same reason. */
+#define RAX_ARENA_PAGE 4096
+#define RAX_ARENA_CHUNK_PAGES 64
+/* Large enough for a node with 256 children and a value. */
+#define RAX_ARENA_MAX_ALLOC 2320
+/* Slot sizes are multiples of the alignment nodes need: the child pointers
+ * alignment, or just the 16 bit header with RAX_SMALL_HEADER, at the cost
+ * of more hot page lists. */
+#ifdef RAX_SMALL_HEADER
+#define RAX_ARENA_ALIGN 2
+#else
+#define RAX_ARENA_ALIGN 8
+#endif
+#define RAX_ARENA_CLASSES (RAX_ARENA_MAX_ALLOC/RAX_ARENA_ALIGN+1)
+#define raxArenaRound(size) \
+    (((size)+RAX_ARENA_ALIGN-1) & ~(size_t)(RAX_ARENA_ALIGN-1))
+
+#define RAX_ARENA_FREE 0
+#define RAX_ARENA_HOT 1
+#define RAX_ARENA_COLD 2
+
+typedef struct raxArenaChunk raxArenaChunk;
+
+typedef struct raxArenaPage {
+    unsigned char *base;
+    raxArenaChunk *chunk;
+    /* Hot pages with free slots of the same size are linked together. */
+    struct raxArenaPage *prev, *next;
+    uint16_t used;          /* Bytes allocated sequentially from 'base'. */
+    uint16_t nodes;         /* Nodes not yet freed. */
+    uint16_t freeslot;      /* Offset+1 of the first free slot, or 0. */
+    uint16_t size;          /* Slot size of hot pages. */
+    uint8_t state;          /* RAX_ARENA_FREE, RAX_ARENA_HOT or COLD. */
+} raxArenaPage;
+
+struct raxArenaChunk {
+    void *alloc;            /* As returned by rax_malloc(). */
+    unsigned char *base;    /* First page, aligned to RAX_ARENA_PAGE. */
+    int freepages;
+    raxArenaPage pages[RAX_ARENA_CHUNK_PAGES];
+};
+
+typedef struct raxArena {
+    raxArenaChunk **chunks; /* Sorted by address. */
+    size_t numchunks;
+    raxArenaPage **free;    /* Free pages, room for all the pages. */
+    size_t numfree;
+    raxArenaPage *hot[RAX_ARENA_CLASSES]; /* Hot pages with free slots, by
+                                             slot size in words. */
+    raxArenaPage *cold;     /* Page being filled by raxArenaCompact(). */
+    int compacting;         /* Don't reuse pages freed while compacting. */
+} raxArena;
+
+/* Return the page holding 'ptr', or NULL if it was not allocated by the
+ * arena. */
+static raxArenaPage *raxArenaPageOf(raxArena *a, void *ptr) {
+    uintptr_t p = (uintptr_t)ptr;
+    size_t lo = 0, hi = a->numchunks;
+    while (lo < hi) {
+        size_t mid = (lo+hi)/2;
+        raxArenaChunk *c = a->chunks[mid];
+        uintptr_t base = (uintptr_t)c->base;
+        if (p < base) {
+            hi = mid;
+        } else if (p >= base+RAX_ARENA_PAGE*RAX_ARENA_CHUNK_PAGES) {
+            lo = mid+1;
+        } else {
+            return c->pages+(p-base)/RAX_ARENA_PAGE;
+        }
+    }
+    return NULL;
+}
+
+/* Add a chunk to the arena, with all its pages free. Returns 0 on out of
+ * memory, otherwise 1. */
+static int raxArenaAddChunk(raxArena *a) {
+    raxArenaChunk *c = raxMalloc(sizeof(*c));
+    if (raxOOM(c == NULL)) return 0;
+    c->alloc = raxMalloc(RAX_ARENA_PAGE*(RAX_ARENA_CHUNK_PAGES+1));
+    raxArenaChunk **chunks = raxRealloc(a->chunks,
+                                        sizeof(c)*(a->numchunks+1));
+    if (chunks) a->chunks = chunks;
+    raxArenaPage **freelist = raxRealloc(a->free,
+        sizeof(raxArenaPage*)*(a->numchunks+1)*RAX_ARENA_CHUNK_PAGES);
+    if (freelist) a->free = freelist;
+    if (raxOOM(c->alloc == NULL || chunks == NULL || freelist == NULL)) {
+        rax_free(c->alloc);
+        rax_free(c);
+        return 0;
+    }
+    uintptr_t base = ((uintptr_t)c->alloc+RAX_ARENA_PAGE-1) &
+                     ~(uintptr_t)(RAX_ARENA_PAGE-1);
+    c->base = (unsigned char*)c->alloc + (base-(uintptr_t)c->alloc);
+    c->freepages = RAX_ARENA_CHUNK_PAGES;
+
+    size_t pos = 0;
+    while (pos < a->numchunks && a->chunks[pos]->base < c->base) pos++;
+    memmove(a->chunks+pos+1,a->chunks+pos,sizeof(c)*(a->numchunks-pos));
+    a->chunks[pos] = c;
+    a->numchunks++;
+
+    /* Pushed in reverse order, so that pages are used in address order. */
+    for (int j = RAX_ARENA_CHUNK_PAGES-1; j >= 0; j--) {
+        raxArenaPage *p = c->pages+j;
+        memset(p,0,sizeof(*p));
+        p->base = c->base+RAX_ARENA_PAGE*j;
+        p->chunk = c;
+        p->state = RAX_ARENA_FREE;
+        a->free[a->numfree++] = p;
+    }
+    return 1;
+}
+
+/* Take a free page, setting it to the specified state. Returns NULL on out
+ * of memory. */
+static raxArenaPage *raxArenaNewPage(raxArena *a, int state) {
+    if (a->numfree == 0 && !raxArenaAddChunk(a)) return NULL;
+    raxArenaPage *p = a->free[--a->numfree];
+    p->chunk->freepages--;
+    p->state = state;
+    return p;
+}
+
+/* Mark the page as free. The page is not reused before the end of the
+ * compaction, if one is in progress. */
+static void raxArenaPageEmpty(raxArena *a, raxArenaPage *p) {
+    p->used = 0;
+    p->freeslot = 0;
+    p->state = RAX_ARENA_FREE;
+    p->chunk->freepages++;
+    if (!a->compacting) a->free[a->numfree++] = p;
+}
+
+/* Return true if the hot page 'p' has a free slot. */
+static int raxArenaHasSlot(raxArenaPage *p) {
+    return p->freeslot || p->used+p->size <= RAX_ARENA_PAGE;
+}
+
+/* Add or remove the hot page 'p' to the list of its slot size. */
+static void raxArenaLink(raxArena *a, raxArenaPage *p) {
+    raxArenaPage **head = a->hot+p->size/RAX_ARENA_ALIGN;
+    p->prev = NULL;
+    p->next = *head;
+    if (*head) (*head)->prev = p;
+    *head = p;
+}
+
+static void raxArenaUnlink(raxArena *a, raxArenaPage *p) {
+    if (p->prev) p->prev->next = p->next;
+    else a->hot[p->size/RAX_ARENA_ALIGN] = p->next;
+    if (p->next) p->next->prev = p->prev;
+    p->prev = p->next = NULL;
+}
+
+/* Allocate 'size' bytes in a hot page. Returns NULL on out of memory. */
+static void *raxArenaAlloc(raxArena *a, size_t size) {
+    size = raxArenaRound(size);
+    if (size > RAX_ARENA_MAX_ALLOC) return raxMalloc(size);
+
+    raxArenaPage *p = a->hot[size/RAX_ARENA_ALIGN];
+    if (p == NULL) {
+        p = raxArenaNewPage(a,RAX_ARENA_HOT);
+        if (p == NULL) return NULL;
+        p->size = size;
+        raxArenaLink(a,p);
+    }
+    unsigned char *ptr;
+    if (p->freeslot) {
+        ptr = p->base+p->freeslot-1;
+        memcpy(&p->freeslot,ptr,sizeof(p->freeslot));
+    } else {
+        ptr = p->base+p->used;
+        p->used += size;
+    }
+    p->nodes++;
+    if (!raxArenaHasSlot(p)) raxArenaUnlink(a,p);
+    return ptr;
+}
+
+/* Allocate 'size' bytes in the cold page being filled by the compaction.
+ * Returns NULL on out of memory. */
+static void *raxArenaAllocCold(raxArena *a, size_t size) {
+    size = raxArenaRound(size);
+    raxArenaPage *p = a->cold;
+    if (p == NULL || p->used+size > RAX_ARENA_PAGE) {
+        p = raxArenaNewPage(a,RAX_ARENA_COLD);
+        if (p == NULL) return NULL;
+        if (a->cold && a->cold->nodes == 0) raxArenaPageEmpty(a,a->cold);
+        a->cold = p;
+    }
+    void *ptr = p->base+p->used;
+    p->used += size;
+    p->nodes++;
+    return ptr;
+}
+
+/* Free a node allocated by the arena, or by rax_malloc() if too large. */
+static void raxArenaFree(raxArena *a, void *ptr) {
+    raxArenaPage *p = raxArenaPageOf(a,ptr);
+    if (p == NULL) {
+        rax_free(ptr);
+        return;
+    }
+    p->nodes--;
+    if (p->state == RAX_ARENA_HOT) {
+        int full = !raxArenaHasSlot(p);
+        if (p->nodes == 0) {
+            if (!full) raxArenaUnlink(a,p);
+            raxArenaPageEmpty(a,p);
+            return;
+        }
+        memcpy(ptr,&p->freeslot,sizeof(p->freeslot));
+        p->freeslot = (unsigned char*)ptr-p->base+1;
+        if (full) raxArenaLink(a,p);
+    } else if (p->nodes == 0 && p != a->cold) {
+        raxArenaPageEmpty(a,p);
+    }
+}
+
+/* Release the chunks having all the pages free, and rebuild the list of
+ * the free pages, that were not added to it while compacting. */
+static void raxArenaTrim(raxArena *a) {
+    size_t j, k;
+    a->numfree = 0;
+    for (j = 0, k = 0; j < a->numchunks; j++) {
+        raxArenaChunk *c = a->chunks[j];
+        if (c->freepages == RAX_ARENA_CHUNK_PAGES) {
+            rax_free(c->alloc);
+            rax_free(c);
+            continue;
+        }
+        a->chunks[k++] = c;
+    }
+    a->numchunks = k;
+    for (j = a->numchunks; j > 0; j--) {
+        raxArenaChunk *c = a->chunks[j-1];
+        for (int i = RAX_ARENA_CHUNK_PAGES-1; i >= 0; i--)
+            if (c->pages[i].state == RAX_ARENA_FREE)
+                a->free[a->numfree++] = c->pages+i;
+    }
+}
+
+/* Allocate a node of 'size' bytes for the tree. */
+static raxNode *raxNodeAlloc(rax *rax, size_t size) {
+    if (rax->arena) return raxArenaAlloc(rax->arena,size);
+    return raxMalloc(size);
+}
+
+/* Grow the node 'n' to 'size' bytes. With an arena, the node is moved to a
+ * hot page. On out of memory NULL is returned, and 'n' is still valid. */
+static raxNode *raxNodeRealloc(rax *rax, raxNode *n, size_t size) {
+    if (rax->arena == NULL) return raxRealloc(n,size);
+    size_t curlen = raxNodeCurrentLength(n);
+    raxNode *newn = raxArenaAlloc(rax->arena,size);
+    if (raxOOM(newn == NULL)) return NULL;
+    memcpy(newn,n,curlen < size ? curlen : size);
+    raxArenaFree(rax->arena,n);
+    return newn;
+}
+
+/* Shrink the node 'n' to its current length, returning its new address.
+ * This can't fail: on out of memory, and with an arena, the node is just
+ * left as it is. */
+static raxNode *raxNodeShrink(rax *rax, raxNode *n) {
+    if (rax->arena) return n;
+    raxNode *newn = rax_realloc(n,raxNodeCurrentLength(n));
+    return newn ? newn : n;
+}
+
+/* Free a node of the tree. */
+static void raxNodeFree(rax *rax, raxNode *n) {
+    if (rax->arena) raxArenaFree(rax->arena,n);
+    else rax_free(n);
+}
+
 /* Allocate a new non compressed node with the specified number of children.
  * If datafiled is true, the allocation is made large enough to hold the
  * associated data pointer.
  * Returns the new node pointer. On out of memory NULL is returned. */
-raxNode *raxNewNode(size_t children, int datafield) {
+raxNode *raxNewNode(rax *rax, size_t children, int datafield) {
     size_t nodesize = sizeof(raxNode)+children+raxPadding(children)+
                       sizeof(raxNode*)*children;
     if (datafield) nodesize += sizeof(void*);
-    raxNode *node = rax_malloc(nodesize);
-    if (node == NULL) return NULL;
+    raxNode *node = raxNodeAlloc(rax,nodesize);
+    if (raxOOM(node == NULL)) return NULL;
     node->iskey = 0;
     node->isnull = 0;
     node->iscompr = 0;
@@ -196,28 +686,69 @@ raxNode *raxNewNode(size_t children, int datafield) {
     return node;
 }
 
-/* Allocate a new rax and return its pointer. On out of memory the function
- * returns NULL. */
-rax *raxNew(void) {
-    rax *rax = rax_malloc(sizeof(*rax));
-    if (rax == NULL) return NULL;
+/* Allocate a new rax, with a head node or, if 'packed' is true, an empty
+ * packed buffer. See raxNew() and raxNewPacked(). */
+static rax *raxCreate(int packed) {
+    rax *rax = raxMalloc(sizeof(*rax));
+    if (raxOOM(rax == NULL)) return NULL;
     rax->numele = 0;
-    rax->numnodes = 1;
-    rax->head = raxNewNode(0,0);
-    if (rax->head == NULL) {
+    rax->numnodes = packed ? 0 : 1;
+    rax->arena = NULL;
+    rax->values = NULL;
+#ifdef RAX_HEAT
+    rax->heat = NULL;
+#endif
+#ifdef RAX_STATS
+    rax->stats = raxMalloc(sizeof(raxStats));
+    if (raxOOM(rax->stats == NULL)) {
+        rax_free(rax);
+        return NULL;
+    }
+    memset(rax->stats,0,sizeof(raxStats));
+#endif
+    if (packed) {
+        raxPacked *p = raxMalloc(sizeof(raxPacked));
+        if (p) memset(p,0,sizeof(*p));
+        rax->head = (raxNode*)(void*)p;
+    } else {
+        rax->head = raxNewNode(rax,0,0);
+    }
+    if (raxOOM(rax->head == NULL)) {
+#ifdef RAX_STATS
+        rax_free(rax->stats);
+#endif
         rax_free(rax);
         return NULL;
     } else {
+        raxTrace(RAX_TRACE_OP_END,RAX_OP_NEW,rax,NULL,0,NULL,0,1,0);
         return rax;
     }
 }
 
+/* Allocate a new rax and return its pointer. On out of memory the function
+ * returns NULL. */
+rax *raxNew(void) {
+    return raxCreate(0);
+}
+
+/* Like raxNew(), but the tree starts with the packed encoding: a single
+ * sorted buffer of front coded keys and values, much smaller than the
+ * nodes for trees of a few short keys, and searched by binary search. The
+ * tree is converted to the normal representation as soon as it grows over
+ * RAX_PACKED_MAX_KEYS keys or RAX_PACKED_MAX_BYTES bytes, or a key longer
+ * than RAX_PACKED_MAX_KEYLEN is inserted. All the API works the same with
+ * both forms, but code accessing the nodes directly via rax->head should
+ * check that rax->numnodes is not zero. */
+rax *raxNewPacked(void) {
+    return raxCreate(1);
+}
+
 /* realloc the node to make room for auxiliary data in order
  * to store an item in that node. On out of memory NULL is returned. */
-raxNode *raxReallocForData(raxNode *n, void *data) {
+raxNode *raxReallocForData(rax *rax, raxNode *n, void *data) {
     if (data == NULL) return n; /* No reallocation needed, setting isnull=1 */
     size_t curlen = raxNodeCurrentLength(n);
-    return rax_realloc(n,curlen+sizeof(void*));
+    return raxNodeRealloc(rax,n,curlen+sizeof(void*));
 }
 
 /* Set the node auxiliary data to the specified pointer. */
@@ -242,6 +773,67 @@ void *raxGetData(raxNode *n) {
     return data;
 }
 
+/* Values array, see raxValuesEnable(). Key nodes store the index of their
+ * value in the array plus one, in place of the value pointer, so that the
+ * node layout is the same and the stored pointer is never NULL. Free slots
+ * are marked with RAX_VALUE_FREE, and their indexes are kept in a stack
+ * as large as the array, so that freeing a slot can't fail. */
+typedef struct raxValues {
+    void **vals;
+    uint32_t *free;         /* Indexes of the free slots. */
+    uint32_t numfree;
+    uint32_t len;           /* Slots used, free ones included. */
+    uint32_t size;          /* Slots allocated. */
+} raxValues;
+
+static char raxValueFreeMark;
+#define RAX_VALUE_FREE ((void*)&raxValueFreeMark)
+
+/* Make sure a slot is available for raxValuesAdd(). Returns 0 on out of
+ * memory or if all the indexes are used, otherwise 1. */
+static int raxValuesReserve(raxValues *v) {
+    if (v->numfree || v->len < v->size) return 1;
+    if (v->size == UINT32_MAX-1) return 0;
+    size_t size = v->size ? (size_t)v->size*2 : 16;
+    if (size > UINT32_MAX-1) size = UINT32_MAX-1;
+    void **vals = raxRealloc(v->vals,sizeof(void*)*size);
+    if (vals) v->vals = vals;
+    uint32_t *freelist = raxRealloc(v->free,sizeof(uint32_t)*size);
+    if (freelist) v->free = freelist;
+    if (raxOOM(vals == NULL || freelist == NULL)) return 0;
+    v->size = size;
+    return 1;
+}
+
+/* Return what the key node will store for the value that the next
+ * raxValuesAdd() call will add, after raxValuesReserve() succeeded. */
+static inline void *raxValuesNextRef(raxValues *v) {
+    uint32_t idx = v->numfree ? v->free[v->numfree-1] : v->len;
+    return (void*)((uintptr_t)idx+1);
+}
+
+/* Store 'data' in the slot referenced by raxValuesNextRef(). */
+static void raxValuesAdd(raxValues *v, void *data) {
+    uint32_t idx = v->numfree ? v->free[--v->numfree] : v->len++;
+    v->vals[idx] = data;
+}
+
+/* Free the slot referenced by 'ref', returning the value it stored. */
+static void *raxValuesDel(raxValues *v, void *ref) {
+    uint32_t idx = (uintptr_t)ref-1;
+    void *data = v->vals[idx];
+    v->vals[idx] = RAX_VALUE_FREE;
+    v->free[v->numfree++] = idx;
+    return data;
+}
+
+/* Return the value of the key node 'n' of the tree. */
+static inline void *raxNodeValue(rax *rax, raxNode *n) {
+    void *data = raxGetData(n);
+    if (rax->values && data) data = rax->values->vals[(uintptr_t)data-1];
+    return data;
+}
+
 /* Add a new child to the node 'n' representing the character 'c' and return
  * its new pointer, as well as the child pointer by reference. Additionally
  * '***parentlink' is populated with the raxNode pointer-to-pointer of where
@@ -251,7 +843,7 @@ void *raxGetData(raxNode *n) {
  * On success the new parent node pointer is returned (it may change because
  * of the realloc, so the caller should discard 'n' and use the new value).
  * On out of memory NULL is returned, and the old node is still valid. */
-raxNode *raxAddChild(raxNode *n, unsigned char c, raxNode **childptr, raxNode ***parentlink) {
+raxNode *raxAddChild(rax *rax, raxNode *n, unsigned char c, raxNode **childptr, raxNode ***parentlink) {
     assert(n->iscompr == 0);
 
     size_t curlen = raxNodeCurrentLength(n);
@@ -261,13 +853,13 @@ raxNode *raxAddChild(raxNode *n, unsigned char c, raxNode **childptr, raxNode **
                   success at the end. */
 
     /* Alloc the new child we will link to 'n'. */
-    raxNode *child = raxNewNode(0,0);
-    if (child == NULL) return NULL;
+    raxNode *child = raxNewNode(rax,0,0);
+    if (raxOOM(child == NULL)) return NULL;
 
     /* Make space in the original node. */
-    raxNode *newn = rax_realloc(n,newlen);
-    if (newn == NULL) {
-        rax_free(child);
+    raxNode *newn = raxNodeRealloc(rax,n,newlen);
+    if (raxOOM(newn == NULL)) {
+        raxNodeFree(rax,child);
         return NULL;
     }
     n = newn;
@@ -392,7 +984,7 @@ raxNode *raxAddChild(raxNode *n, unsigned char c, raxNode **childptr, raxNode **
  * The function also returns a child node, since the last node of the
  * compressed chain cannot be part of the chain: it has zero children while
  * we can only compress inner nodes with exactly one child each. */
-raxNode *raxCompressNode(raxNode *n, unsigned char *s, size_t len, raxNode **child) {
+raxNode *raxCompressNode(rax *rax, raxNode *n, unsigned char *s, size_t len, raxNode **child) {
     assert(n->size == 0 && n->iscompr == 0);
     void *data = NULL; /* Initialized only to avoid warnings. */
     size_t newsize;
@@ -400,8 +992,8 @@ raxNode *raxCompressNode(raxNode *n, unsigned char *s, size_t len, raxNode **chi
     debugf("Compress node: %.*s\n", (int)len,s);
 
     /* Allocate the child to link to this node. */
-    *child = raxNewNode(0,0);
-    if (*child == NULL) return NULL;
+    *child = raxNewNode(rax,0,0);
+    if (raxOOM(*child == NULL)) return NULL;
 
     /* Make space in the parent node. */
     newsize = sizeof(raxNode)+len+raxPadding(len)+sizeof(raxNode*);
@@ -409,9 +1001,9 @@ raxNode *raxCompressNode(raxNode *n, unsigned char *s, size_t len, raxNode **chi
         data = raxGetData(n); /* To restore it later. */
         if (!n->isnull) newsize += sizeof(void*);
     }
-    raxNode *newn = rax_realloc(n,newsize);
-    if (newn == NULL) {
-        rax_free(*child);
+    raxNode *newn = raxNodeRealloc(rax,n,newsize);
+    if (raxOOM(newn == NULL)) {
+        raxNodeFree(rax,*child);
         return NULL;
     }
     n = newn;
@@ -425,6 +1017,29 @@ raxNode *raxCompressNode(raxNode *n, unsigned char *s, size_t len, raxNode **chi
     return n;
 }
 
+/* Trim the compressed node 'n' in place, so that it only represents its
+ * first 'len' characters, followed by the single child 'child'. If 'len'
+ * is 1 the node is turned into a normal node with one child, since the
+ * layout is the same. The key flag and the associated value, if any, are
+ * preserved.
+ *
+ * This is used when splitting compressed nodes, in order to reuse the
+ * original allocation instead of allocating a new node. Since the node
+ * only gets smaller, the function can't fail, but the caller must save the
+ * characters after 'len' and the old child pointer before calling it, since
+ * they get overwritten. The allocation is not shrunk, this is up to the
+ * caller. */
+raxNode *raxTrimNode(raxNode *n, size_t len, raxNode *child) {
+    assert(n->iscompr && len && len <= n->size);
+    void *data = n->iskey ? raxGetData(n) : NULL;
+    n->size = len;
+    n->iscompr = len > 1;
+    raxNode **cp = raxNodeFirstChildPtr(n);
+    memcpy(cp,&child,sizeof(child));
+    if (n->iskey) raxSetData(n,data);
+    return n;
+}
+
 /* Low level function that walks the tree looking for the string
  * 's' of 'len' bytes. The function returns the number of characters
  * of the key that was possible to process: if the returned integer
@@ -460,14 +1075,18 @@ static inline size_t raxLowWalk(rax *rax, unsigned char *s, size_t len, raxNode
 
     size_t i = 0; /* Position in the string. */
     size_t j = 0; /* Position in the node children (or bytes if compressed).*/
+    raxStatsIncr(rax,walks,1);
     while(h->size && i < len) {
         debugnode("Lookup current node",h);
         unsigned char *v = h->data;
+        raxStatsIncr(rax,nodes_visited,1);
 
         if (h->iscompr) {
             for (j = 0; j < h->size && i < len; j++, i++) {
                 if (v[j] != s[i]) break;
             }
+            /* Count the mismatching byte as well, if any. */
+            raxStatsIncr(rax,compr_bytes,j + (j != h->size && i < len));
             if (j != h->size) break;
         } else {
             /* Even when h->size is large, linear scan provides good
@@ -476,6 +1095,7 @@ static inline size_t raxLowWalk(rax *rax, unsigned char *s, size_t len, raxNode
             for (j = 0; j < h->size; j++) {
                 if (v[j] == s[i]) break;
             }
+            raxStatsIncr(rax,edge_bytes,j != h->size ? j+1 : j);
             if (j == h->size) break;
             i++;
         }
@@ -512,6 +1132,26 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
                   node for insertion. */
     raxNode *h, **parentlink;
 
+    if (raxIsPacked(rax)) {
+        int retval = raxPackedInsert(rax,s,len,data,old,overwrite);
+        if (retval != -1) return retval;
+        /* Too big for the packed encoding: convert and insert normally. */
+        if (!raxPackedConvert(rax)) {
+            errno = ENOMEM;
+            return 0;
+        }
+    }
+
+    /* With a values array the nodes store a reference to the value. */
+    void *value = data;
+    if (rax->values) {
+        if (!raxValuesReserve(rax->values)) {
+            errno = ENOMEM;
+            return 0;
+        }
+        data = raxValuesNextRef(rax->values);
+    }
+
     debugf("### Insert %.*s with value %p\n", (int)len, s, data);
     i = raxLowWalk(rax,s,len,&h,&parentlink,&j,NULL);
 
@@ -524,18 +1164,24 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         debugf("### Insert: node representing key exists\n");
         /* Make space for the value pointer if needed. */
         if (!h->iskey || (h->isnull && overwrite)) {
-            h = raxReallocForData(h,data);
+            h = raxReallocForData(rax,h,data);
             if (h) memcpy(parentlink,&h,sizeof(h));
         }
-        if (h == NULL) {
+        if (raxOOM(h == NULL)) {
             errno = ENOMEM;
             return 0;
         }
 
-        /* Update the existing key if there is already one. */
+        /* Update the existing key if there is already one. With a values
+         * array only the array is modified. */
         if (h->iskey) {
-            if (old) *old = raxGetData(h);
-            if (overwrite) raxSetData(h,data);
+            if (old) *old = raxNodeValue(rax,h);
+            if (overwrite) {
+                if (rax->values)
+                    rax->values->vals[(uintptr_t)raxGetData(h)-1] = value;
+                else
+                    raxSetData(h,data);
+            }
             errno = 0;
             return 0; /* Element already exists. */
         }
@@ -543,6 +1189,7 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         /* Otherwise set the node as a key. Note that raxSetData()
          * will set h->iskey. */
         raxSetData(h,data);
+        if (rax->values) raxValuesAdd(rax->values,value);
         rax->numele++;
         return 1; /* Element inserted. */
     }
@@ -620,15 +1267,16 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
      *    at step "6".
      *
      * 3a. IF $SPLITPOS == 0:
-     *     Replace the old node with the split node, by copying the auxiliary
-     *     data if any. Fix parent's reference. Free old node eventually
-     *     (we still need its data for the next steps of the algorithm).
+     *     The split node is the old node trimmed to just its first
+     *     character: trim it in place, so that the auxiliary data if any
+     *     is already there, and the parent's reference is still valid.
      *
      * 3b. IF $SPLITPOS != 0:
-     *     Trim the compressed node (reallocating it as well) in order to
-     *     contain $splitpos characters. Change chilid pointer in order to link
-     *     to the split node. If new compressed node len is just 1, set
-     *     iscompr to 0 (layout is the same). Fix parent's reference.
+     *     Trim the compressed node in place (shrinking its allocation) in
+     *     order to contain $splitpos characters. Change chilid pointer in
+     *     order to link to the split node. If new compressed node len is
+     *     just 1, set iscompr to 0 (layout is the same). Fix parent's
+     *     reference.
      *
      * 4a. IF the postfix len (the length of the remaining string of the
      *     original compressed node after the split character) is non zero,
@@ -662,17 +1310,23 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
      *    Set the node as a key with the associated value of the new
      *    inserted key.
      *
-     * 3. Trim the current node to contain the first $SPLITPOS characters.
-     *    As usually if the new node length is just 1, set iscompr to 0.
-     *    Take the iskey / associated value as it was in the orignal node.
-     *    Fix the parent's reference.
+     * 3. Trim the current node in place to contain the first $SPLITPOS
+     *    characters. As usually if the new node length is just 1, set
+     *    iscompr to 0. The iskey / associated value are the ones of the
+     *    orignal node. Fix the parent's reference.
      *
      * 4. Set the postfix node as the only child pointer of the trimmed
      *    node created at step 1.
+     *
+     * Note that in both the algorithms the original compressed node is
+     * never freed: the trimmed (or split) node always fits into its
+     * allocation, so it is rewritten in place. This saves one allocation
+     * for every split, see raxTrimNode().
      */
 
     /* ------------------------- ALGORITHM 1 --------------------------- */
     if (h->iscompr && i != len) {
+        raxTraceStart(splitstart);
         debugf("ALGO 1: Stopped at compressed node %.*s (%p)\n",
             h->size, h->data, (void*)h);
         debugf("Still to insert: %.*s\n", (int)(len-i), s+i);
@@ -692,68 +1346,35 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         /* Set the length of the additional nodes we will need. */
         size_t trimmedlen = j;
         size_t postfixlen = h->size - j - 1;
-        int split_node_is_key = !trimmedlen && h->iskey && !h->isnull;
         size_t nodesize;
 
-        /* 2: Create the split node. Also allocate the other nodes we'll need
+        /* 2: Create the split node, unless the original node is going to be
+         *    reused as split node (step 3a). Also allocate the postfix node
          *    ASAP, so that it will be simpler to handle OOM. */
-        raxNode *splitnode = raxNewNode(1, split_node_is_key);
-        raxNode *trimmed = NULL;
+        raxNode *splitnode = NULL;
         raxNode *postfix = NULL;
 
-        if (trimmedlen) {
-            nodesize = sizeof(raxNode)+trimmedlen+raxPadding(trimmedlen)+
-                       sizeof(raxNode*);
-            if (h->iskey && !h->isnull) nodesize += sizeof(void*);
-            trimmed = rax_malloc(nodesize);
-        }
+        if (trimmedlen) splitnode = raxNewNode(rax,1,0);
 
         if (postfixlen) {
             nodesize = sizeof(raxNode)+postfixlen+raxPadding(postfixlen)+
                        sizeof(raxNode*);
-            postfix = rax_malloc(nodesize);
+            postfix = raxNodeAlloc(rax,nodesize);
         }
 
         /* OOM? Abort now that the tree is untouched. */
-        if (splitnode == NULL ||
-            (trimmedlen && trimmed == NULL) ||
-            (postfixlen && postfix == NULL))
+        if (raxOOM((trimmedlen && splitnode == NULL) ||
+                   (postfixlen && postfix == NULL)))
         {
-            rax_free(splitnode);
-            rax_free(trimmed);
-            rax_free(postfix);
+            raxNodeFree(rax,splitnode);
+            raxNodeFree(rax,postfix);
             errno = ENOMEM;
             return 0;
         }
-        splitnode->data[0] = h->data[j];
-
-        if (j == 0) {
-            /* 3a: Replace the old node with the split node. */
-            if (h->iskey) {
-                void *ndata = raxGetData(h);
-                raxSetData(splitnode,ndata);
-            }
-            memcpy(parentlink,&splitnode,sizeof(splitnode));
-        } else {
-            /* 3b: Trim the compressed node. */
-            trimmed->size = j;
-            memcpy(trimmed->data,h->data,j);
-            trimmed->iscompr = j > 1 ? 1 : 0;
-            trimmed->iskey = h->iskey;
-            trimmed->isnull = h->isnull;
-            if (h->iskey && !h->isnull) {
-                void *ndata = raxGetData(h);
-                raxSetData(trimmed,ndata);
-            }
-            raxNode **cp = raxNodeLastChildPtr(trimmed);
-            memcpy(cp,&splitnode,sizeof(splitnode));
-            memcpy(parentlink,&trimmed,sizeof(trimmed));
-            parentlink = cp; /* Set parentlink to splitnode parent. */
-            rax->numnodes++;
-        }
 
         /* 4: Create the postfix node: what remains of the original
-         * compressed node after the split. */
+         * compressed node after the split. This is done before trimming
+         * the original node, since trimming overwrites these characters. */
         if (postfixlen) {
             /* 4a: create a postfix node. */
             postfix->iskey = 0;
@@ -769,34 +1390,46 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
             postfix = next;
         }
 
-        /* 5: Set splitnode first child as the postfix node. */
-        raxNode **splitchild = raxNodeLastChildPtr(splitnode);
-        memcpy(splitchild,&postfix,sizeof(postfix));
+        if (j == 0) {
+            /* 3a: The original node becomes the split node. Since it is
+             * going to get a new child at step 6, don't bother to shrink
+             * it: raxAddChild() will reallocate it anyway. */
+            splitnode = raxTrimNode(h,1,postfix);
+        } else {
+            /* 3b: Trim the compressed node, and link the split node. */
+            splitnode->data[0] = h->data[j];
+            raxNode **splitchild = raxNodeLastChildPtr(splitnode);
+            memcpy(splitchild,&postfix,sizeof(postfix));
+
+            h = raxNodeShrink(rax,raxTrimNode(h,j,splitnode));
+            memcpy(parentlink,&h,sizeof(h));
+            parentlink = raxNodeLastChildPtr(h); /* Splitnode parent. */
+            rax->numnodes++;
+        }
+
+        raxStatsIncr(rax,splits_algo1,1);
+        raxTrace(RAX_TRACE_SPLIT,raxInsertOp(overwrite),rax,s,len,data,
+                 trimmedlen+1+postfixlen,1,splitstart);
 
         /* 6. Continue insertion: this will cause the splitnode to
          * get a new child (the non common character at the currently
          * inserted key). */
-        rax_free(h);
         h = splitnode;
     } else if (h->iscompr && i == len) {
     /* ------------------------- ALGORITHM 2 --------------------------- */
+        raxTraceStart(splitstart);
         debugf("ALGO 2: Stopped at compressed node %.*s (%p) j = %d\n",
             h->size, h->data, (void*)h, j);
 
-        /* Allocate postfix & trimmed nodes ASAP to fail for OOM gracefully. */
+        /* Allocate the postfix node ASAP to fail for OOM gracefully. The
+         * trimmed node is the original node itself. */
         size_t postfixlen = h->size - j;
         size_t nodesize = sizeof(raxNode)+postfixlen+raxPadding(postfixlen)+
                           sizeof(raxNode*);
         if (data != NULL) nodesize += sizeof(void*);
-        raxNode *postfix = rax_malloc(nodesize);
-
-        nodesize = sizeof(raxNode)+j+raxPadding(j)+sizeof(raxNode*);
-        if (h->iskey && !h->isnull) nodesize += sizeof(void*);
-        raxNode *trimmed = rax_malloc(nodesize);
+        raxNode *postfix = raxNodeAlloc(rax,nodesize);
 
-        if (postfix == NULL || trimmed == NULL) {
-            rax_free(postfix);
-            rax_free(trimmed);
+        if (raxOOM(postfix == NULL)) {
             errno = ENOMEM;
             return 0;
         }
@@ -817,27 +1450,17 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         memcpy(cp,&next,sizeof(next));
         rax->numnodes++;
 
-        /* 3: Trim the compressed node. */
-        trimmed->size = j;
-        trimmed->iscompr = j > 1;
-        trimmed->iskey = 0;
-        trimmed->isnull = 0;
-        memcpy(trimmed->data,h->data,j);
-        memcpy(parentlink,&trimmed,sizeof(trimmed));
-        if (h->iskey) {
-            void *aux = raxGetData(h);
-            raxSetData(trimmed,aux);
-        }
-
-        /* Fix the trimmed node child pointer to point to
-         * the postfix node. */
-        cp = raxNodeLastChildPtr(trimmed);
-        memcpy(cp,&postfix,sizeof(postfix));
+        /* 3: Trim the compressed node, and 4: link the postfix node. */
+        h = raxNodeShrink(rax,raxTrimNode(h,j,postfix));
+        memcpy(parentlink,&h,sizeof(h));
 
         /* Finish! We don't need to continue with the insertion
          * algorithm for ALGO 2. The key is already inserted. */
+        raxStatsIncr(rax,splits_algo2,1);
+        raxTrace(RAX_TRACE_SPLIT,raxInsertOp(overwrite),rax,s,len,data,
+                 j+postfixlen,2,splitstart);
+        if (rax->values) raxValuesAdd(rax->values,value);
         rax->numele++;
-        rax_free(h);
         return 1; /* Key inserted. */
     }
 
@@ -854,8 +1477,8 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
             size_t comprsize = len-i;
             if (comprsize > RAX_NODE_MAX_SIZE)
                 comprsize = RAX_NODE_MAX_SIZE;
-            raxNode *newh = raxCompressNode(h,s+i,comprsize,&child);
-            if (newh == NULL) goto oom;
+            raxNode *newh = raxCompressNode(rax,h,s+i,comprsize,&child);
+            if (raxOOM(newh == NULL)) goto oom;
             h = newh;
             memcpy(parentlink,&h,sizeof(h));
             parentlink = raxNodeLastChildPtr(h);
@@ -863,8 +1486,12 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         } else {
             debugf("Inserting normal node\n");
             raxNode **new_parentlink;
-            raxNode *newh = raxAddChild(h,s[i],&child,&new_parentlink);
-            if (newh == NULL) goto oom;
+            raxTraceStart(addstart);
+            raxNode *newh = raxAddChild(rax,h,s[i],&child,&new_parentlink);
+            if (raxOOM(newh == NULL)) goto oom;
+            raxStatsIncr(rax,addchild_reallocs,1);
+            raxTrace(RAX_TRACE_REALLOC,raxInsertOp(overwrite),rax,s,len,data,
+                     raxNodeCurrentLength(newh),newh->size,addstart);
             h = newh;
             memcpy(parentlink,&h,sizeof(h));
             parentlink = new_parentlink;
@@ -873,11 +1500,12 @@ int raxGenericInsert(rax *rax, unsigned char *s, size_t len, void *data, void **
         rax->numnodes++;
         h = child;
     }
-    raxNode *newh = raxReallocForData(h,data);
-    if (newh == NULL) goto oom;
+    raxNode *newh = raxReallocForData(rax,h,data);
+    if (raxOOM(newh == NULL)) goto oom;
     h = newh;
     if (!h->iskey) rax->numele++;
     raxSetData(h,data);
+    if (rax->values) raxValuesAdd(rax->values,value);
     memcpy(parentlink,&h,sizeof(h));
     return 1; /* Element inserted. */
 
@@ -900,28 +1528,162 @@ oom:
 /* Overwriting insert. Just a wrapper for raxGenericInsert() that will
  * update the element if there is already one for the same key. */
 int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
-    return raxGenericInsert(rax,s,len,data,old,1);
+    raxTraceStart(start);
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_INSERT,rax,s,len,data,0,0,0);
+    int retval = raxGenericInsert(rax,s,len,data,old,1);
+    raxTrace(RAX_TRACE_OP_END,RAX_OP_INSERT,rax,s,len,data,0,retval,start);
+    return retval;
 }
 
 /* Non overwriting insert function: this if an element with the same key
  * exists, the value is not updated and the function returns 0.
  * This is a just a wrapper for raxGenericInsert(). */
 int raxTryInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old) {
-    return raxGenericInsert(rax,s,len,data,old,0);
+    raxTraceStart(start);
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_TRYINSERT,rax,s,len,data,0,0,0);
+    int retval = raxGenericInsert(rax,s,len,data,old,0);
+    raxTrace(RAX_TRACE_OP_END,RAX_OP_TRYINSERT,rax,s,len,data,0,retval,
+             start);
+    return retval;
 }
 
-/* Find a key in the rax, returns raxNotFound special void pointer value
- * if the item was not found, otherwise the value associated with the
- * item is returned. */
-void *raxFind(rax *rax, unsigned char *s, size_t len) {
+/* Low level lookup function, see raxFind(). */
+static inline void *raxLowFind(rax *rax, unsigned char *s, size_t len) {
     raxNode *h;
 
+    if (raxIsPacked(rax)) return raxPackedFind(rax,s,len);
+
     debugf("### Lookup: %.*s\n", (int)len, s);
     int splitpos = 0;
     size_t i = raxLowWalk(rax,s,len,&h,NULL,&splitpos,NULL);
     if (i != len || (h->iscompr && splitpos != 0) || !h->iskey)
         return raxNotFound;
-    return raxGetData(h);
+    return raxNodeValue(rax,h);
+}
+
+#ifdef RAX_HEAT
+/* Count a visit for each of the first heat->levels nodes in the path of
+ * the sampled lookup of 's', keyed by the prefix leading to the node. Nodes
+ * whose prefix is not already tracked are ignored once the side table is
+ * full. */
+static void raxHeatSample(rax *rax, unsigned char *s, size_t len) {
+    raxHeat *heat = rax->heat;
+    raxNode *h = rax->head;
+    size_t i = 0, j;
+
+    heat->countdown = heat->every;
+    if (raxIsPacked(rax)) return; /* No nodes to count visits for. */
+    heat->samples++;
+    for (int depth = 0; depth < heat->levels; depth++) {
+        void *visits = raxLowFind(heat->prefixes,s,i);
+        if (visits == raxNotFound) {
+            if (heat->prefixes->numele >= RAX_HEAT_MAX_PREFIXES) goto next;
+            visits = NULL;
+        }
+        raxGenericInsert(heat->prefixes,s,i,
+                         (void*)((uintptr_t)visits+1),NULL,1);
+
+next:
+        if (h->size == 0 || i == len) break;
+        if (h->iscompr) {
+            if (len-i < h->size || memcmp(h->data,s+i,h->size) != 0) break;
+            i += h->size;
+            j = 0;
+        } else {
+            for (j = 0; j < h->size; j++)
+                if (h->data[j] == s[i]) break;
+            if (j == h->size) break;
+            i++;
+        }
+        memcpy(&h,raxNodeFirstChildPtr(h)+j,sizeof(h));
+    }
+}
+#endif
+
+/* Find a key in the rax, returns raxNotFound special void pointer value
+ * if the item was not found, otherwise the value associated with the
+ * item is returned. */
+void *raxFind(rax *rax, unsigned char *s, size_t len) {
+    raxTraceStart(start);
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_FIND,rax,s,len,NULL,0,0,0);
+    void *data = raxLowFind(rax,s,len);
+    raxHeatTick(rax,s,len);
+    raxTrace(RAX_TRACE_OP_END,RAX_OP_FIND,rax,s,len,NULL,0,
+             data != raxNotFound,start);
+    return data;
+}
+
+/* Stepwise lookup. raxFind() stalls on a cache miss at every node of a big
+ * tree. Callers with many independent lookups to perform can instead drive
+ * several raxLookupState machines in turn: each step visits one node and
+ * prefetches the next one, so that the memory accesses of a lookup overlap
+ * with the work of the others instead of being waited for one after the
+ * other. The result is the same raxFind() would return. */
+#if defined(__GNUC__)
+#define raxPrefetch(p) __builtin_prefetch(p)
+#else
+#define raxPrefetch(p) ((void)(p))
+#endif
+
+/* Setup 'ls' for the lookup of the key 's' of 'len' bytes in 'rax'. The key
+ * must not be modified until the lookup is done, and neither must the
+ * tree. The head node is prefetched. */
+void raxLookupStart(raxLookupState *ls, rax *rax, unsigned char *s,
+                    size_t len)
+{
+    ls->rt = rax;
+    ls->key = s;
+    ls->len = len;
+    ls->i = 0;
+    ls->node = rax->head;
+    ls->value = raxNotFound;
+    raxPrefetch(ls->node);
+    raxStatsIncr(rax,walks,!raxIsPacked(rax));
+}
+
+/* Visit the next node of the lookup: returns 1 after prefetching the node
+ * to visit in the next step, or 0 when the lookup is done, with the result
+ * in ls->value (raxNotFound if the key is not in the tree). Packed trees
+ * are searched in a single step. */
+int raxLookupStep(raxLookupState *ls) {
+    rax *rax = ls->rt;
+    raxNode *h = ls->node;
+    unsigned char *s = ls->key;
+    size_t i = ls->i, len = ls->len, j;
+
+    if (raxIsPacked(rax)) {
+        ls->value = raxPackedFind(rax,s,len);
+        goto done;
+    }
+    if (h->size == 0 || i == len) {
+        /* Same condition raxLowFind() checks on the stop node. */
+        if (i == len && h->iskey) ls->value = raxNodeValue(rax,h);
+        goto done;
+    }
+
+    /* Like an iteration of raxLowWalk(). */
+    raxStatsIncr(rax,nodes_visited,1);
+    if (h->iscompr) {
+        for (j = 0; j < h->size && i < len; j++, i++)
+            if (h->data[j] != s[i]) break;
+        raxStatsIncr(rax,compr_bytes,j + (j != h->size && i < len));
+        if (j != h->size) goto done;
+        j = 0;
+    } else {
+        for (j = 0; j < h->size; j++)
+            if (h->data[j] == s[i]) break;
+        raxStatsIncr(rax,edge_bytes,j != h->size ? j+1 : j);
+        if (j == h->size) goto done;
+        i++;
+    }
+    memcpy(&ls->node,raxNodeFirstChildPtr(h)+j,sizeof(h));
+    ls->i = i;
+    raxPrefetch(ls->node);
+    return 1;
+
+done:
+    raxHeatTick(rax,s,len);
+    return 0;
 }
 
 /* Return the memory address where the 'parent' node stores the specified
@@ -944,7 +1706,7 @@ raxNode **raxFindParentLink(raxNode *parent, raxNode *child) {
  * removal) is returned. Note that this function does not fix the pointer
  * of the parent node in its parent, so this task is up to the caller.
  * The function never fails for out of memory. */
-raxNode *raxRemoveChild(raxNode *parent, raxNode *child) {
+raxNode *raxRemoveChild(rax *rax, raxNode *parent, raxNode *child) {
     debugnode("raxRemoveChild before", parent);
     /* If parent is a compressed node (having a single child, as for definition
      * of the data structure), the removal of the child consists into turning
@@ -988,10 +1750,11 @@ raxNode *raxRemoveChild(raxNode *parent, raxNode *child) {
     /* Compute the shift, that is the amount of bytes we should move our
      * child pointers to the left, since the removal of one edge character
      * and the corresponding padding change, may change the layout.
-     * We just check if in the old version of the node there was at the
-     * end just a single byte and all padding: in that case removing one char
-     * will remove a whole sizeof(void*) word. */
-    size_t shift = ((parent->size+4) % sizeof(void*)) == 1 ? sizeof(void*) : 0;
+     * With padding this is a whole sizeof(void*) word if in the old version
+     * of the node there was at the end just a single byte and all padding,
+     * otherwise zero. Without padding (RAX_SMALL_HEADER) it is one byte. */
+    size_t shift = parent->size+raxPadding(parent->size) -
+                   (parent->size-1+raxPadding(parent->size-1));
 
     /* Move the children pointers before the deletion point. */
     if (shift)
@@ -1005,22 +1768,20 @@ raxNode *raxRemoveChild(raxNode *parent, raxNode *child) {
     parent->size--;
 
     /* realloc the node according to the theoretical memory usage, to free
-     * data if we are over-allocating right now. */
-    raxNode *newnode = rax_realloc(parent,raxNodeCurrentLength(parent));
-    if (newnode) {
-        debugnode("raxRemoveChild after", newnode);
-    }
-    /* Note: if rax_realloc() fails we just return the old address, which
-     * is valid. */
-    return newnode ? newnode : parent;
+     * data if we are over-allocating right now. Note: if the realloc fails
+     * we just get the old address, which is valid. */
+    raxNode *newnode = raxNodeShrink(rax,parent);
+    debugnode("raxRemoveChild after", newnode);
+    return newnode;
 }
 
-/* Remove the specified item. Returns 1 if the item was found and
- * deleted, 0 otherwise. */
-int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
+/* Low level remove function, see raxRemove(). */
+int raxGenericRemove(rax *rax, unsigned char *s, size_t len, void **old) {
     raxNode *h;
     raxStack ts;
 
+    if (raxIsPacked(rax)) return raxPackedRemove(rax,s,len,old);
+
     debugf("### Delete: %.*s\n", (int)len, s);
     raxStackInit(&ts);
     int splitpos = 0;
@@ -1029,7 +1790,12 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
         raxStackFree(&ts);
         return 0;
     }
-    if (old) *old = raxGetData(h);
+    if (rax->values && !h->isnull) {
+        void *data = raxValuesDel(rax->values,raxGetData(h));
+        if (old) *old = data;
+    } else if (old) {
+        *old = raxGetData(h);
+    }
     h->iskey = 0;
     rax->numele--;
 
@@ -1049,7 +1815,7 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
             child = h;
             debugf("Freeing child %p [%.*s] key:%d\n", (void*)child,
                 (int)child->size, (char*)child->data, child->iskey);
-            rax_free(child);
+            raxNodeFree(rax,child);
             rax->numnodes--;
             h = raxStackPop(&ts);
              /* If this node has more then one child, or actually holds
@@ -1059,7 +1825,7 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
         if (child) {
             debugf("Unlinking child %p from parent %p\n",
                 (void*)child, (void*)h);
-            raxNode *new = raxRemoveChild(h,child);
+            raxNode *new = raxRemoveChild(rax,h,child);
             if (new != h) {
                 raxNode *parent = raxStackPeek(&ts);
                 raxNode **parentlink;
@@ -1086,7 +1852,7 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
 
     /* Don't try node compression if our nodes pointers stack is not
      * complete because of OOM while executing raxLowWalk() */
-    if (trycompress && ts.oom) trycompress = 0;
+    if (raxOOM(trycompress && ts.oom)) trycompress = 0;
 
     /* Recompression: if trycompress is true, 'h' points to a radix tree node
      * that changed in a way that could allow to compress nodes in this
@@ -1163,13 +1929,14 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
             comprsize += h->size;
         }
         if (nodes > 1) {
+            raxTraceStart(comprstart);
             /* If we can compress, create the new node and populate it. */
             size_t nodesize =
                 sizeof(raxNode)+comprsize+raxPadding(comprsize)+sizeof(raxNode*);
-            raxNode *new = rax_malloc(nodesize);
+            raxNode *new = raxNodeAlloc(rax,nodesize);
             /* An out of memory here just means we cannot optimize this
              * node, but the tree is left in a consistent state. */
-            if (new == NULL) {
+            if (raxOOM(new == NULL)) {
                 raxStackFree(&ts);
                 return 1;
             }
@@ -1190,7 +1957,7 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
                 raxNode **cp = raxNodeLastChildPtr(h);
                 raxNode *tofree = h;
                 memcpy(&h,cp,sizeof(h));
-                rax_free(tofree); rax->numnodes--;
+                raxNodeFree(rax,tofree); rax->numnodes--;
                 if (h->iskey || (!h->iscompr && h->size != 1)) break;
             }
             debugnode("New node",new);
@@ -1208,6 +1975,10 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
                 rax->head = new;
             }
 
+            raxStatsIncr(rax,recompressions,1);
+            raxStatsIncr(rax,recompressed_nodes,nodes);
+            raxTrace(RAX_TRACE_RECOMPRESS,RAX_OP_REMOVE,rax,s,len,NULL,
+                     comprsize,nodes,comprstart);
             debugf("Compressed %d nodes, %d total bytes\n",
                 nodes, (int)comprsize);
         }
@@ -1216,6 +1987,16 @@ int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
     return 1;
 }
 
+/* Remove the specified item. Returns 1 if the item was found and
+ * deleted, 0 otherwise. */
+int raxRemove(rax *rax, unsigned char *s, size_t len, void **old) {
+    raxTraceStart(start);
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_REMOVE,rax,s,len,NULL,0,0,0);
+    int retval = raxGenericRemove(rax,s,len,old);
+    raxTrace(RAX_TRACE_OP_END,RAX_OP_REMOVE,rax,s,len,NULL,0,retval,start);
+    return retval;
+}
+
 /* This is the core of raxFree(): performs a depth-first scan of the
  * tree and releases all the nodes found. */
 void raxRecursiveFree(rax *rax, raxNode *n, void (*free_callback)(void*)) {
@@ -1229,18 +2010,50 @@ void raxRecursiveFree(rax *rax, raxNode *n, void (*free_callback)(void*)) {
         cp--;
     }
     debugnode("free depth-first",n);
-    if (free_callback && n->iskey && !n->isnull)
-        free_callback(raxGetData(n));
-    rax_free(n);
+    if (free_callback && n->iskey && !n->isnull) {
+        void *data = raxNodeValue(rax,n);
+        if (data) free_callback(data);
+    }
+    raxNodeFree(rax,n);
     rax->numnodes--;
 }
 
+/* Release everything but the nodes: the values array, the arena and the
+ * other auxiliary structures, then the tree itself. */
+static void raxFreeAux(rax *rax) {
+    if (rax->values) {
+        rax_free(rax->values->vals);
+        rax_free(rax->values->free);
+        rax_free(rax->values);
+    }
+    if (rax->arena) {
+        raxArena *a = rax->arena;
+        for (size_t j = 0; j < a->numchunks; j++) {
+            rax_free(a->chunks[j]->alloc);
+            rax_free(a->chunks[j]);
+        }
+        rax_free(a->chunks);
+        rax_free(a->free);
+        rax_free(a);
+    }
+#ifdef RAX_STATS
+    rax_free(rax->stats);
+#endif
+    raxHeatEnable(rax,0,0);
+    rax_free(rax);
+}
+
 /* Free a whole radix tree, calling the specified callback in order to
  * free the auxiliary data. */
 void raxFreeWithCallback(rax *rax, void (*free_callback)(void*)) {
-    raxRecursiveFree(rax,rax->head,free_callback);
-    assert(rax->numnodes == 0);
-    rax_free(rax);
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_FREE,rax,NULL,0,NULL,0,0,0);
+    if (raxIsPacked(rax)) {
+        raxPackedFree(rax,free_callback);
+    } else {
+        raxRecursiveFree(rax,rax->head,free_callback);
+        assert(rax->numnodes == 0);
+    }
+    raxFreeAux(rax);
 }
 
 /* Free a whole radix tree. */
@@ -1248,50 +2061,938 @@ void raxFree(rax *rax) {
     raxFreeWithCallback(rax,NULL);
 }
 
-/* ------------------------------- Iterator --------------------------------- */
+/* ------------------------------ Resumable jobs -----------------------------
+ * Freeing a big tree, scanning it or deleting many keys may take tens of
+ * milliseconds, which is too much for a program serving clients from a
+ * single threaded event loop. The functions below set up a raxJob instead,
+ * and raxJobRun() performs the work in small steps, returning when the
+ * budget given by the caller is exhausted, so that the job can continue in
+ * the next event loop iteration. The raxJob itself is the continuation
+ * token: it holds the position reached and it must not be moved in memory
+ * while the job is active. */
+
+static uint64_t raxJobTime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
 
-/* Initialize a Rax iterator. This call should be performed a single time
- * to initialize the iterator, and must be followed by a raxSeek() call,
- * otherwise the raxPrev()/raxNext() functions will just return EOF. */
-void raxStart(raxIterator *it, rax *rt) {
-    it->flags = RAX_ITER_EOF; /* No crash if the iterator is not seeked. */
-    it->rt = rt;
-    it->key_len = 0;
-    it->key = it->key_static_string;
-    it->key_max = RAX_ITER_STATIC_LEN;
-    it->data = NULL;
-    it->node_cb = NULL;
-    raxStackInit(&it->stack);
+/* Setup 'job' in order to free the tree 'rax' like raxFreeWithCallback()
+ * does. The tree is owned by the job from now on and can't be accessed by
+ * the caller anymore. A unit of work is a node freed. */
+void raxFreeJob(raxJob *job, rax *rax, void (*free_callback)(void*)) {
+    raxTrace(RAX_TRACE_OP_BEGIN,RAX_OP_FREE,rax,NULL,0,NULL,0,0,0);
+    memset(job,0,sizeof(*job));
+    job->type = RAX_JOB_FREE;
+    job->rt = rax;
+    job->free_callback = free_callback;
+    raxStackInit(&job->stack);
+    /* Can't fail: the first items are stored inside the stack. */
+    job->packed = raxIsPacked(rax);
+    if (!job->packed) raxStackPush(&job->stack,rax->head);
 }
 
-/* Append characters at the current key string of the iterator 'it'. This
- * is a low level function used to implement the iterator, not callable by
- * the user. Returns 0 on out of memory, otherwise 1 is returned. */
-int raxIteratorAddChars(raxIterator *it, unsigned char *s, size_t len) {
-    if (it->key_max < it->key_len+len) {
-        unsigned char *old = (it->key == it->key_static_string) ? NULL :
-                                                                  it->key;
-        size_t new_max = (it->key_len+len)*2;
-        it->key = rax_realloc(old,new_max);
-        if (it->key == NULL) {
-            it->key = (!old) ? it->key_static_string : old;
+/* Setup 'job' in order to remove all the keys in the range specified like
+ * in raxSeekRange(), calling 'free_callback', if not NULL, with the value
+ * of every key removed. A unit of work is a key removed. The tree remains
+ * usable between calls to raxJobRun(), and keys added to the range in the
+ * meantime after the current position are removed as well.
+ *
+ * On success 1 is returned. Otherwise 0 is returned and errno is set to
+ * EINVAL for invalid operators, or ENOMEM when out of memory. */
+int raxRemoveRangeJob(raxJob *job, rax *rax, const char *lo_op,
+                      unsigned char *lo, size_t lo_len, const char *hi_op,
+                      unsigned char *hi, size_t hi_len,
+                      void (*free_callback)(void*))
+{
+    memset(job,0,sizeof(*job));
+    job->type = RAX_JOB_REMOVE;
+    job->rt = rax;
+    job->free_callback = free_callback;
+    if (strlen(hi_op) > 2) {
+        errno = EINVAL;
+        return 0;
+    }
+    memcpy(job->hi_op,hi_op,strlen(hi_op)+1);
+    if (hi_len) {
+        job->hi = raxMalloc(hi_len);
+        if (raxOOM(job->hi == NULL)) {
             errno = ENOMEM;
             return 0;
         }
-        if (old == NULL) memcpy(it->key,it->key_static_string,it->key_len);
-        it->key_max = new_max;
+        memcpy(job->hi,hi,hi_len);
+        job->hi_len = hi_len;
+    }
+    raxStart(&job->it,rax);
+    if (!raxSeekRange(&job->it,lo_op,lo,lo_len,hi_op,hi,hi_len)) {
+        if (errno == 0) errno = EINVAL;
+        raxStop(&job->it);
+        rax_free(job->hi);
+        return 0;
     }
-    /* Use memmove since there could be an overlap between 's' and
-     * it->key when we use the current key in order to re-seek. */
-    memmove(it->key+it->key_len,s,len);
-    it->key_len += len;
     return 1;
 }
 
-/* Remove the specified number of chars from the right of the current
- * iterator key. */
+/* Like raxRemoveRangeJob() but removes all the keys starting with the
+ * specified prefix: these are the keys >= prefix and < than the prefix
+ * with the last byte incremented, after removing the trailing 255 bytes
+ * that can't be incremented. */
+int raxRemovePrefixJob(raxJob *job, rax *rax, unsigned char *prefix,
+                       size_t len, void (*free_callback)(void*))
+{
+    unsigned char *hi = NULL;
+    size_t hi_len = len;
+    while(hi_len && prefix[hi_len-1] == 255) hi_len--;
+    if (hi_len) {
+        hi = raxMalloc(hi_len);
+        if (raxOOM(hi == NULL)) {
+            errno = ENOMEM;
+            return 0;
+        }
+        memcpy(hi,prefix,hi_len);
+        hi[hi_len-1]++;
+    }
+    int retval = raxRemoveRangeJob(job,rax,len ? ">=" : "^",prefix,len,
+                                   hi_len ? "<" : "$",hi,hi_len,
+                                   free_callback);
+    rax_free(hi);
+    return retval;
+}
+
+/* Setup 'job' in order to call 'cb' for all the keys in the tree, in
+ * lexicographical order. The callback receives the key, its value and
+ * 'privdata', and can return 0 in order to stop the scan. A unit of work is
+ * a key visited. The tree can be modified between calls to raxJobRun(),
+ * but not by the callback: the scan continues from the first key greater
+ * than the last key visited.
+ *
+ * On success 1 is returned, otherwise 0 is returned and errno is set to
+ * ENOMEM. */
+int raxScanJob(raxJob *job, rax *rax, raxScanCallback cb, void *privdata) {
+    memset(job,0,sizeof(*job));
+    job->type = RAX_JOB_SCAN;
+    job->rt = rax;
+    job->scan_cb = cb;
+    job->privdata = privdata;
+    memcpy(job->hi_op,"$",2);
+    raxStart(&job->it,rax);
+    if (!raxSeek(&job->it,"^",NULL,0)) {
+        raxStop(&job->it);
+        return 0;
+    }
+    return 1;
+}
+
+/* Perform a unit of work of the job. Returns 1 if there is more work to do,
+ * 0 if the job is completed, and -1 on out of memory. */
+static int raxJobStep(raxJob *job) {
+    raxIterator *it = &job->it;
+
+    if (job->type == RAX_JOB_FREE) {
+        rax *rax = job->rt;
+        raxNode *n = raxStackPop(&job->stack);
+        if (n == NULL) {
+            if (job->packed) raxPackedFree(rax,job->free_callback);
+            assert(rax->numnodes == 0);
+            raxFreeAux(rax);
+            job->rt = NULL;
+            return 0;
+        }
+        int numchildren = n->iscompr ? 1 : n->size;
+        raxNode **cp = raxNodeFirstChildPtr(n);
+        while(numchildren--) {
+            raxNode *child;
+            memcpy(&child,cp,sizeof(child));
+            /* If the stack can't grow, just free the subtree now. */
+            if (!raxStackPush(&job->stack,child))
+                raxRecursiveFree(rax,child,job->free_callback);
+            cp++;
+        }
+        if (job->free_callback && n->iskey && !n->isnull) {
+            void *data = raxNodeValue(rax,n);
+            if (data) job->free_callback(data);
+        }
+        raxNodeFree(rax,n);
+        rax->numnodes--;
+        return 1;
+    }
+
+    /* Removal and scan jobs: the tree may have been modified since the
+     * last key was visited, so seek again just after it, or at it if it
+     * must be processed again. */
+    if (job->reseek) {
+        if (!raxSeekRange(it,job->reseek == 2 ? ">=" : ">",it->key,
+                          it->key_len,job->hi_op,job->hi,job->hi_len))
+            return -1;
+        job->reseek = 0;
+    }
+    errno = 0;
+    if (!raxNext(it)) return errno == ENOMEM ? -1 : 0;
+    if (job->type == RAX_JOB_REMOVE) {
+        void *old = NULL;
+        errno = 0;
+        if (!raxRemove(job->rt,it->key,it->key_len,&old) && errno == ENOMEM) {
+            /* Removing from packed trees may fail: seek the same key
+             * again, so that the next step retries. */
+            job->reseek = 2;
+            return -1;
+        }
+        if (job->free_callback && old) job->free_callback(old);
+        job->reseek = 1;
+    } else {
+        if (!job->scan_cb(it->key,it->key_len,it->data,job->privdata))
+            return 0;
+    }
+    return 1;
+}
+
+/* Run the job for at most 'max_work' units of work, and for at most
+ * 'max_us' microseconds. Zero means no limit. The clock is checked every
+ * 16 units of work, so the time limit can be exceeded by the time needed
+ * to perform 15 units.
+ *
+ * Returns 1 if there is still work to do, so that the caller should call
+ * the function again later, or 0 if the job is completed: in this case all
+ * its resources were released. When out of memory 1 is returned and errno
+ * is set to ENOMEM: the job will retry the failed step in the next call. */
+int raxJobRun(raxJob *job, size_t max_work, uint64_t max_us) {
+    uint64_t start = max_us ? raxJobTime() : 0;
+    size_t work = 0;
+
+    if (job->done) return 0;
+    while(1) {
+        int retval = raxJobStep(job);
+        if (retval == -1) {
+            errno = ENOMEM;
+            break;
+        } else if (retval == 0) {
+            raxJobStop(job);
+            return 0;
+        }
+        job->work++;
+        work++;
+        if (max_work && work >= max_work) break;
+        if (max_us && (work & 15) == 0 && raxJobTime()-start >= max_us)
+            break;
+    }
+    /* The tree may be modified before the next call. */
+    if (job->type == RAX_JOB_SCAN) job->reseek = 1;
+    return 1;
+}
+
+/* Stop the job releasing its resources. Removal and scan jobs are just
+ * abandoned, leaving the keys not processed yet in the tree. Free jobs
+ * instead can't leave the tree half freed, so the work left is performed
+ * now. */
+void raxJobStop(raxJob *job) {
+    if (job->done) return;
+    if (job->type == RAX_JOB_FREE) {
+        /* Steps can't fail here, the stack falls back to recursion. */
+        while(job->rt) raxJobStep(job);
+        raxStackFree(&job->stack);
+    } else {
+        raxStop(&job->it);
+        rax_free(job->hi);
+        job->hi = NULL;
+    }
+    job->done = 1;
+}
+
+/* Register the function 'cb' to be called, with 'privdata' as second
+ * argument, for every trace event (see raxTraceEvent in rax.h): at the
+ * start and end of raxInsert(), raxTryInsert(), raxRemove(), raxFind(),
+ * raxSeek(), raxNext() and raxPrev(), when trees are created and freed,
+ * and when compressed nodes are split, chains of nodes are compressed by
+ * raxRemove(), or nodes are reallocated to add children. Passing NULL
+ * disables tracing. The callback is global, not per tree.
+ *
+ * Returns 1 on success, or 0 if Rax was not compiled with RAX_TRACE. */
+int raxSetTraceCallback(raxTraceCallback cb, void *privdata) {
+#ifdef RAX_TRACE
+    raxTraceCb = cb;
+    raxTracePrivdata = privdata;
+    return 1;
+#else
+    (void)cb;
+    (void)privdata;
+    return 0;
+#endif
+}
+
+/* Copy the operation counters of the tree into 'stats' and return 1. If Rax
+ * was not compiled with RAX_STATS, or the tree has no counters (static
+ * trees), 'stats' is zeroed and 0 is returned. */
+int raxGetStats(rax *rax, raxStats *stats) {
+#ifdef RAX_STATS
+    if (rax->stats) {
+        *stats = *rax->stats;
+        return 1;
+    }
+#else
+    (void)rax;
+#endif
+    memset(stats,0,sizeof(*stats));
+    return 0;
+}
+
+/* Reset the operation counters of the tree, if any. */
+void raxResetStats(rax *rax) {
+#ifdef RAX_STATS
+    if (rax->stats) memset(rax->stats,0,sizeof(raxStats));
+#else
+    (void)rax;
+#endif
+}
+
+/* Enable the sampled access heat of the tree: one raxFind() call every
+ * 'every' counts a visit to each of the first 'levels' nodes of its path,
+ * in a side table keyed by the prefix leading to the node, that can be
+ * queried with raxHotPrefixes(). Enabling it again resets the counts,
+ * while 'every' set to 0 disables it and frees the side table.
+ *
+ * While the heat is enabled lookups modify the tree, so they need
+ * exclusive access to it like insertions and removals.
+ *
+ * Returns 1 on success, 0 on out of memory or if Rax was not compiled
+ * with RAX_HEAT. */
+int raxHeatEnable(rax *rax, uint32_t every, int levels) {
+#ifdef RAX_HEAT
+    if (rax->heat) {
+        raxFree(rax->heat->prefixes);
+        rax_free(rax->heat);
+        rax->heat = NULL;
+    }
+    if (every == 0) return 1;
+
+    raxHeat *heat = raxMalloc(sizeof(*heat));
+    if (raxOOM(heat == NULL)) return 0;
+    heat->prefixes = raxNew();
+    if (raxOOM(heat->prefixes == NULL)) {
+        rax_free(heat);
+        return 0;
+    }
+    heat->every = heat->countdown = every;
+    heat->levels = levels > 0 ? levels : 1;
+    heat->samples = 0;
+    rax->heat = heat;
+    return 1;
+#else
+    (void)rax;
+    (void)every;
+    (void)levels;
+    return 0;
+#endif
+}
+
+/* Return the 'k' prefixes visited by the most sampled lookups, hottest
+ * first, setting '*count' to the number of prefixes returned. Prefixes of
+ * the same path are all reported: the head (empty prefix) is visited by
+ * every lookup. The array must be freed with raxFreeHotPrefixes(). NULL is
+ * returned if heat tracking is not enabled, nothing was sampled, or on out
+ * of memory. */
+raxHotPrefix *raxHotPrefixes(rax *rax, size_t k, size_t *count) {
+    *count = 0;
+#ifdef RAX_HEAT
+    raxHeat *heat = rax->heat;
+    if (heat == NULL || heat->samples == 0 || k == 0) return NULL;
+    if (k > heat->prefixes->numele) k = heat->prefixes->numele;
+    raxHotPrefix *hp = raxMalloc(sizeof(*hp)*k);
+    if (raxOOM(hp == NULL)) return NULL;
+
+    size_t n = 0;
+    raxIterator ri;
+    raxStart(&ri,heat->prefixes);
+    raxSeek(&ri,"^",NULL,0);
+    while(raxNext(&ri)) {
+        uint64_t visits = (uintptr_t)ri.data;
+        if (n == k && visits <= hp[k-1].visits) continue;
+        unsigned char *prefix = raxMalloc(ri.key_len ? ri.key_len : 1);
+        if (raxOOM(prefix == NULL)) {
+            raxStop(&ri);
+            raxFreeHotPrefixes(hp,n);
+            return NULL;
+        }
+        memcpy(prefix,ri.key,ri.key_len);
+
+        /* Insert sorted, evicting the coldest when full. */
+        size_t pos = n;
+        if (n == k) rax_free(hp[--pos].prefix);
+        else n++;
+        while (pos > 0 && hp[pos-1].visits < visits) {
+            hp[pos] = hp[pos-1];
+            pos--;
+        }
+        hp[pos].prefix = prefix;
+        hp[pos].len = ri.key_len;
+        hp[pos].visits = visits;
+        hp[pos].rate = (double)visits/heat->samples;
+    }
+    raxStop(&ri);
+    *count = n;
+    return hp;
+#else
+    (void)rax;
+    (void)k;
+    return NULL;
+#endif
+}
+
+/* Free the array returned by raxHotPrefixes(). */
+void raxFreeHotPrefixes(raxHotPrefix *hp, size_t count) {
+    for (size_t j = 0; j < count; j++) rax_free(hp[j].prefix);
+    rax_free(hp);
+}
+
+/* Allocate the nodes of the tree in a per tree arena from now on, instead
+ * of allocating every node with rax_malloc(), in order to dirty fewer
+ * pages when the tree is modified after a fork(): see raxArenaCompact().
+ * Nodes already in the tree are moved in the arena when reallocated or
+ * compacted. The arena is released by raxFree(), and can't be disabled.
+ * Returns 0 on out of memory, otherwise 1. */
+int raxArenaEnable(rax *rax) {
+    if (rax->arena) return 1;
+    raxArena *a = raxMalloc(sizeof(*a));
+    if (raxOOM(a == NULL)) return 0;
+    memset(a,0,sizeof(*a));
+    rax->arena = a;
+    return 1;
+}
+
+/* Move the subtree rooted at 'n' in cold pages, in depth first order, and
+ * return the new address of 'n'. Nodes that can't be moved because of out
+ * of memory are left where they are. */
+static raxNode *raxArenaCompactNode(rax *rax, raxNode *n) {
+    size_t size = raxNodeCurrentLength(n);
+    if (size <= RAX_ARENA_MAX_ALLOC) {
+        raxNode *newn = raxArenaAllocCold(rax->arena,size);
+        if (newn) {
+            memcpy(newn,n,size);
+            raxArenaFree(rax->arena,n);
+            n = newn;
+        }
+    }
+    int numchildren = n->iscompr ? 1 : n->size;
+    raxNode **cp = raxNodeFirstChildPtr(n);
+    for (int i = 0; i < numchildren; i++) {
+        raxNode *child;
+        memcpy(&child,cp+i,sizeof(child));
+        child = raxArenaCompactNode(rax,child);
+        memcpy(cp+i,&child,sizeof(child));
+    }
+    return n;
+}
+
+/* Move all the nodes of a tree using an arena in cold pages, packed in
+ * depth first order, so that the nodes of every subtree are contiguous and
+ * the memory left unused by freed nodes is reclaimed. New and reallocated
+ * nodes go to other pages, so after a fork() (for instance to persist a
+ * snapshot) the writes copy fewer pages. Call it before forking, when the
+ * tree is not being modified: the cost is a copy of every node. */
+void raxArenaCompact(rax *rax) {
+    raxArena *a = rax->arena;
+    if (a == NULL || raxIsPacked(rax)) return;
+
+    /* Nodes are copied in new chunks, so that the old ones are released
+     * once all their nodes are moved. */
+    a->compacting = 1;
+    a->numfree = 0;
+    rax->head = raxArenaCompactNode(rax,rax->head);
+    a->compacting = 0;
+
+    /* The next compaction starts a new page. */
+    raxArenaPage *p = a->cold;
+    a->cold = NULL;
+    if (p && p->nodes == 0) raxArenaPageEmpty(a,p);
+    raxArenaTrim(a);
+}
+
+/* Fill 'info' with the arena usage of the tree and return 1. If the tree
+ * has no arena, 'info' is zeroed and 0 is returned. */
+int raxArenaGetInfo(rax *rax, raxArenaInfo *info) {
+    raxArena *a = rax->arena;
+    memset(info,0,sizeof(*info));
+    if (a == NULL) return 0;
+    for (size_t j = 0; j < a->numchunks; j++) {
+        for (int i = 0; i < RAX_ARENA_CHUNK_PAGES; i++) {
+            raxArenaPage *p = a->chunks[j]->pages+i;
+            info->pages++;
+            if (p->state == RAX_ARENA_FREE) info->free_pages++;
+            else if (p->state == RAX_ARENA_HOT) info->hot_pages++;
+            else info->cold_pages++;
+            info->nodes += p->nodes;
+            info->used_bytes += p->used;
+        }
+    }
+    return 1;
+}
+
+/* Return the arena pages needed to allocate 'count' nodes of 'size' bytes,
+ * or zero if nodes of such size are not allocated in the arena. */
+static size_t raxArenaPagesFor(size_t count, size_t size) {
+    size = raxArenaRound(size);
+    if (size > RAX_ARENA_MAX_ALLOC) return 0;
+    size_t perpage = RAX_ARENA_PAGE/size;
+    return (count+perpage-1)/perpage;
+}
+
+/* Prepare the tree for a burst of insertions of 'keys' keys, 'avg_len'
+ * bytes long on average, so that they don't need to call the allocator:
+ * the tree arena is enabled (see raxArenaEnable()) and enough free pages
+ * are added to it, and touched. The nodes are estimated modeling every key
+ * as a node holding its value, a compressed node holding the bytes that
+ * only belong to this key, and a quarter of a node with four children.
+ * Keys sharing long prefixes need less than that, and nodes larger than
+ * the arena pages are still allocated with rax_malloc().
+ *
+ * The pages are released by raxReserveRelease(), and by raxArenaCompact(),
+ * if not used. Returns 0 on out of memory, otherwise 1. */
+int raxReserve(rax *rax, size_t keys, size_t avg_len) {
+    if (!raxArenaEnable(rax)) return 0;
+    if (keys == 0) return 1;
+
+    /* Bytes needed to tell apart the keys, at least one per level. */
+    size_t depth = 1;
+    for (size_t n = keys; n >= 256; n /= 256) depth++;
+    size_t suffix = avg_len > depth ? avg_len-depth : 1;
+    if (suffix > RAX_NODE_MAX_SIZE) suffix = RAX_NODE_MAX_SIZE;
+
+    size_t keynode = sizeof(raxNode)+raxPadding(0)+sizeof(void*);
+    size_t compr = sizeof(raxNode)+suffix+raxPadding(suffix)+
+                   sizeof(raxNode*);
+    size_t branch = sizeof(raxNode)+4+raxPadding(4)+sizeof(raxNode*)*4;
+    size_t pages = raxArenaPagesFor(keys,keynode)+
+                   raxArenaPagesFor(keys,compr)+
+                   raxArenaPagesFor(keys/4+1,branch);
+
+    raxArena *a = rax->arena;
+    while (a->numfree < pages)
+        if (!raxArenaAddChunk(a)) return 0;
+
+    /* Touch the pages, so that the page faults happen now as well. */
+    for (size_t j = 0; j < a->numfree; j++) a->free[j]->base[0] = 0;
+    return 1;
+}
+
+/* Release the arena chunks left completely unused, for instance after the
+ * burst of insertions raxReserve() was called for. */
+void raxReserveRelease(rax *rax) {
+    if (rax->arena) raxArenaTrim(rax->arena);
+}
+
+/* Store the values of the tree in a separate array instead of the nodes:
+ * key nodes just store the index of their value. Updating the value of an
+ * existing key then writes to the array only, so that the nodes are only
+ * written when keys are added or removed (they stay shared with a forked
+ * child, for instance), and all the values can be read sequentially with
+ * raxValuesScan(). The tree must be empty, and can't be a packed tree.
+ * Returns 1 on success, otherwise 0 with errno set to EINVAL or ENOMEM. */
+int raxValuesEnable(rax *rax) {
+    if (rax->values) return 1;
+    if (rax->numele || raxIsPacked(rax)) {
+        errno = EINVAL;
+        return 0;
+    }
+    raxValues *v = raxMalloc(sizeof(*v));
+    if (raxOOM(v == NULL)) {
+        errno = ENOMEM;
+        return 0;
+    }
+    memset(v,0,sizeof(*v));
+    rax->values = v;
+    return 1;
+}
+
+/* Copy the values of the subtree at 'n' from 'from' to 'to', in key order
+ * starting at index '*next', updating the indexes stored in the nodes. */
+static void raxValuesCompactNode(raxNode *n, void **from, void **to,
+                                 uint32_t *next)
+{
+    if (n->iskey && !n->isnull) {
+        uintptr_t idx = (uintptr_t)raxGetData(n)-1;
+        to[*next] = from[idx];
+        /* Only the nodes whose value moved are written. */
+        if (idx != *next) raxSetData(n,(void*)((uintptr_t)*next+1));
+        (*next)++;
+    }
+    int numchildren = n->iscompr ? 1 : n->size;
+    raxNode **cp = raxNodeFirstChildPtr(n);
+    for (int i = 0; i < numchildren; i++) {
+        raxNode *child;
+        memcpy(&child,cp+i,sizeof(child));
+        raxValuesCompactNode(child,from,to,next);
+    }
+}
+
+/* Renumber the values in key order, releasing the free slots, so that
+ * raxValuesScan() reads the values in key order, without holes. Returns 0
+ * on out of memory, leaving the array as it is, otherwise 1. */
+int raxValuesCompact(rax *rax) {
+    raxValues *v = rax->values;
+    if (v == NULL) return 1;
+    size_t size = rax->numele > 16 ? rax->numele : 16;
+    void **vals = raxMalloc(sizeof(void*)*size);
+    uint32_t *freelist = raxMalloc(sizeof(uint32_t)*size);
+    if (raxOOM(vals == NULL || freelist == NULL)) {
+        rax_free(vals);
+        rax_free(freelist);
+        errno = ENOMEM;
+        return 0;
+    }
+    uint32_t next = 0;
+    raxValuesCompactNode(rax->head,v->vals,vals,&next);
+    rax_free(v->vals);
+    rax_free(v->free);
+    v->vals = vals;
+    v->free = freelist;
+    v->numfree = 0;
+    v->len = next;
+    v->size = size;
+    return 1;
+}
+
+/* Call 'fn' for every value of the tree. With a values array the array is
+ * read sequentially, without touching the nodes: after raxValuesCompact()
+ * the values are visited in key order, then new keys take the free slots
+ * or are appended. Otherwise the tree is iterated in key order. */
+void raxValuesScan(rax *rax, void (*fn)(void *value, void *privdata),
+                   void *privdata)
+{
+    raxValues *v = rax->values;
+    if (v) {
+        for (uint32_t j = 0; j < v->len; j++)
+            if (v->vals[j] != RAX_VALUE_FREE) fn(v->vals[j],privdata);
+        return;
+    }
+    raxIterator ri;
+    raxStart(&ri,rax);
+    raxSeek(&ri,"^",NULL,0);
+    while (raxNext(&ri)) fn(ri.data,privdata);
+    raxStop(&ri);
+}
+
+/* ---------------------------- Packed encoding ----------------------------- */
+
+/* Decoding state of a packed buffer: 'key' holds the last key decoded,
+ * rebuilt from the entries scanned so far. */
+typedef struct raxPackedCursor {
+    raxPacked *p;
+    size_t idx;         /* Index of the next entry to decode. */
+    size_t off;         /* Offset of the next entry to decode. */
+    unsigned char key[RAX_PACKED_MAX_KEYLEN];
+    size_t len;         /* Length of the last key decoded. */
+    void *data;         /* Value of the last key decoded. */
+} raxPackedCursor;
+
+/* Position the cursor at the restart entry of the specified block. */
+static void raxPackedCursorInit(raxPackedCursor *c, raxPacked *p,
+                                size_t block)
+{
+    c->p = p;
+    c->idx = block*RAX_PACKED_RESTART;
+    c->off = p->restart[block];
+    c->len = 0;
+}
+
+/* Decode the next entry. Returns 0 if there are no more entries. */
+static int raxPackedCursorNext(raxPackedCursor *c) {
+    if (c->idx == c->p->numkeys) return 0;
+    unsigned char *e = c->p->entries+c->off;
+    size_t shared = e[0], suffix = e[1];
+    memcpy(c->key+shared,e+2,suffix);
+    c->len = shared+suffix;
+    memcpy(&c->data,e+2+suffix,sizeof(c->data));
+    c->off += 2+suffix+sizeof(c->data);
+    c->idx++;
+    return 1;
+}
+
+/* Compare two keys like memcmp(), the shorter being the smaller if one is
+ * a prefix of the other. */
+static int raxPackedCompare(unsigned char *a, size_t alen,
+                            unsigned char *b, size_t blen)
+{
+    size_t minlen = alen < blen ? alen : blen;
+    int cmp = minlen ? memcmp(a,b,minlen) : 0;
+    if (cmp) return cmp;
+    return alen < blen ? -1 : alen > blen;
+}
+
+/* Search the first key greater or equal to 's' and return its index, or
+ * the number of keys if there is none. '*offp' is set to the offset of its
+ * entry, and '*found' to 1 if the key is equal to 's', otherwise to 0. */
+static size_t raxPackedSearch(raxPacked *p, unsigned char *s, size_t len,
+                              size_t *offp, int *found)
+{
+    /* Binary search of the last block starting with a key <= s, if any,
+     * otherwise of the first block. */
+    size_t lo = 0;
+    size_t hi = (p->numkeys+RAX_PACKED_RESTART-1)/RAX_PACKED_RESTART;
+    while (hi-lo > 1) {
+        size_t mid = (lo+hi)/2;
+        unsigned char *e = p->entries+p->restart[mid];
+        if (raxPackedCompare(e+2,e[1],s,len) <= 0) lo = mid;
+        else hi = mid;
+    }
+
+    /* Linear scan, without decoding the keys: 'match' is the length of
+     * the prefix that the last key, smaller than 's', has in common with
+     * 's'. A key sharing less than that with the previous one is greater
+     * than 's', a key sharing more is smaller, and only otherwise its
+     * suffix needs to be compared. */
+    size_t idx = lo*RAX_PACKED_RESTART, off = p->restart[lo], match = 0;
+    *found = 0;
+    for (; idx < p->numkeys; idx++) {
+        unsigned char *e = p->entries+off;
+        size_t shared = e[0], suffix = e[1];
+        if (shared < match) break;
+        if (shared == match) {
+            size_t i = 0;
+            while (i < suffix && match < len && e[2+i] == s[match]) {
+                i++;
+                match++;
+            }
+            if (i < suffix) {
+                if (match == len || e[2+i] > s[match]) break;
+            } else if (match == len) {
+                *found = 1;
+                break;
+            }
+        }
+        off += 2+suffix+sizeof(void*);
+    }
+    *offp = off;
+    return idx;
+}
+
+/* Return the value of the entry at offset 'off'. */
+static void *raxPackedGetData(raxPacked *p, size_t off) {
+    void *data;
+    memcpy(&data,p->entries+off+2+p->entries[off+1],sizeof(data));
+    return data;
+}
+
+/* Encoder state used to rebuild a packed buffer. */
+typedef struct raxPackedBuilder {
+    raxPacked *p;
+    unsigned char prev[RAX_PACKED_MAX_KEYLEN];
+    size_t prevlen;
+} raxPackedBuilder;
+
+/* Append a key to the buffer being built. The buffer must be large enough
+ * and the key greater than the previous one. */
+static void raxPackedAppend(raxPackedBuilder *b, unsigned char *key,
+                            size_t len, void *data)
+{
+    raxPacked *p = b->p;
+    size_t shared = 0;
+
+    if (p->numkeys % RAX_PACKED_RESTART == 0) {
+        p->restart[p->numkeys/RAX_PACKED_RESTART] = p->bytes;
+    } else {
+        while (shared < len && shared < b->prevlen &&
+               key[shared] == b->prev[shared]) shared++;
+    }
+    unsigned char *e = p->entries+p->bytes;
+    e[0] = shared;
+    e[1] = len-shared;
+    memcpy(e+2,key+shared,len-shared);
+    memcpy(e+2+len-shared,&data,sizeof(data));
+    p->bytes += 2+len-shared+sizeof(data);
+    p->numkeys++;
+    memcpy(b->prev+shared,key+shared,len-shared);
+    b->prevlen = len;
+}
+
+/* Return a new packed buffer with the entries of 'p', but without the one
+ * at index 'pos' if 'del' is true, otherwise with the key 's' added before
+ * it. Returns NULL on out of memory. */
+static raxPacked *raxPackedRebuild(raxPacked *p, size_t pos, int del,
+                                   unsigned char *s, size_t len, void *data)
+{
+    /* Besides the new entry, the front coding of the entry following the
+     * deleted one, and of the entries becoming restart entries, may grow
+     * up to the full key length. */
+    size_t maxbytes = p->bytes + (del ? 0 : 2+len+sizeof(void*)) +
+                      (RAX_PACKED_RESTARTS+1)*RAX_PACKED_MAX_KEYLEN;
+    raxPacked *np = raxMalloc(sizeof(raxPacked)+maxbytes);
+    if (raxOOM(np == NULL)) return NULL;
+    memset(np,0,sizeof(*np));
+    np->version = p->version+1;
+
+    raxPackedBuilder b;
+    b.p = np;
+    b.prevlen = 0;
+    raxPackedCursor c;
+    raxPackedCursorInit(&c,p,0);
+    while (raxPackedCursorNext(&c)) {
+        if (c.idx-1 == pos) {
+            if (del) continue;
+            raxPackedAppend(&b,s,len,data);
+        }
+        raxPackedAppend(&b,c.key,c.len,c.data);
+    }
+    if (!del && pos == p->numkeys) raxPackedAppend(&b,s,len,data);
+
+    /* Give back the unused space. Failing is harmless here. */
+    raxPacked *fit = rax_realloc(np,sizeof(raxPacked)+np->bytes);
+    return fit ? fit : np;
+}
+
+/* Lookup in a packed tree, see raxLowFind(). */
+static void *raxPackedFind(rax *rax, unsigned char *s, size_t len) {
+    raxPacked *p = raxPackedOf(rax);
+    size_t off;
+    int found;
+    raxPackedSearch(p,s,len,&off,&found);
+    return found ? raxPackedGetData(p,off) : raxNotFound;
+}
+
+/* Insert in a packed tree, see raxGenericInsert(). Returns -1, without
+ * touching the tree, if the key does not fit the packed encoding, so that
+ * the tree must be converted to nodes first. */
+static int raxPackedInsert(rax *rax, unsigned char *s, size_t len, void *data,
+                           void **old, int overwrite)
+{
+    raxPacked *p = raxPackedOf(rax);
+    size_t off;
+    int found;
+
+    if (len > RAX_PACKED_MAX_KEYLEN) return -1;
+    size_t pos = raxPackedSearch(p,s,len,&off,&found);
+    if (found) {
+        if (old) *old = raxPackedGetData(p,off);
+        if (overwrite)
+            memcpy(p->entries+off+2+p->entries[off+1],&data,sizeof(data));
+        errno = 0;
+        return 0;
+    }
+    if (p->numkeys == RAX_PACKED_MAX_KEYS) return -1;
+
+    raxPacked *np = raxPackedRebuild(p,pos,0,s,len,data);
+    if (np == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+    if (np->bytes > RAX_PACKED_MAX_BYTES) {
+        rax_free(np);
+        return -1;
+    }
+    rax_free(p);
+    rax->head = (raxNode*)(void*)np;
+    rax->numele++;
+    return 1;
+}
+
+/* Remove from a packed tree, see raxGenericRemove(). Since the buffer is
+ * rebuilt, unlike removals from nodes this can fail for out of memory: in
+ * that case the key is not removed, 0 is returned and errno is set to
+ * ENOMEM. */
+static int raxPackedRemove(rax *rax, unsigned char *s, size_t len,
+                           void **old)
+{
+    raxPacked *p = raxPackedOf(rax);
+    size_t off;
+    int found;
+
+    size_t pos = raxPackedSearch(p,s,len,&off,&found);
+    if (!found) return 0;
+    raxPacked *np = raxPackedRebuild(p,pos,1,NULL,0,NULL);
+    if (np == NULL) {
+        errno = ENOMEM;
+        return 0;
+    }
+    if (old) *old = raxPackedGetData(p,off);
+    rax_free(p);
+    rax->head = (raxNode*)(void*)np;
+    rax->numele--;
+    return 1;
+}
+
+/* Convert a packed tree to nodes. The nodes are built in a temporary tree,
+ * so that on out of memory 0 is returned and the packed tree is left
+ * untouched. Otherwise 1 is returned. */
+static int raxPackedConvert(rax *rax) {
+    raxPacked *p = raxPackedOf(rax);
+    struct rax tmp;
+
+    memset(&tmp,0,sizeof(tmp));
+    tmp.arena = rax->arena;
+    tmp.head = raxNewNode(&tmp,0,0);
+    if (raxOOM(tmp.head == NULL)) return 0;
+    tmp.numnodes = 1;
+
+    raxPackedCursor c;
+    raxPackedCursorInit(&c,p,0);
+    while (raxPackedCursorNext(&c)) {
+        if (!raxGenericInsert(&tmp,c.key,c.len,c.data,NULL,1)) {
+            raxRecursiveFree(&tmp,tmp.head,NULL);
+            return 0;
+        }
+    }
+    rax_free(p);
+    rax->head = tmp.head;
+    rax->numnodes = tmp.numnodes;
+    return 1;
+}
+
+/* Free a packed tree buffer, see raxFreeWithCallback(). */
+static void raxPackedFree(rax *rax, void (*free_callback)(void*)) {
+    raxPackedCursor c;
+
+    raxPackedCursorInit(&c,raxPackedOf(rax),0);
+    while (free_callback && raxPackedCursorNext(&c))
+        if (c.data) free_callback(c.data);
+    rax_free(rax->head);
+    rax->head = NULL;
+}
+
+/* ------------------------------- Iterator --------------------------------- */
+
+/* Initialize a Rax iterator. This call should be performed a single time
+ * to initialize the iterator, and must be followed by a raxSeek() call,
+ * otherwise the raxPrev()/raxNext() functions will just return EOF. */
+void raxStart(raxIterator *it, rax *rt) {
+    it->flags = RAX_ITER_EOF; /* No crash if the iterator is not seeked. */
+    it->rt = rt;
+    it->key_len = 0;
+    it->key = it->key_static_string;
+    it->key_max = RAX_ITER_STATIC_LEN;
+    it->data = NULL;
+    it->node_cb = NULL;
+    it->range_lo = it->range_hi = NULL;
+    raxStackInit(&it->stack);
+}
+
+/* Append characters at the current key string of the iterator 'it'. This
+ * is a low level function used to implement the iterator, not callable by
+ * the user. Returns 0 on out of memory, otherwise 1 is returned. */
+int raxIteratorAddChars(raxIterator *it, unsigned char *s, size_t len) {
+    if (it->key_max < it->key_len+len) {
+        unsigned char *old = (it->key == it->key_static_string) ? NULL :
+                                                                  it->key;
+        size_t new_max = (it->key_len+len)*2;
+        it->key = raxRealloc(old,new_max);
+        if (raxOOM(it->key == NULL)) {
+            it->key = (!old) ? it->key_static_string : old;
+            errno = ENOMEM;
+            return 0;
+        }
+        if (old == NULL) memcpy(it->key,it->key_static_string,it->key_len);
+        it->key_max = new_max;
+    }
+    /* Use memmove since there could be an overlap between 's' and
+     * it->key when we use the current key in order to re-seek. */
+    memmove(it->key+it->key_len,s,len);
+    it->key_len += len;
+    return 1;
+}
+
+/* Remove the specified number of chars from the right of the current
+ * iterator key. */
 void raxIteratorDelChars(raxIterator *it, size_t count) {
     it->key_len -= count;
+    if (it->key_len < it->range_lo_min) it->range_lo_min = it->key_len;
+    if (it->key_len < it->range_hi_min) it->range_hi_min = it->key_len;
 }
 
 /* Do an iteration step towards the next element. At the end of the step the
@@ -1342,7 +3043,7 @@ int raxIteratorNextStep(raxIterator *it, int noup) {
              * way, since the key is lexicograhically smaller compared to
              * what follows in the sub-children. */
             if (it->node->iskey) {
-                it->data = raxGetData(it->node);
+                it->data = raxNodeValue(it->rt,it->node);
                 return 1;
             }
         } else {
@@ -1395,7 +3096,7 @@ int raxIteratorNextStep(raxIterator *it, int noup) {
                         if (it->node_cb && it->node_cb(&it->node))
                             memcpy(cp,&it->node,sizeof(it->node));
                         if (it->node->iskey) {
-                            it->data = raxGetData(it->node);
+                            it->data = raxNodeValue(it->rt,it->node);
                             return 1;
                         }
                         break;
@@ -1495,23 +3196,75 @@ int raxIteratorPrevStep(raxIterator *it, int noup) {
          * subtree, or if we did not find a new subtree to explore here,
          * before giving up with this node, check if it's a key itself. */
         if (it->node->iskey) {
-            it->data = raxGetData(it->node);
+            it->data = raxNodeValue(it->rt,it->node);
             return 1;
         }
     }
 }
 
-/* Seek an iterator at the specified element.
- * Return 0 if the seek failed for syntax error or out of memory. Otherwise
- * 1 is returned. When 0 is returned for out of memory, errno is set to
- * the ENOMEM value. */
-int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
+/* Set the iterator on the key at index 'idx' of a packed tree. Returns 0
+ * on out of memory, otherwise 1. */
+static int raxPackedIterSet(raxIterator *it, size_t idx) {
+    raxPacked *p = raxPackedOf(it->rt);
+    raxPackedCursor c;
+
+    raxPackedCursorInit(&c,p,idx/RAX_PACKED_RESTART);
+    while (c.idx <= idx) raxPackedCursorNext(&c);
+    it->key_len = 0;
+    if (!raxIteratorAddChars(it,c.key,c.len)) return 0;
+    it->data = c.data;
+    it->packed_idx = idx;
+    it->packed_off = c.off;
+    it->packed_version = p->version;
+    return 1;
+}
+
+/* raxGenericSeek() implementation for packed trees, with the operator
+ * already parsed. The tree is not empty. */
+static int raxPackedSeek(raxIterator *it, int eq, int lt, int gt, int first,
+                         int last, unsigned char *ele, size_t len)
+{
+    raxPacked *p = raxPackedOf(it->rt);
+    size_t idx;
+
+    it->flags |= RAX_ITER_PACKED;
+    if (first) {
+        idx = 0;
+    } else if (last) {
+        idx = p->numkeys-1;
+    } else {
+        size_t off;
+        int found;
+        size_t pos = raxPackedSearch(p,ele,len,&off,&found);
+        if (found && eq) {
+            idx = pos;
+        } else if (gt) {
+            idx = found ? pos+1 : pos;
+        } else if (lt && pos > 0) {
+            idx = pos-1;
+        } else {
+            idx = p->numkeys; /* Nothing to seek. */
+        }
+    }
+    if (idx >= p->numkeys) {
+        it->flags |= RAX_ITER_EOF;
+        return 1;
+    }
+    return raxPackedIterSet(it,idx);
+}
+
+/* Low level seek function, see raxSeek(). */
+static int raxGenericSeek(raxIterator *it, const char *op, unsigned char *ele,
+                   size_t len)
+{
     int eq = 0, lt = 0, gt = 0, first = 0, last = 0;
 
     it->stack.items = 0; /* Just resetting. Intialized by raxStart(). */
     it->flags |= RAX_ITER_JUST_SEEKED;
     it->flags &= ~RAX_ITER_EOF;
+    it->flags &= ~RAX_ITER_PACKED;
     it->key_len = 0;
+    it->range_lo_min = it->range_hi_min = 0;
     it->node = NULL;
 
     /* Set flags according to the operator used to perform the seek. */
@@ -1539,10 +3292,13 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
         return 1;
     }
 
+    if (raxIsPacked(it->rt))
+        return raxPackedSeek(it,eq,lt,gt,first,last,ele,len);
+
     if (first) {
         /* Seeking the first key greater or equal to the empty string
          * is equivalent to seeking the smaller key available. */
-        return raxSeek(it,">=",NULL,0);
+        return raxGenericSeek(it,">=",NULL,0);
     }
 
     if (last) {
@@ -1551,7 +3307,7 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
         it->node = it->rt->head;
         if (!raxSeekGreatest(it)) return 0;
         assert(it->node->iskey);
-        it->data = raxGetData(it->node);
+        it->data = raxNodeValue(it->rt,it->node);
         return 1;
     }
 
@@ -1562,7 +3318,7 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
     size_t i = raxLowWalk(it->rt,ele,len,&it->node,NULL,&splitpos,&it->stack);
 
     /* Return OOM on incomplete stack info. */
-    if (it->stack.oom) return 0;
+    if (raxOOM(it->stack.oom)) return 0;
 
     if (eq && i == len && (!it->node->iscompr || splitpos == 0) &&
         it->node->iskey)
@@ -1570,7 +3326,7 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
         /* We found our node, since the key matches and we have an
          * "equal" condition. */
         if (!raxIteratorAddChars(it,ele,len)) return 0; /* OOM. */
-        it->data = raxGetData(it->node);
+        it->data = raxNodeValue(it->rt,it->node);
     } else if (lt || gt) {
         /* Exact key not found or eq flag not set. We have to set as current
          * key the one represented by the node we stopped at, and perform
@@ -1643,7 +3399,7 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
                  * the previous sub-tree. */
                 if (nodechar < keychar) {
                     if (!raxSeekGreatest(it)) return 0;
-                    it->data = raxGetData(it->node);
+                    it->data = raxNodeValue(it->rt,it->node);
                 } else {
                     if (!raxIteratorAddChars(it,it->node->data,it->node->size))
                         return 0;
@@ -1687,14 +3443,172 @@ int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
     return 1;
 }
 
-/* Go to the next element in the scope of the iterator 'it'.
- * If EOF (or out of memory) is reached, 0 is returned, otherwise 1 is
- * returned. In case 0 is returned because of OOM, errno is set to ENOMEM. */
-int raxNext(raxIterator *it) {
-    if (!raxIteratorNextStep(it,0)) {
+/* Seek an iterator at the specified element.
+ * Return 0 if the seek failed for syntax error or out of memory. Otherwise
+ * 1 is returned. When 0 is returned for out of memory, errno is set to
+ * the ENOMEM value. */
+int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len) {
+    raxTraceStart(start);
+    raxTraceIter(RAX_TRACE_OP_BEGIN,RAX_OP_SEEK,it,op,ele,len,0,0);
+    it->flags &= ~(RAX_ITER_RANGE_LO|RAX_ITER_RANGE_LO_EQ|
+                   RAX_ITER_RANGE_HI|RAX_ITER_RANGE_HI_EQ);
+    int retval = raxGenericSeek(it,op,ele,len);
+    raxTraceIter(RAX_TRACE_OP_END,RAX_OP_SEEK,it,op,ele,len,retval,start);
+    return retval;
+}
+
+/* Compare the iterator key with a bound of raxSeekRange(), returning a
+ * value less than, equal to, or greater than zero like memcmp(). Only the
+ * bytes following the prefix the key still shares with the bound since
+ * the last check are compared: '*common' is updated with the new shared
+ * prefix length, and '*min', the shortest length the key had since the
+ * last check of this bound, is reset. Once the key diverges from the
+ * bound, the keys of the whole subtree below the divergence are known to
+ * be on the same side of the bound, and every check costs a single byte
+ * comparison until the iterator climbs above that point. */
+static inline int raxRangeCompare(raxIterator *it, unsigned char *bound,
+                                  size_t len, size_t *common, size_t *min)
+{
+    /* Packed steps replace the whole key. */
+    if (it->flags & RAX_ITER_PACKED) *min = 0;
+    size_t j = *common < *min ? *common : *min;
+    size_t max = it->key_len < len ? it->key_len : len;
+    while (j < max && it->key[j] == bound[j]) j++;
+    *common = j;
+    *min = it->key_len;
+    if (j < max) return it->key[j] < bound[j] ? -1 : 1;
+    return it->key_len < len ? -1 : it->key_len > len;
+}
+
+/* Return true if the iterator key is within the upper (if 'hi' is true)
+ * or lower bound of raxSeekRange(). */
+static inline int raxRangeCheck(raxIterator *it, int hi) {
+    int cmp;
+    if (hi) {
+        cmp = raxRangeCompare(it,it->range_hi,it->range_hi_len,
+                              &it->range_hi_common,&it->range_hi_min);
+        return cmp < 0 || (cmp == 0 && (it->flags & RAX_ITER_RANGE_HI_EQ));
+    } else {
+        cmp = raxRangeCompare(it,it->range_lo,it->range_lo_len,
+                              &it->range_lo_common,&it->range_lo_min);
+        return cmp > 0 || (cmp == 0 && (it->flags & RAX_ITER_RANGE_LO_EQ));
+    }
+}
+
+/* Seek the iterator at the first element of a range, like raxSeek() does,
+ * fixing both bounds: raxNext() and raxPrev() will then report EOF as soon
+ * as the next element would be out of the range, without the need to call
+ * raxCompare() after every step. The lower bound operator is ">" or ">="
+ * ("^" for no lower bound), the upper bound one "<" or "<=" ("$" for no
+ * upper bound). The bounds are copied. A following raxSeek() removes them.
+ *
+ * Return 0 for syntax error or out of memory (errno set to ENOMEM),
+ * otherwise 1 is returned, even if the range is empty: raxNext() will
+ * just return 0 in that case. */
+int raxSeekRange(raxIterator *it, const char *lo_op, unsigned char *lo,
+                 size_t lo_len, const char *hi_op, unsigned char *hi,
+                 size_t hi_len)
+{
+    int flags = 0;
+    if (lo_op[0] == '>' && (lo_op[1] == '\0' || lo_op[1] == '=')) {
+        flags |= RAX_ITER_RANGE_LO;
+        if (lo_op[1] == '=') flags |= RAX_ITER_RANGE_LO_EQ;
+    } else if (lo_op[0] != '^' || lo_op[1] != '\0') {
+        errno = 0;
+        return 0;
+    }
+    if (hi_op[0] == '<' && (hi_op[1] == '\0' || hi_op[1] == '=')) {
+        flags |= RAX_ITER_RANGE_HI;
+        if (hi_op[1] == '=') flags |= RAX_ITER_RANGE_HI_EQ;
+    } else if (hi_op[0] != '$' || hi_op[1] != '\0') {
+        errno = 0;
+        return 0;
+    }
+    if (!(flags & RAX_ITER_RANGE_LO)) lo_len = 0;
+    if (!(flags & RAX_ITER_RANGE_HI)) hi_len = 0;
+
+    /* The buffer is reused by the next seeks, that in range scans are
+     * frequent. */
+    if (it->range_lo == NULL || it->range_size < lo_len+hi_len) {
+        unsigned char *bounds = raxRealloc(it->range_lo,lo_len+hi_len+1);
+        if (raxOOM(bounds == NULL)) {
+            errno = ENOMEM;
+            return 0;
+        }
+        it->range_lo = bounds;
+        it->range_size = lo_len+hi_len+1;
+    }
+    /* Copy before seeking, since the bounds may point to the current key
+     * of the iterator. */
+    if (lo_len) memcpy(it->range_lo,lo,lo_len);
+    if (hi_len) memcpy(it->range_lo+lo_len,hi,hi_len);
+    if (!raxSeek(it,lo_op,it->range_lo,lo_len)) return 0;
+    it->range_hi = it->range_lo+lo_len;
+    it->range_lo_len = lo_len;
+    it->range_hi_len = hi_len;
+    it->range_lo_common = it->range_hi_common = 0;
+    it->flags |= flags;
+
+    /* The element seeked may already be out of the range. */
+    if (!(it->flags & RAX_ITER_EOF) && (flags & RAX_ITER_RANGE_HI) &&
+        !raxRangeCheck(it,1)) it->flags |= RAX_ITER_EOF;
+    return 1;
+}
+
+/* Next and previous step for packed trees, like raxIteratorNextStep() and
+ * raxIteratorPrevStep(). If the tree was modified since the iterator was
+ * positioned, possibly converting it to nodes, the iterator seeks again
+ * starting from the current key. */
+static int raxPackedStep(raxIterator *it, int prev) {
+    if (it->flags & RAX_ITER_EOF) {
+        return 1;
+    } else if (it->flags & RAX_ITER_JUST_SEEKED) {
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+
+    if (!raxIsPacked(it->rt) ||
+        raxPackedOf(it->rt)->version != it->packed_version)
+    {
+        if (!raxGenericSeek(it,prev ? "<" : ">",it->key,it->key_len))
+            return 0;
+        it->flags &= ~RAX_ITER_JUST_SEEKED;
+        return 1;
+    }
+
+    raxPacked *p = raxPackedOf(it->rt);
+    if (prev) {
+        if (it->packed_idx == 0) {
+            it->flags |= RAX_ITER_EOF;
+            return 1;
+        }
+        return raxPackedIterSet(it,it->packed_idx-1);
+    }
+
+    /* Going forward the current key is the previous one of the entry. */
+    if (it->packed_idx+1 >= p->numkeys) {
+        it->flags |= RAX_ITER_EOF;
+        return 1;
+    }
+    unsigned char *e = p->entries+it->packed_off;
+    it->key_len = e[0];
+    if (!raxIteratorAddChars(it,e+2,e[1])) return 0;
+    memcpy(&it->data,e+2+e[1],sizeof(it->data));
+    it->packed_idx++;
+    it->packed_off += 2+e[1]+sizeof(it->data);
+    return 1;
+}
+
+/* Low level next step, see raxNext(). */
+static inline int raxGenericNext(raxIterator *it) {
+    int ok = (it->flags & RAX_ITER_PACKED) ? raxPackedStep(it,0) :
+                                             raxIteratorNextStep(it,0);
+    if (!ok) {
         errno = ENOMEM;
         return 0;
     }
+    if (!(it->flags & RAX_ITER_EOF) && (it->flags & RAX_ITER_RANGE_HI) &&
+        !raxRangeCheck(it,1)) it->flags |= RAX_ITER_EOF;
     if (it->flags & RAX_ITER_EOF) {
         errno = 0;
         return 0;
@@ -1702,14 +3616,28 @@ int raxNext(raxIterator *it) {
     return 1;
 }
 
-/* Go to the previous element in the scope of the iterator 'it'.
+/* Go to the next element in the scope of the iterator 'it'.
  * If EOF (or out of memory) is reached, 0 is returned, otherwise 1 is
  * returned. In case 0 is returned because of OOM, errno is set to ENOMEM. */
-int raxPrev(raxIterator *it) {
-    if (!raxIteratorPrevStep(it,0)) {
+int raxNext(raxIterator *it) {
+    raxTraceStart(start);
+    raxTraceIter(RAX_TRACE_OP_BEGIN,RAX_OP_NEXT,it,NULL,NULL,0,0,0);
+    int retval = raxGenericNext(it);
+    raxTraceIter(RAX_TRACE_OP_END,RAX_OP_NEXT,it,NULL,it->key,it->key_len,
+                 retval,start);
+    return retval;
+}
+
+/* Low level previous step, see raxPrev(). */
+static inline int raxGenericPrev(raxIterator *it) {
+    int ok = (it->flags & RAX_ITER_PACKED) ? raxPackedStep(it,1) :
+                                             raxIteratorPrevStep(it,0);
+    if (!ok) {
         errno = ENOMEM;
         return 0;
     }
+    if (!(it->flags & RAX_ITER_EOF) && (it->flags & RAX_ITER_RANGE_LO) &&
+        !raxRangeCheck(it,0)) it->flags |= RAX_ITER_EOF;
     if (it->flags & RAX_ITER_EOF) {
         errno = 0;
         return 0;
@@ -1717,6 +3645,18 @@ int raxPrev(raxIterator *it) {
     return 1;
 }
 
+/* Go to the previous element in the scope of the iterator 'it'.
+ * If EOF (or out of memory) is reached, 0 is returned, otherwise 1 is
+ * returned. In case 0 is returned because of OOM, errno is set to ENOMEM. */
+int raxPrev(raxIterator *it) {
+    raxTraceStart(start);
+    raxTraceIter(RAX_TRACE_OP_BEGIN,RAX_OP_PREV,it,NULL,NULL,0,0,0);
+    int retval = raxGenericPrev(it);
+    raxTraceIter(RAX_TRACE_OP_END,RAX_OP_PREV,it,NULL,it->key,it->key_len,
+                 retval,start);
+    return retval;
+}
+
 /* Perform a random walk starting in the current position of the iterator.
  * Return 0 if the tree is empty or on out of memory. Otherwise 1 is returned
  * and the iterator is set to the node reached after doing a random walk
@@ -1735,6 +3675,12 @@ int raxRandomWalk(raxIterator *it, size_t steps) {
         return 0;
     }
 
+    /* Packed trees are small: just pick a key at random. */
+    if (raxIsPacked(it->rt)) {
+        it->flags |= RAX_ITER_PACKED;
+        return raxPackedIterSet(it,rand() % it->rt->numele);
+    }
+
     if (steps == 0) {
         size_t fle = floor(log(it->rt->numele));
         fle *= 2;
@@ -1801,6 +3747,8 @@ int raxCompare(raxIterator *iter, const char *op, unsigned char *key, size_t key
 /* Free the iterator. */
 void raxStop(raxIterator *it) {
     if (it->key != it->key_static_string) rax_free(it->key);
+    rax_free(it->range_lo);
+    it->range_lo = it->range_hi = NULL;
     raxStackFree(&it->stack);
 }
 
@@ -1842,6 +3790,11 @@ uint64_t raxSize(rax *rax) {
  *  is used instead:
  *
  *  [abc] -> "ladin" -> []
+ *
+ *  Packed trees (see raxNewPacked()) are shown as a single line listing
+ *  the keys and their values:
+ *
+ *  {"abc"=0x12345678 "abd"=0x87654321}
  */
 
 /* The actual implementation of raxShow(). */
@@ -1880,10 +3833,152 @@ void raxRecursiveShow(int level, int lpad, raxNode *n) {
 
 /* Show a tree, as outlined in the comment above. */
 void raxShow(rax *rax) {
+    if (raxIsPacked(rax)) {
+        raxPackedCursor c;
+        raxPackedCursorInit(&c,raxPackedOf(rax),0);
+        printf("{");
+        while (raxPackedCursorNext(&c)) {
+            if (c.idx > 1) putchar(' ');
+            printf("\"%.*s\"=%p", (int)c.len, c.key, c.data);
+        }
+        printf("}\n");
+        return;
+    }
     raxRecursiveShow(0,0,rax->head);
     putchar('\n');
 }
 
+/* The actual implementation of raxAnalyze(): 'depth' is the number of
+ * nodes from the head to 'n', and 'keylen' the length of the key 'n'
+ * represents. */
+void raxRecursiveAnalyze(raxNode *n, uint64_t depth, uint64_t keylen,
+                         raxAnalysis *a)
+{
+    a->nodes++;
+    a->bytes += raxNodeCurrentLength(n);
+    a->padding_bytes += raxPadding(n->size);
+    if (n->iskey) {
+        a->keys++;
+        a->key_bytes += keylen;
+        a->depth[depth < RAX_ANALYZE_DEPTHS ? depth : RAX_ANALYZE_DEPTHS-1]++;
+        if (depth > a->max_depth) a->max_depth = depth;
+    }
+    if (n->size == 0) a->empty_leaves++;
+    if (n->iscompr) {
+        int bucket = 0;
+        while ((n->size >> (bucket+1)) && bucket < RAX_ANALYZE_RUNS-1)
+            bucket++;
+        a->compr_nodes++;
+        a->runs[bucket]++;
+    } else {
+        a->fanout[n->size]++;
+    }
+
+    int numchildren = n->iscompr ? 1 : n->size;
+    raxNode **cp = raxNodeFirstChildPtr(n);
+    for (int i = 0; i < numchildren; i++) {
+        raxNode *child;
+        memcpy(&child,cp,sizeof(child));
+        raxRecursiveAnalyze(child,depth+1,
+            keylen + (n->iscompr ? n->size : 1),a);
+        cp++;
+    }
+}
+
+/* Collect statistics about the shape of the tree, useful when raxShow()
+ * output would be too large to be useful: distribution of the keys depth,
+ * fan-out of the normal nodes, length of the compressed nodes, memory
+ * wasted for padding and so forth. See the raxAnalysis structure in rax.h
+ * for the full list. */
+void raxAnalyze(rax *rax, raxAnalysis *a) {
+    memset(a,0,sizeof(*a));
+    if (raxIsPacked(rax)) {
+        /* No nodes: keys are at depth zero. */
+        raxPackedCursor c;
+        raxPackedCursorInit(&c,raxPackedOf(rax),0);
+        while (raxPackedCursorNext(&c)) a->key_bytes += c.len;
+        a->keys = a->depth[0] = rax->numele;
+        a->bytes = sizeof(raxPacked)+raxPackedOf(rax)->bytes;
+        return;
+    }
+    raxRecursiveAnalyze(rax->head,0,0,a);
+}
+
+/* Show the statistics collected by raxAnalyze() on standard output, as
+ * text or, if 'json' is true, as a JSON object. Empty histogram buckets
+ * are omitted. */
+void raxShowAnalysis(raxAnalysis *a, int json) {
+    double avglen = a->keys ? (double)a->key_bytes/a->keys : 0;
+    double padperc = a->bytes ? (double)a->padding_bytes*100/a->bytes : 0;
+    int first;
+
+    if (json) {
+        printf("{\"keys\":%llu,\"avg_key_len\":%.2f,\"nodes\":%llu,"
+               "\"compressed_nodes\":%llu,\"empty_leaves\":%llu,"
+               "\"bytes\":%llu,\"padding_bytes\":%llu,\"max_depth\":%llu,",
+            (unsigned long long)a->keys, avglen,
+            (unsigned long long)a->nodes,
+            (unsigned long long)a->compr_nodes,
+            (unsigned long long)a->empty_leaves,
+            (unsigned long long)a->bytes,
+            (unsigned long long)a->padding_bytes,
+            (unsigned long long)a->max_depth);
+    } else {
+        printf("Keys: %llu (average length %.2f bytes)\n",
+            (unsigned long long)a->keys, avglen);
+        printf("Nodes: %llu (%llu compressed, %llu empty leaves)\n",
+            (unsigned long long)a->nodes,
+            (unsigned long long)a->compr_nodes,
+            (unsigned long long)a->empty_leaves);
+        printf("Nodes size: %llu bytes (%llu padding bytes, %.2f%%)\n",
+            (unsigned long long)a->bytes,
+            (unsigned long long)a->padding_bytes, padperc);
+        printf("Max depth: %llu\n", (unsigned long long)a->max_depth);
+    }
+
+    printf(json ? "\"depth\":{" : "Keys by depth:\n");
+    first = 1;
+    for (int j = 0; j < RAX_ANALYZE_DEPTHS; j++) {
+        if (a->depth[j] == 0) continue;
+        const char *plus = (j == RAX_ANALYZE_DEPTHS-1) ? "+" : "";
+        if (json)
+            printf("%s\"%d%s\":%llu", first ? "" : ",", j, plus,
+                (unsigned long long)a->depth[j]);
+        else
+            printf("  %d%s: %llu\n", j, plus,
+                (unsigned long long)a->depth[j]);
+        first = 0;
+    }
+
+    printf(json ? "},\"fanout\":{" : "Normal nodes by children:\n");
+    first = 1;
+    for (int j = 0; j <= 256; j++) {
+        if (a->fanout[j] == 0) continue;
+        if (json)
+            printf("%s\"%d\":%llu", first ? "" : ",", j,
+                (unsigned long long)a->fanout[j]);
+        else
+            printf("  %d: %llu\n", j, (unsigned long long)a->fanout[j]);
+        first = 0;
+    }
+
+    printf(json ? "},\"compressed_len\":{" :
+                  "Compressed nodes by length:\n");
+    first = 1;
+    for (int j = 0; j < RAX_ANALYZE_RUNS; j++) {
+        if (a->runs[j] == 0) continue;
+        unsigned long long min = 1ULL<<j, max = (2ULL<<j)-1;
+        if (json)
+            printf("%s\"%llu-%llu\":%llu", first ? "" : ",", min, max,
+                (unsigned long long)a->runs[j]);
+        else
+            printf("  %llu-%llu: %llu\n", min, max,
+                (unsigned long long)a->runs[j]);
+        first = 0;
+    }
+    if (json) printf("}}\n");
+}
+
 /* Used by debugnode() macro to show info about a given node. */
 void raxDebugShowNode(const char *msg, raxNode *n) {
     if (raxDebugMsg == 0) return;
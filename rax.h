@@ -33,6 +33,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Representation of a radix tree as implemented in this file, that contains
  * the strings "foo", "foobar" and "footer" after the insertion of each
  * word. When the node represents a key inside the radix tree, we write it
@@ -94,12 +98,29 @@
  *
  */
 
+/* Compiling with RAX_SMALL_HEADER the node header takes 16 bits instead of
+ * 32, and the child pointers are stored right after the characters, without
+ * padding to align them, since they are always accessed with memcpy(). This
+ * saves up to 9 bytes per node, but compressed nodes can only hold 8191
+ * characters: longer runs become chains of compressed nodes. Only the node
+ * layout changes, so the define is needed by rax.c and by the code reading
+ * raxNode or the layout of the nodes, while code using just the API and the
+ * other structures can be compiled either way. */
+#ifdef RAX_SMALL_HEADER
+#define RAX_NODE_MAX_SIZE ((1<<13)-1)
+typedef struct raxNode {
+    uint16_t iskey:1;
+    uint16_t isnull:1;
+    uint16_t iscompr:1;
+    uint16_t size:13;
+#else
 #define RAX_NODE_MAX_SIZE ((1<<29)-1)
 typedef struct raxNode {
     uint32_t iskey:1;     /* Does this node contain a key? */
     uint32_t isnull:1;    /* Associated value is NULL (don't store it). */
     uint32_t iscompr:1;   /* Node is compressed. */
     uint32_t size:29;     /* Number of children, or compressed string len. */
+#endif
     /* Data layout is as follows:
      *
      * If node is not compressed we have 'size' bytes, one for each children
@@ -130,12 +151,119 @@ typedef struct raxNode {
     unsigned char data[];
 } raxNode;
 
+/* Operation counters. They are only collected when Rax is compiled with
+ * RAX_STATS defined (the define must be the same for rax.c and for the code
+ * including rax.h, since it changes the rax structure), otherwise the code
+ * incrementing them is not compiled at all. See raxGetStats(). */
+typedef struct raxStats {
+    uint64_t walks;             /* Lookups, inserts, removes and seeks. */
+    uint64_t nodes_visited;     /* Nodes traversed while walking. */
+    uint64_t compr_bytes;       /* Bytes compared in compressed nodes. */
+    uint64_t edge_bytes;        /* Edge bytes scanned in normal nodes. */
+    uint64_t addchild_reallocs; /* Nodes reallocated to add a child. */
+    uint64_t splits_algo1;      /* Compressed nodes split at a mismatch. */
+    uint64_t splits_algo2;      /* Compressed nodes split since the key
+                                   ends inside them. */
+    uint64_t recompressions;    /* Chains compressed again by raxRemove(). */
+    uint64_t recompressed_nodes;/* Nodes merged by such recompressions. */
+} raxStats;
+
+/* Hottest prefixes returned by raxHotPrefixes(). */
+typedef struct raxHotPrefix {
+    unsigned char *prefix;  /* Path from the head to the node. */
+    size_t len;
+    uint64_t visits;        /* Sampled lookups visiting the node. */
+    double rate;            /* Fraction of the sampled lookups. */
+} raxHotPrefix;
+
+/* Node arena usage reported by raxArenaGetInfo(). */
+typedef struct raxArenaInfo {
+    uint64_t pages;             /* Pages allocated, free ones included. */
+    uint64_t hot_pages;         /* Pages receiving new and modified nodes. */
+    uint64_t cold_pages;        /* Pages filled by raxArenaCompact(). */
+    uint64_t free_pages;        /* Empty pages, ready for reuse. */
+    uint64_t nodes;             /* Nodes allocated in the arena. */
+    uint64_t used_bytes;        /* Bytes allocated in non free pages, either
+                                   used or freed since the page was filled. */
+} raxArenaInfo;
+
 typedef struct rax {
     raxNode *head;
     uint64_t numele;
-    uint64_t numnodes;
+    uint64_t numnodes;  /* Zero for packed trees, see raxNewPacked(). */
+    struct raxArena *arena; /* Node arena, see raxArenaEnable(). */
+    struct raxValues *values; /* Values array, see raxValuesEnable(). */
+#ifdef RAX_STATS
+    raxStats *stats;    /* NULL if the tree was not created by raxNew(). */
+#endif
+#ifdef RAX_HEAT
+    struct raxHeat *heat; /* Access heat, see raxHeatEnable(). */
+#endif
 } rax;
 
+/* Trace events, reported to the callback registered with
+ * raxSetTraceCallback() when Rax is compiled with RAX_TRACE. Durations
+ * are in nanoseconds. */
+#define RAX_TRACE_OP_BEGIN 0    /* Operation started. */
+#define RAX_TRACE_OP_END 1      /* Operation done: 'count' is the return
+                                   value (1 if found for lookups). For
+                                   raxNext() / raxPrev() the key is the
+                                   one reached. */
+#define RAX_TRACE_SPLIT 2       /* Compressed node of 'size' bytes split:
+                                   'count' is the algorithm, 1 or 2. */
+#define RAX_TRACE_RECOMPRESS 3  /* 'count' nodes merged into a compressed
+                                   node of 'size' bytes by raxRemove(). */
+#define RAX_TRACE_REALLOC 4     /* Node grown to 'size' bytes to add a
+                                   child, 'count' is the new children. */
+
+/* Operations, see the 'op' field of raxTraceEvent. */
+#define RAX_OP_INSERT 0
+#define RAX_OP_TRYINSERT 1
+#define RAX_OP_REMOVE 2
+#define RAX_OP_FIND 3
+#define RAX_OP_SEEK 4
+#define RAX_OP_NEXT 5
+#define RAX_OP_PREV 6
+#define RAX_OP_NEW 7            /* Only the end event is reported. */
+#define RAX_OP_FREE 8           /* Only the begin event is reported. */
+
+typedef struct raxTraceEvent {
+    int type;               /* RAX_TRACE_... */
+    int op;                 /* Operation in progress, RAX_OP_... */
+    struct rax *rax;        /* Tree the operation is performed on. */
+    struct raxIterator *iter; /* Iterator, for iterator operations. */
+    const char *seek_op;    /* Operator, for raxSeek(). */
+    unsigned char *key;     /* Key of the operation. */
+    size_t key_len;
+    void *data;             /* Value, for inserts. */
+    size_t size;            /* Bytes involved, depending on the event. */
+    uint64_t count;         /* Depending on the event. */
+    uint64_t duration;      /* Event duration, zero for OP_BEGIN. */
+} raxTraceEvent;
+
+typedef void (*raxTraceCallback)(const raxTraceEvent *e, void *privdata);
+
+/* Tree shape statistics, filled by raxAnalyze() with a single traversal. */
+#define RAX_ANALYZE_DEPTHS 64   /* Deeper keys are counted in the last bucket. */
+#define RAX_ANALYZE_RUNS 30     /* Enough for any compressed node length. */
+typedef struct raxAnalysis {
+    uint64_t keys;              /* Number of keys. */
+    uint64_t key_bytes;         /* Total length of the keys. */
+    uint64_t nodes;             /* Number of nodes. */
+    uint64_t compr_nodes;       /* Number of compressed nodes. */
+    uint64_t empty_leaves;      /* Nodes without children. */
+    uint64_t bytes;             /* Total size of the nodes. */
+    uint64_t padding_bytes;     /* Bytes used to align child pointers. */
+    uint64_t max_depth;         /* Max depth of a key, in nodes. */
+    /* Keys by depth, that is, the number of nodes from the head. */
+    uint64_t depth[RAX_ANALYZE_DEPTHS];
+    /* Non compressed nodes by number of children. */
+    uint64_t fanout[257];
+    /* Compressed nodes by length: runs[j] counts lengths in the range
+     * 2^j ... 2^(j+1)-1. */
+    uint64_t runs[RAX_ANALYZE_RUNS];
+} raxAnalysis;
+
 /* Stack data structure used by raxLowWalk() in order to, optionally, return
  * a list of parent nodes to the caller. The nodes do not have a "parent"
  * field for space concerns, so we use the auxiliary stack when needed. */
@@ -159,7 +287,8 @@ typedef struct raxStack {
  * This callback is used to perform very low level analysis of the radix tree
  * structure, scanning each possible node (but the root node), or in order to
  * reallocate the nodes to reduce the allocation fragmentation (this is the
- * Redis application for this callback).
+ * Redis application for this callback). Nodes allocated in the tree arena
+ * (see raxArenaEnable()) must not be reallocated with rax_realloc().
  *
  * This is currently only supported in forward iterations (raxNext) */
 typedef int (*raxNodeCallback)(raxNode **noderef);
@@ -172,6 +301,12 @@ typedef int (*raxNodeCallback)(raxNode **noderef);
 #define RAX_ITER_EOF (1<<1)    /* End of iteration reached. */
 #define RAX_ITER_SAFE (1<<2)   /* Safe iterator, allows operations while
                                   iterating. But it is slower. */
+#define RAX_ITER_PACKED (1<<3) /* Iterating a packed tree, see
+                                  raxNewPacked(). */
+#define RAX_ITER_RANGE_LO (1<<4)    /* Lower bound set by raxSeekRange(). */
+#define RAX_ITER_RANGE_LO_EQ (1<<5) /* The lower bound is inclusive. */
+#define RAX_ITER_RANGE_HI (1<<6)    /* Upper bound set by raxSeekRange(). */
+#define RAX_ITER_RANGE_HI_EQ (1<<7) /* The upper bound is inclusive. */
 typedef struct raxIterator {
     int flags;
     rax *rt;                /* Radix tree we are iterating. */
@@ -183,21 +318,75 @@ typedef struct raxIterator {
     raxNode *node;          /* Current node. Only for unsafe iteration. */
     raxStack stack;         /* Stack used for unsafe iteration. */
     raxNodeCallback node_cb; /* Optional node callback. Normally set to NULL. */
+    size_t packed_idx;      /* Index of the current key in packed trees. */
+    size_t packed_off;      /* Offset of the entry after the current one. */
+    uint32_t packed_version; /* Packed tree version the position refers to. */
+    unsigned char *range_lo; /* Copy of the raxSeekRange() bounds, both in */
+    unsigned char *range_hi; /* the allocation starting at 'range_lo'. */
+    size_t range_size;      /* Bytes allocated at 'range_lo'. */
+    size_t range_lo_len;
+    size_t range_hi_len;
+    size_t range_lo_common; /* Bytes the key shared with the lower bound and */
+    size_t range_hi_common; /* with the upper bound at the last check. */
+    size_t range_lo_min;    /* Shortest key length since the last check */
+    size_t range_hi_min;    /* of the lower and of the upper bound. */
 } raxIterator;
 
+/* Resumable operations on big trees, see raxJobRun() in rax.c. */
+#define RAX_JOB_FREE 0
+#define RAX_JOB_REMOVE 1
+#define RAX_JOB_SCAN 2
+typedef int (*raxScanCallback)(unsigned char *key, size_t len, void *data,
+                               void *privdata);
+typedef struct raxJob {
+    int type;               /* RAX_JOB_... */
+    int done;               /* Job completed or stopped. */
+    int reseek;             /* Seek after (1) or at (2) the current key
+                               before the next step, since the tree may
+                               have changed. */
+    rax *rt;                /* Tree the job operates on. */
+    uint64_t work;          /* Units of work performed so far. */
+    void (*free_callback)(void*);
+    raxScanCallback scan_cb;
+    void *privdata;
+    raxStack stack;         /* Nodes left to free, for free jobs. */
+    int packed;             /* Freeing a packed tree. */
+    raxIterator it;         /* Position reached by removal and scan jobs. */
+    char hi_op[3];          /* Upper bound of the range to process. */
+    unsigned char *hi;
+    size_t hi_len;
+} raxJob;
+
+/* Lookup performed one node at a time, see raxLookupStep(). */
+typedef struct raxLookupState {
+    rax *rt;
+    unsigned char *key;
+    size_t len;
+    size_t i;               /* Key bytes matched so far. */
+    raxNode *node;          /* Node to visit in the next step. */
+    void *value;            /* Result when done, raxNotFound if missing. */
+} raxLookupState;
+
 /* A special pointer returned for not found items. */
 extern void *raxNotFound;
 
 /* Exported API. */
 rax *raxNew(void);
+rax *raxNewPacked(void);
 int raxInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
 int raxTryInsert(rax *rax, unsigned char *s, size_t len, void *data, void **old);
 int raxRemove(rax *rax, unsigned char *s, size_t len, void **old);
 void *raxFind(rax *rax, unsigned char *s, size_t len);
+void raxLookupStart(raxLookupState *ls, rax *rax, unsigned char *s,
+                    size_t len);
+int raxLookupStep(raxLookupState *ls);
 void raxFree(rax *rax);
 void raxFreeWithCallback(rax *rax, void (*free_callback)(void*));
 void raxStart(raxIterator *it, rax *rt);
 int raxSeek(raxIterator *it, const char *op, unsigned char *ele, size_t len);
+int raxSeekRange(raxIterator *it, const char *lo_op, unsigned char *lo,
+                 size_t lo_len, const char *hi_op, unsigned char *hi,
+                 size_t hi_len);
 int raxNext(raxIterator *it);
 int raxPrev(raxIterator *it);
 int raxRandomWalk(raxIterator *it, size_t steps);
@@ -205,12 +394,43 @@ int raxCompare(raxIterator *iter, const char *op, unsigned char *key, size_t key
 void raxStop(raxIterator *it);
 int raxEOF(raxIterator *it);
 void raxShow(rax *rax);
+void raxAnalyze(rax *rax, raxAnalysis *a);
+void raxShowAnalysis(raxAnalysis *a, int json);
 uint64_t raxSize(rax *rax);
 unsigned long raxTouch(raxNode *n);
 void raxSetDebugMsg(int onoff);
+int raxGetStats(rax *rax, raxStats *stats);
+void raxResetStats(rax *rax);
+int raxHeatEnable(rax *rax, uint32_t every, int levels);
+raxHotPrefix *raxHotPrefixes(rax *rax, size_t k, size_t *count);
+void raxFreeHotPrefixes(raxHotPrefix *hp, size_t count);
+int raxSetTraceCallback(raxTraceCallback cb, void *privdata);
+int raxArenaEnable(rax *rax);
+void raxArenaCompact(rax *rax);
+int raxArenaGetInfo(rax *rax, raxArenaInfo *info);
+int raxReserve(rax *rax, size_t keys, size_t avg_len);
+void raxReserveRelease(rax *rax);
+int raxValuesEnable(rax *rax);
+int raxValuesCompact(rax *rax);
+void raxValuesScan(rax *rax, void (*fn)(void *value, void *privdata),
+                   void *privdata);
+void raxFreeJob(raxJob *job, rax *rax, void (*free_callback)(void*));
+int raxRemoveRangeJob(raxJob *job, rax *rax, const char *lo_op,
+                      unsigned char *lo, size_t lo_len, const char *hi_op,
+                      unsigned char *hi, size_t hi_len,
+                      void (*free_callback)(void*));
+int raxRemovePrefixJob(raxJob *job, rax *rax, unsigned char *prefix,
+                       size_t len, void (*free_callback)(void*));
+int raxScanJob(raxJob *job, rax *rax, raxScanCallback cb, void *privdata);
+int raxJobRun(raxJob *job, size_t max_work, uint64_t max_us);
+void raxJobStop(raxJob *job);
 
 /* Internal API. May be used by the node callback in order to access rax nodes
  * in a low level way, so this function is exported as well. */
 void raxSetData(raxNode *n, void *data);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,469 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Header only C++17 wrapper around rax.c.
+ *
+ * rax::map<V, Alloc> is an ordered map from binary safe string keys to
+ * values of type V, implemented on top of the C API:
+ *
+ *   rax::map<std::unique_ptr<Conn>> conns;
+ *   conns.try_emplace("client:1", std::make_unique<Conn>());
+ *   for (auto [key, conn] : conns) ...
+ *   std::optional<std::unique_ptr<Conn>> c = conns.extract("client:1");
+ *
+ * Values are owned by the map. Trivially copyable values not larger than a
+ * pointer are stored inline in the node value slot, so they require no
+ * allocation at all. Other values (including move only types) are
+ * constructed in memory obtained from 'Alloc', which can be a
+ * std::pmr::polymorphic_allocator (see rax::pmr::map). Tree nodes are still
+ * allocated with the allocator rax.c was compiled with.
+ *
+ * Differences with std::map worth knowing:
+ *
+ * - try_emplace() and insert_or_assign() perform a single tree walk, so they
+ *   return a reference to the value (by value for inline types) instead of
+ *   an iterator, since an iterator requires a seek.
+ * - Iterators are bidirectional but heavier than std::map ones: each one
+ *   owns a raxIterator, and copying it re-seeks the current key. Like the C
+ *   iterators, they are invalidated by any modification of the map.
+ * - For inline values, dereferencing an iterator returns a copy of the
+ *   value: use insert_or_assign() to change it.
+ *
+ * The C API is declared inside the rax::c namespace, since in C++ a global
+ * 'struct rax' would clash with the 'rax' namespace. For this reason C++
+ * files using this header should not include rax.h directly. */
+
+#ifndef RAX_HPP
+#define RAX_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace rax {
+namespace c {
+#include "rax.h"
+}
+
+template <class V, class Alloc = std::allocator<V>>
+class map {
+    using traits = std::allocator_traits<Alloc>;
+    static_assert(std::is_same_v<typename traits::value_type, V>,
+                  "Alloc::value_type must be V");
+
+public:
+    using key_type = std::string_view;
+    using mapped_type = V;
+    using allocator_type = Alloc;
+    using size_type = std::size_t;
+
+    /* True if values are stored inside the node value slot. */
+    static constexpr bool inline_values =
+        sizeof(V) <= sizeof(void*) && std::is_trivially_copyable_v<V>;
+
+    /* What lookups and iterators return: a copy for inline values,
+     * otherwise a reference to the value owned by the map. */
+    using value_ref = std::conditional_t<inline_values, V, V&>;
+    using const_value_ref = std::conditional_t<inline_values, V, const V&>;
+    using value_type = std::pair<std::string_view, value_ref>;
+
+    class iterator;
+
+    explicit map(const Alloc &alloc = Alloc()) : alloc_(alloc) { tree(); }
+
+    map(const map &) = delete;
+    map &operator=(const map &) = delete;
+
+    /* A moved from map is empty, and allocates a new tree when used
+     * again. */
+    map(map &&other) noexcept
+        : tree_(other.tree_), alloc_(std::move(other.alloc_)) {
+        other.tree_ = nullptr;
+    }
+
+    map &operator=(map &&other) {
+        if (this == &other) return *this;
+        if constexpr (traits::propagate_on_container_move_assignment::value ||
+                      traits::is_always_equal::value) {
+            destroy();
+            if constexpr (traits::propagate_on_container_move_assignment::value)
+                alloc_ = std::move(other.alloc_);
+            tree_ = other.tree_;
+            other.tree_ = nullptr;
+        } else if (alloc_ == other.alloc_) {
+            destroy();
+            tree_ = other.tree_;
+            other.tree_ = nullptr;
+        } else {
+            /* Different memory resources: values must be moved one by one
+             * into memory owned by our allocator. */
+            clear();
+            for (auto it = other.begin(); it != other.end(); ++it)
+                try_emplace(it.key(), std::move(it.value()));
+            other.clear();
+        }
+        return *this;
+    }
+
+    ~map() { destroy(); }
+
+    allocator_type get_allocator() const { return alloc_; }
+    size_type size() const { return tree_ ? c::raxSize(tree_) : 0; }
+    bool empty() const { return size() == 0; }
+
+    /* Insert the key with a value constructed from 'args' only if the key
+     * is not already present. Returns the value associated with the key and
+     * true if the insertion took place. */
+    template <class... Args>
+    std::pair<value_ref, bool> try_emplace(std::string_view key,
+                                           Args &&...args) {
+        c::rax *t = tree();
+        void *old = nullptr;
+        if constexpr (inline_values) {
+            void *ptr = encode(V(std::forward<Args>(args)...));
+            int inserted = c::raxTryInsert(t, kptr(key), key.size(),
+                                           ptr, &old);
+            if (!inserted && errno == ENOMEM) throw std::bad_alloc();
+            return {decode(inserted ? ptr : old), inserted != 0};
+        } else {
+            V *ptr = traits::allocate(alloc_, 1);
+            int inserted = c::raxTryInsert(t, kptr(key), key.size(),
+                                           ptr, &old);
+            if (!inserted) {
+                traits::deallocate(alloc_, ptr, 1);
+                if (errno == ENOMEM) throw std::bad_alloc();
+                return {*static_cast<V *>(old), false};
+            }
+            try {
+                traits::construct(alloc_, ptr, std::forward<Args>(args)...);
+            } catch (...) {
+                c::raxRemove(t, kptr(key), key.size(), nullptr);
+                traits::deallocate(alloc_, ptr, 1);
+                throw;
+            }
+            return {*ptr, true};
+        }
+    }
+
+    /* Set the value of the key, replacing the old one if any. Returns true
+     * if the key was not already present. */
+    template <class M>
+    bool insert_or_assign(std::string_view key, M &&value) {
+        c::rax *t = tree();
+        void *ptr, *old = nullptr;
+        if constexpr (inline_values) {
+            ptr = encode(V(std::forward<M>(value)));
+        } else {
+            V *p = traits::allocate(alloc_, 1);
+            try {
+                traits::construct(alloc_, p, std::forward<M>(value));
+            } catch (...) {
+                traits::deallocate(alloc_, p, 1);
+                throw;
+            }
+            ptr = p;
+        }
+        int inserted = c::raxInsert(t, kptr(key), key.size(), ptr, &old);
+        if (!inserted && errno == ENOMEM) {
+            release(ptr);
+            throw std::bad_alloc();
+        }
+        if (!inserted) release(old);
+        return inserted != 0;
+    }
+
+    /* Remove the key, returning its value if it was present. */
+    std::optional<V> extract(std::string_view key) {
+        void *old;
+        if (tree_ == nullptr ||
+            !c::raxRemove(tree_, kptr(key), key.size(), &old))
+            return std::nullopt;
+        if constexpr (inline_values) {
+            return decode(old);
+        } else {
+            V *p = static_cast<V *>(old);
+            std::optional<V> v(std::move(*p));
+            release(p);
+            return v;
+        }
+    }
+
+    /* Remove the key, returning the number of elements removed. */
+    size_type erase(std::string_view key) {
+        void *old;
+        if (tree_ == nullptr ||
+            !c::raxRemove(tree_, kptr(key), key.size(), &old)) return 0;
+        release(old);
+        return 1;
+    }
+
+    /* Remove the element at 'pos', returning an iterator to the next one. */
+    iterator erase(iterator pos) {
+        std::string key(pos.key());
+        erase(key);
+        iterator next(this);
+        next.seek(">", key);
+        return next;
+    }
+
+    bool contains(std::string_view key) const {
+        return find_ptr(key) != c::raxNotFound;
+    }
+
+    size_type count(std::string_view key) const { return contains(key); }
+
+    /* Return the value of the key, throwing std::out_of_range if missing. */
+    value_ref at(std::string_view key) {
+        void *ptr = find_ptr(key);
+        if (ptr == c::raxNotFound) throw std::out_of_range("rax::map::at");
+        return decode(ptr);
+    }
+
+    const_value_ref at(std::string_view key) const {
+        void *ptr = find_ptr(key);
+        if (ptr == c::raxNotFound) throw std::out_of_range("rax::map::at");
+        return decode(ptr);
+    }
+
+    /* Single walk lookup: returns a std::optional<V> for inline values,
+     * otherwise a pointer to the value. Both are false if the key is
+     * missing. */
+    auto lookup(std::string_view key) const {
+        void *ptr = find_ptr(key);
+        if constexpr (inline_values) {
+            return ptr == c::raxNotFound ? std::optional<V>()
+                                         : std::optional<V>(decode(ptr));
+        } else {
+            return ptr == c::raxNotFound ? nullptr : static_cast<V *>(ptr);
+        }
+    }
+
+    iterator find(std::string_view key) { return iterator(this, "==", key); }
+    iterator lower_bound(std::string_view key) {
+        return iterator(this, ">=", key);
+    }
+    iterator upper_bound(std::string_view key) {
+        return iterator(this, ">", key);
+    }
+    iterator begin() { return iterator(this, "^", std::string_view()); }
+    iterator end() { return iterator(this); }
+
+    void clear() {
+        destroy();
+        tree();
+    }
+
+    /* Access to the underlying C tree, for functions without a wrapper.
+     * It is NULL for a moved from map not used again yet. */
+    c::rax *native() const { return tree_; }
+
+    class iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = map::value_type;
+
+        iterator() = default;
+
+        iterator(const iterator &other) : m_(other.m_) {
+            if (other.st_) seek("==", other.key());
+        }
+
+        iterator(iterator &&) noexcept = default;
+
+        iterator &operator=(const iterator &other) {
+            if (this != &other) {
+                m_ = other.m_;
+                st_.reset();
+                if (other.st_) seek("==", other.key());
+            }
+            return *this;
+        }
+
+        iterator &operator=(iterator &&) noexcept = default;
+
+        std::string_view key() const {
+            return std::string_view(
+                reinterpret_cast<const char *>(st_->it.key), st_->it.key_len);
+        }
+        value_ref value() const { return m_->decode(st_->it.data); }
+        reference operator*() const { return reference(key(), value()); }
+
+        iterator &operator++() {
+            if (!c::raxNext(&st_->it)) st_.reset();
+            return *this;
+        }
+
+        iterator &operator--() {
+            /* Decrementing end() moves to the greatest element. */
+            if (!st_) {
+                seek("$", std::string_view());
+            } else if (!c::raxPrev(&st_->it)) {
+                st_.reset();
+            }
+            return *this;
+        }
+
+        iterator operator++(int) {
+            iterator tmp(*this);
+            ++*this;
+            return tmp;
+        }
+
+        iterator operator--(int) {
+            iterator tmp(*this);
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const {
+            if (!st_ || !other.st_) return !st_ && !other.st_;
+            return key() == other.key();
+        }
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class map;
+
+        /* raxIterator points to its own static buffer, so it can't be
+         * moved in memory once started: keep it on the heap. */
+        struct state {
+            c::raxIterator it;
+            explicit state(c::rax *t) { c::raxStart(&it, t); }
+            ~state() { c::raxStop(&it); }
+        };
+
+        explicit iterator(map *m) : m_(m) {}
+        iterator(map *m, const char *op, std::string_view key) : m_(m) {
+            seek(op, key);
+        }
+
+        /* Seek and position on the first element: a null state means end().
+         * Operators are the ones of raxSeek(). */
+        void seek(const char *op, std::string_view key) {
+            st_ = std::make_unique<state>(m_->tree());
+            if (!c::raxSeek(&st_->it, op, kptr(key), key.size()) &&
+                errno == ENOMEM)
+                throw std::bad_alloc();
+            bool found = c::raxNext(&st_->it);
+            if (!found && errno == ENOMEM) throw std::bad_alloc();
+            if (!found) st_.reset();
+        }
+
+        map *m_ = nullptr;
+        std::unique_ptr<state> st_;
+    };
+
+private:
+    static unsigned char *kptr(std::string_view key) {
+        return reinterpret_cast<unsigned char *>(
+            const_cast<char *>(key.data()));
+    }
+
+    static void *encode(const V &v) {
+        void *ptr = nullptr;
+        std::memcpy(&ptr, &v, sizeof(V));
+        return ptr;
+    }
+
+    static value_ref decode(void *ptr) {
+        if constexpr (inline_values) {
+            alignas(V) unsigned char buf[sizeof(V)];
+            std::memcpy(buf, &ptr, sizeof(V));
+            return *std::launder(reinterpret_cast<V *>(buf));
+        } else {
+            return *static_cast<V *>(ptr);
+        }
+    }
+
+    /* Return the tree, allocating a new one if the map was moved from. */
+    c::rax *tree() {
+        if (tree_ == nullptr) {
+            tree_ = c::raxNew();
+            if (tree_ == nullptr) throw std::bad_alloc();
+        }
+        return tree_;
+    }
+
+    /* raxFind() that handles moved from maps. */
+    void *find_ptr(std::string_view key) const {
+        if (tree_ == nullptr) return c::raxNotFound;
+        return c::raxFind(tree_, kptr(key), key.size());
+    }
+
+    /* Destroy and deallocate a value no longer referenced by the tree. */
+    void release(void *ptr) {
+        if constexpr (!inline_values) {
+            V *p = static_cast<V *>(ptr);
+            traits::destroy(alloc_, p);
+            traits::deallocate(alloc_, p, 1);
+        }
+    }
+
+    void destroy() {
+        if (tree_ == nullptr) return;
+        if constexpr (!inline_values) {
+            c::raxIterator it;
+            c::raxStart(&it, tree_);
+            c::raxSeek(&it, "^", nullptr, 0);
+            while (c::raxNext(&it)) release(it.data);
+            c::raxStop(&it);
+        }
+        c::raxFree(tree_);
+        tree_ = nullptr;
+    }
+
+    c::rax *tree_ = nullptr;
+    Alloc alloc_;
+};
+
+namespace pmr {
+template <class V>
+using map = rax::map<V, std::pmr::polymorphic_allocator<V>>;
+}
+
+} // namespace rax
+
+#endif
@@ -0,0 +1,90 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Counting allocator.
+ *
+ * This allocator just wraps the libc allocator, counting the number of
+ * calls, in order to measure how many allocations the different operations
+ * perform. Compile rax.c with:
+ *
+ *   -DRAX_MALLOC_INCLUDE='"rax_count_malloc.h"'
+ *
+ * When the libc is able to report the usable size of an allocation (glibc)
+ * the allocator also tracks the number of bytes currently allocated, as
+ * seen by the allocator itself, so including the rounding to the size
+ * classes but not the allocator per-chunk overhead.
+ *
+ * The counters are global, and can be read (and reset) by the application
+ * declaring them as extern. */
+
+#ifndef RAX_ALLOC_H
+#define RAX_ALLOC_H
+
+#include <stdlib.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#define count_usable_size(p) malloc_usable_size(p)
+#else
+#define count_usable_size(p) 0
+#endif
+
+unsigned long long rax_malloc_calls = 0;
+unsigned long long rax_realloc_calls = 0;
+unsigned long long rax_free_calls = 0;
+unsigned long long rax_alloc_bytes = 0; /* Currently allocated bytes. */
+
+void *count_malloc(size_t size) {
+    rax_malloc_calls++;
+    void *ptr = malloc(size);
+    if (ptr) rax_alloc_bytes += count_usable_size(ptr);
+    return ptr;
+}
+
+void *count_realloc(void *ptr, size_t size) {
+    rax_realloc_calls++;
+    size_t oldsize = ptr ? count_usable_size(ptr) : 0;
+    void *newptr = realloc(ptr,size);
+    if (newptr) rax_alloc_bytes += count_usable_size(newptr) - oldsize;
+    return newptr;
+}
+
+void count_free(void *ptr) {
+    if (ptr) {
+        rax_free_calls++;
+        rax_alloc_bytes -= count_usable_size(ptr);
+    }
+    free(ptr);
+}
+
+#define rax_malloc count_malloc
+#define rax_realloc count_realloc
+#define rax_free count_free
+#endif
@@ -0,0 +1,181 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rax.h"
+#include "rax_intern.h"
+
+#ifndef RAX_MALLOC_INCLUDE
+#define RAX_MALLOC_INCLUDE "rax_malloc.h"
+#endif
+
+#include RAX_MALLOC_INCLUDE
+
+/* Create a new, empty, interning table. Returns NULL on out of memory. */
+raxIntern *raxInternNew(void) {
+    raxIntern *in = rax_malloc(sizeof(*in));
+    if (in == NULL) return NULL;
+    in->tree = raxNew();
+    in->offsets = rax_malloc(sizeof(size_t));
+    if (in->tree == NULL || in->offsets == NULL) {
+        if (in->tree) raxFree(in->tree);
+        rax_free(in->offsets);
+        rax_free(in);
+        return NULL;
+    }
+    in->buf = NULL;
+    in->buflen = in->bufsize = 0;
+    in->offsets[0] = 0;
+    in->count = 0;
+    in->slots = 0;
+    return in;
+}
+
+/* Free the table: the strings returned by raxInternString() are no longer
+ * valid. */
+void raxInternFree(raxIntern *in) {
+    raxFree(in->tree);
+    rax_free(in->buf);
+    rax_free(in->offsets);
+    rax_free(in);
+}
+
+/* Make room for 'strings' more strings of 'bytes' bytes overall. The
+ * buffers grow exponentially, so interning is amortized O(1) besides the
+ * tree insertion. Returns 0 on out of memory, otherwise 1. */
+static int raxInternReserve(raxIntern *in, size_t strings, size_t bytes) {
+    if (strings > (size_t)RAX_INTERN_NONE-in->count) {
+        errno = ERANGE;
+        return 0;
+    }
+    if (in->count+strings > in->slots) {
+        size_t slots = in->slots ? (size_t)in->slots*2 : 16;
+        if (slots < in->count+strings) slots = in->count+strings;
+        if (slots > RAX_INTERN_NONE) slots = RAX_INTERN_NONE;
+        size_t *offsets = rax_realloc(in->offsets,sizeof(size_t)*(slots+1));
+        if (offsets == NULL) {
+            errno = ENOMEM;
+            return 0;
+        }
+        in->offsets = offsets;
+        in->slots = slots;
+    }
+    if (in->buflen+bytes > in->bufsize) {
+        size_t size = in->bufsize ? in->bufsize*2 : 256;
+        if (size < in->buflen+bytes) size = in->buflen+bytes;
+        unsigned char *buf = rax_realloc(in->buf,size);
+        if (buf == NULL) {
+            errno = ENOMEM;
+            return 0;
+        }
+        in->buf = buf;
+        in->bufsize = size;
+    }
+    return 1;
+}
+
+/* Intern a string assuming room was reserved for it. */
+static uint32_t raxInternReserved(raxIntern *in, const unsigned char *s,
+                                  size_t len)
+{
+    void *old;
+    uint32_t id = in->count;
+    errno = 0;
+    if (raxTryInsert(in->tree,(unsigned char*)s,len,
+                     (void*)(uintptr_t)id,&old)) {
+        if (len) memcpy(in->buf+in->buflen,s,len);
+        in->buflen += len;
+        in->count++;
+        in->offsets[in->count] = in->buflen;
+        return id;
+    }
+    if (errno == ENOMEM) return RAX_INTERN_NONE;
+    return (uint32_t)(uintptr_t)old;
+}
+
+/* Return the ID of the string 's' of 'len' bytes, or RAX_INTERN_NONE if it
+ * was never interned. */
+uint32_t raxInternFind(raxIntern *in, const unsigned char *s, size_t len) {
+    void *id = raxFind(in->tree,(unsigned char*)s,len);
+    return id == raxNotFound ? RAX_INTERN_NONE : (uint32_t)(uintptr_t)id;
+}
+
+/* Return the ID of the string 's' of 'len' bytes, interning it if it was
+ * not already. On out of memory, or if all the IDs are used, returns
+ * RAX_INTERN_NONE with errno set to ENOMEM or ERANGE. */
+uint32_t raxInternAdd(raxIntern *in, const unsigned char *s, size_t len) {
+    /* Reserving first allows to intern with a single walk of the tree. If
+     * that fails the string may still be interned already. */
+    if (!raxInternReserve(in,1,len)) {
+        int saved = errno;
+        uint32_t id = raxInternFind(in,s,len);
+        if (id == RAX_INTERN_NONE) errno = saved;
+        return id;
+    }
+    return raxInternReserved(in,s,len);
+}
+
+/* Return the string with the specified ID, setting '*len' to its length,
+ * or NULL if no string has such ID. The string is not null terminated, and
+ * it is only valid until the next string is interned. */
+const unsigned char *raxInternString(raxIntern *in, uint32_t id, size_t *len) {
+    if (id >= in->count) return NULL;
+    *len = in->offsets[id+1]-in->offsets[id];
+    return in->buf+in->offsets[id];
+}
+
+/* Intern 'count' strings, for instance all the field names of a parsed
+ * document, storing their IDs in 'ids'. Room for all the strings is
+ * reserved at once, and every string is inserted with a single walk of the
+ * tree. Returns the number of strings interned: if less than 'count', the
+ * next string could not be interned, and errno is set as raxInternAdd()
+ * does. */
+size_t raxInternBatch(raxIntern *in, const unsigned char **strs,
+                      const size_t *lens, size_t count, uint32_t *ids)
+{
+    size_t bytes = 0, j;
+    for (j = 0; j < count; j++) bytes += lens[j];
+    if (!raxInternReserve(in,count,bytes)) {
+        /* Fall back to reserving string by string. */
+        for (j = 0; j < count; j++) {
+            ids[j] = raxInternAdd(in,strs[j],lens[j]);
+            if (ids[j] == RAX_INTERN_NONE) break;
+        }
+        return j;
+    }
+    for (j = 0; j < count; j++) {
+        ids[j] = raxInternReserved(in,strs[j],lens[j]);
+        if (ids[j] == RAX_INTERN_NONE) break;
+    }
+    return j;
+}
@@ -0,0 +1,67 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RAX_INTERN_H
+#define RAX_INTERN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "rax.h"
+
+/* String interning: every distinct string gets a dense 32 bit ID, assigned
+ * in order of first appearance starting from zero, that never changes.
+ * Strings are mapped to IDs by a radix tree storing the ID as the value,
+ * IDs are mapped back to strings by a copy of all the strings, stored one
+ * after the other in a single buffer: nodes have no parent pointer, so the
+ * key can't be rebuilt from the tree. Strings are never removed. */
+
+#define RAX_INTERN_NONE UINT32_MAX  /* Returned when no ID is available. */
+
+typedef struct raxIntern {
+    rax *tree;              /* String -> ID. */
+    unsigned char *buf;     /* The strings, in ID order. */
+    size_t buflen;          /* Bytes used in 'buf'. */
+    size_t bufsize;         /* Bytes allocated for 'buf'. */
+    size_t *offsets;        /* Offset of every string in 'buf', plus the
+                               end of the last one. */
+    uint32_t count;         /* Number of strings interned. */
+    uint32_t slots;         /* Entries allocated for 'offsets'. */
+} raxIntern;
+
+raxIntern *raxInternNew(void);
+void raxInternFree(raxIntern *in);
+uint32_t raxInternAdd(raxIntern *in, const unsigned char *s, size_t len);
+uint32_t raxInternFind(raxIntern *in, const unsigned char *s, size_t len);
+const unsigned char *raxInternString(raxIntern *in, uint32_t id, size_t *len);
+size_t raxInternBatch(raxIntern *in, const unsigned char **strs,
+                      const size_t *lens, size_t count, uint32_t *ids);
+
+#endif
@@ -0,0 +1,332 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "rax.h"
+#include "rax_record.h"
+
+#define RAX_RECORD_MAGIC "RAXREC"
+#define RAX_RECORD_MAGIC_LEN 6
+
+const char *raxRecordSeekOps[RAX_RECORD_SEEK_OPS] = {
+    "==", ">", ">=", "<", "<=", "^", "$"
+};
+
+/* --------------------------------------------------------------------------
+ * Writer.
+ * -------------------------------------------------------------------------*/
+
+static void recWriteVarint(FILE *fp, uint64_t v) {
+    while (v >= 0x80) {
+        fputc((int)((v & 0x7f) | 0x80),fp);
+        v >>= 7;
+    }
+    fputc((int)v,fp);
+}
+
+/* Create the recording 'filename', truncating it, and write the header.
+ * Returns 1 on success, otherwise 0 with errno set. */
+int raxRecordCreate(raxRecordWriter *w, const char *filename, int flags) {
+    w->fp = fopen(filename,"wb");
+    if (w->fp == NULL) return 0;
+    w->flags = flags;
+    fwrite(RAX_RECORD_MAGIC,RAX_RECORD_MAGIC_LEN,1,w->fp);
+    fputc(RAX_RECORD_VERSION,w->fp);
+    fputc(flags,w->fp);
+    return 1;
+}
+
+/* Append the record 'rec'. The key is written as it is. */
+void raxRecordWrite(raxRecordWriter *w, const raxRecord *rec) {
+    int op = rec->op;
+    fputc(op,w->fp);
+    fputc(rec->result > 255 ? 255 : rec->result,w->fp);
+    recWriteVarint(w->fp,rec->tree);
+    if (op == RAX_OP_SEEK || op == RAX_OP_NEXT || op == RAX_OP_PREV)
+        recWriteVarint(w->fp,rec->iter);
+    if (op == RAX_OP_SEEK) {
+        int code = 255;
+        for (int j = 0; rec->seek_op && j < RAX_RECORD_SEEK_OPS; j++) {
+            if (strcmp(rec->seek_op,raxRecordSeekOps[j]) == 0) {
+                code = j;
+                break;
+            }
+        }
+        fputc(code,w->fp);
+    }
+    if (op == RAX_OP_INSERT || op == RAX_OP_TRYINSERT ||
+        op == RAX_OP_REMOVE || op == RAX_OP_FIND || op == RAX_OP_SEEK)
+    {
+        recWriteVarint(w->fp,rec->key_len);
+        if (rec->key_len) fwrite(rec->key,rec->key_len,1,w->fp);
+    }
+}
+
+/* Close the recording. Returns 1 on success, 0 if writing it failed. */
+int raxRecordFinish(raxRecordWriter *w) {
+    int ok = !ferror(w->fp);
+    if (fclose(w->fp) != 0) ok = 0;
+    w->fp = NULL;
+    return ok;
+}
+
+/* --------------------------------------------------------------------------
+ * Recorder.
+ * -------------------------------------------------------------------------*/
+
+static struct {
+    raxRecordWriter w;
+    int active;
+    int incomplete;         /* Records dropped because out of memory. */
+    int busy;               /* Set while the recorder itself uses Rax. */
+    rax *trees;             /* Tree pointer -> id. */
+    rax *iters;             /* Iterator pointer -> id. */
+    uint64_t next_tree_id;
+    uint64_t next_iter_id;
+    uint64_t seed;          /* Key hashing seed, never written. */
+    unsigned char *keybuf;  /* Hashed key buffer. */
+    size_t keybuf_len;
+} Rec;
+
+static uint64_t recMix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* Return the id of the object at 'ptr' in the map 'map', assigning the
+ * next id from '*next_id' if the object was never seen, or if 'renew'
+ * is true because the address was freed and reused for a new object. */
+static uint64_t recGetId(rax *map, void *ptr, uint64_t *next_id, int renew) {
+    void *id = renew ? raxNotFound :
+                       raxFind(map,(unsigned char*)&ptr,sizeof(ptr));
+    if (id != raxNotFound) return (uint64_t)(uintptr_t)id;
+    id = (void*)(uintptr_t)(*next_id)++;
+    raxInsert(map,(unsigned char*)&ptr,sizeof(ptr),id,NULL);
+    return (uint64_t)(uintptr_t)id;
+}
+
+/* Hash the key preserving its length and the prefixes it shares with the
+ * other keys: every byte is XORed with a value derived from the bytes
+ * before it, so that distinct keys stay distinct. */
+static unsigned char *recHashKey(unsigned char *key, size_t len) {
+    if (len > Rec.keybuf_len) {
+        unsigned char *buf = realloc(Rec.keybuf,len);
+        if (buf == NULL) return NULL;
+        Rec.keybuf = buf;
+        Rec.keybuf_len = len;
+    }
+    uint64_t h = Rec.seed;
+    for (size_t j = 0; j < len; j++) {
+        Rec.keybuf[j] = key[j] ^ (unsigned char)(h >> 56);
+        h = recMix(h ^ key[j]);
+    }
+    return Rec.keybuf;
+}
+
+static void raxRecordCallback(const raxTraceEvent *e, void *privdata) {
+    (void)privdata;
+    if (Rec.busy) return;
+
+    /* Log every operation once: at its end when the result is known,
+     * with the exception of raxFree() that only reports its start. */
+    if (e->op == RAX_OP_FREE) {
+        if (e->type != RAX_TRACE_OP_BEGIN) return;
+    } else {
+        if (e->type != RAX_TRACE_OP_END) return;
+    }
+
+    Rec.busy = 1;
+    raxRecord rec;
+    rec.op = e->op;
+    rec.result = e->count > 255 ? 255 : (int)e->count;
+    rec.tree = recGetId(Rec.trees,e->rax,&Rec.next_tree_id,
+                        e->op == RAX_OP_NEW);
+    rec.iter = e->iter ? recGetId(Rec.iters,e->iter,&Rec.next_iter_id,0) : 0;
+    rec.seek_op = e->seek_op;
+    rec.key = e->key;
+    rec.key_len = e->key_len;
+    if (rec.key_len && (Rec.w.flags & RAX_RECORD_HASH_KEYS))
+        rec.key = recHashKey(e->key,e->key_len);
+    if (rec.key == NULL && rec.key_len) {
+        /* Out of memory hashing the key: better to drop the record than
+         * to leak the original key. */
+        Rec.incomplete = 1;
+    } else {
+        raxRecordWrite(&Rec.w,&rec);
+    }
+    if (e->op == RAX_OP_FREE)
+        raxRemove(Rec.trees,(unsigned char*)&e->rax,sizeof(e->rax),NULL);
+    Rec.busy = 0;
+}
+
+/* Start recording the operations performed on all the trees into the file
+ * 'filename', which is truncated. Trees already populated before the
+ * recording started are replayed starting from an empty tree, so it is
+ * better to start recording before the trees are created. On success 1 is
+ * returned, otherwise 0 is returned and errno is set: ENOTSUP if Rax was
+ * not compiled with RAX_TRACE, EBUSY if already recording. The recorder
+ * installs its own trace callback and is not thread safe. */
+int raxRecordStart(const char *filename, int flags) {
+    if (Rec.active) {
+        errno = EBUSY;
+        return 0;
+    }
+    if (!raxSetTraceCallback(NULL,NULL)) {
+        errno = ENOTSUP;
+        return 0;
+    }
+    memset(&Rec,0,sizeof(Rec));
+    Rec.trees = raxNew();
+    Rec.iters = raxNew();
+    if (Rec.trees == NULL || Rec.iters == NULL) goto oom;
+    if (!raxRecordCreate(&Rec.w,filename,flags)) goto err;
+    Rec.active = 1;
+    Rec.seed = recMix((uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)&Rec);
+    raxSetTraceCallback(raxRecordCallback,NULL);
+    return 1;
+
+oom:
+    errno = ENOMEM;
+err:
+    if (Rec.trees) raxFree(Rec.trees);
+    if (Rec.iters) raxFree(Rec.iters);
+    memset(&Rec,0,sizeof(Rec));
+    return 0;
+}
+
+/* Stop recording and close the file. Returns 1 on success, 0 if not
+ * recording, if writing the file failed, or if records were dropped
+ * because out of memory. */
+int raxRecordStop(void) {
+    if (!Rec.active) return 0;
+    raxSetTraceCallback(NULL,NULL);
+    int ok = raxRecordFinish(&Rec.w) && !Rec.incomplete;
+    raxFree(Rec.trees);
+    raxFree(Rec.iters);
+    free(Rec.keybuf);
+    memset(&Rec,0,sizeof(Rec));
+    return ok;
+}
+
+/* --------------------------------------------------------------------------
+ * Reader.
+ * -------------------------------------------------------------------------*/
+
+/* Open a recording for reading. Returns 1 on success, otherwise 0 is
+ * returned and errno is set, to EINVAL if the file is not a recording
+ * or was written by a different version. */
+int raxRecordOpen(raxRecordReader *r, const char *filename) {
+    unsigned char hdr[RAX_RECORD_MAGIC_LEN+2];
+    memset(r,0,sizeof(*r));
+    r->fp = fopen(filename,"rb");
+    if (r->fp == NULL) return 0;
+    if (fread(hdr,sizeof(hdr),1,r->fp) != 1 ||
+        memcmp(hdr,RAX_RECORD_MAGIC,RAX_RECORD_MAGIC_LEN) != 0 ||
+        hdr[RAX_RECORD_MAGIC_LEN] != RAX_RECORD_VERSION)
+    {
+        fclose(r->fp);
+        r->fp = NULL;
+        errno = EINVAL;
+        return 0;
+    }
+    r->flags = hdr[RAX_RECORD_MAGIC_LEN+1];
+    return 1;
+}
+
+static int recReadVarint(FILE *fp, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(fp);
+        if (c == EOF) return 0;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) return 1;
+    }
+    return 0;
+}
+
+/* Read the next record into 'rec'. Returns 1 if a record was read, 0 at
+ * the end of the file, and -1 if the file is truncated or corrupted, or
+ * on out of memory, setting errno to EINVAL or ENOMEM. */
+int raxRecordNext(raxRecordReader *r, raxRecord *rec) {
+    int op = fgetc(r->fp);
+    if (op == EOF) return 0;
+    memset(rec,0,sizeof(*rec));
+    rec->op = op;
+    if (op > RAX_OP_FREE) goto corrupted;
+
+    int result = fgetc(r->fp);
+    if (result == EOF) goto corrupted;
+    rec->result = result;
+    if (!recReadVarint(r->fp,&rec->tree)) goto corrupted;
+    if (op == RAX_OP_SEEK || op == RAX_OP_NEXT || op == RAX_OP_PREV) {
+        if (!recReadVarint(r->fp,&rec->iter)) goto corrupted;
+    }
+    if (op == RAX_OP_SEEK) {
+        int code = fgetc(r->fp);
+        if (code == EOF) goto corrupted;
+        rec->seek_op = code < RAX_RECORD_SEEK_OPS ? raxRecordSeekOps[code] :
+                                                    NULL;
+    }
+    if (op == RAX_OP_INSERT || op == RAX_OP_TRYINSERT ||
+        op == RAX_OP_REMOVE || op == RAX_OP_FIND || op == RAX_OP_SEEK)
+    {
+        uint64_t len;
+        if (!recReadVarint(r->fp,&len) || len > SIZE_MAX) goto corrupted;
+        if (len > r->bufsize) {
+            unsigned char *buf = realloc(r->buf,len);
+            if (buf == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            r->buf = buf;
+            r->bufsize = len;
+        }
+        if (len && fread(r->buf,len,1,r->fp) != 1) goto corrupted;
+        rec->key = r->buf;
+        rec->key_len = len;
+    }
+    return 1;
+
+corrupted:
+    errno = EINVAL;
+    return -1;
+}
+
+void raxRecordClose(raxRecordReader *r) {
+    if (r->fp) fclose(r->fp);
+    free(r->buf);
+    memset(r,0,sizeof(*r));
+}
@@ -0,0 +1,98 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017-2018, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RAX_RECORD_H
+#define RAX_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Workload recorder: logs the operations performed on all the trees into
+ * a compact binary file that rax-replay can replay later. Recording is
+ * built on the trace callback, so it needs Rax compiled with RAX_TRACE.
+ *
+ * File format: the "RAXREC" magic, a version byte and a flags byte, then
+ * one record per operation:
+ *
+ *   op byte, result byte, tree id (varint)
+ *   seek, next, prev: iterator id (varint)
+ *   seek: operator byte (index in raxRecordSeekOps, 255 if invalid)
+ *   insert, tryinsert, remove, find, seek: key length (varint), key bytes
+ *
+ * Trees and iterators are identified by small ids in order of appearance.
+ * Values are not recorded: the replay inserts NULL values. Recordings can
+ * also be written directly, record by record, with raxRecordWrite(). */
+
+#define RAX_RECORD_VERSION 1
+
+/* Flags for raxRecordStart(). */
+#define RAX_RECORD_HASH_KEYS (1<<0) /* Hash the keys instead of storing them
+                                       verbatim. The hashing preserves the
+                                       length and the common prefixes of the
+                                       keys, so that the replayed tree has
+                                       the same shape, but not their order.
+                                       Not meant as strong anonymization. */
+
+#define RAX_RECORD_SEEK_OPS 7
+extern const char *raxRecordSeekOps[RAX_RECORD_SEEK_OPS];
+
+typedef struct raxRecord {
+    int op;                 /* RAX_OP_... */
+    uint64_t tree;          /* Tree id. */
+    uint64_t iter;          /* Iterator id, for iterator operations. */
+    int result;             /* Return value: 1 if found for raxFind(). */
+    const char *seek_op;    /* Operator, for raxSeek(), NULL if invalid. */
+    unsigned char *key;     /* Key, valid until the next record is read. */
+    size_t key_len;
+} raxRecord;
+
+typedef struct raxRecordWriter {
+    FILE *fp;
+    int flags;
+} raxRecordWriter;
+
+typedef struct raxRecordReader {
+    FILE *fp;
+    int flags;              /* Flags the file was recorded with. */
+    unsigned char *buf;     /* Key buffer. */
+    size_t bufsize;
+} raxRecordReader;
+
+int raxRecordStart(const char *filename, int flags);
+int raxRecordStop(void);
+int raxRecordCreate(raxRecordWriter *w, const char *filename, int flags);
+void raxRecordWrite(raxRecordWriter *w, const raxRecord *rec);
+int raxRecordFinish(raxRecordWriter *w);
+int raxRecordOpen(raxRecordReader *r, const char *filename);
+int raxRecordNext(raxRecordReader *r, raxRecord *rec);
+void raxRecordClose(raxRecordReader *r);
+
+#endif
@@ -0,0 +1,239 @@
+/* Rax -- A radix tree implementation.
+ *
+ * Copyright (c) 2017, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Type specialized radix trees.
+ *
+ * The generic API stores 'void*' values. This header generates a wrapper
+ * type and a set of static inline functions for a given value type, so that
+ * callers don't need casts, and values of any size are handled by the
+ * compiler with the exact type and size known at compile time:
+ *
+ *   RAX_DEFINE(counters,uint64_t)
+ *
+ *   counters c;
+ *   countersInit(&c);
+ *   countersInsert(&c,(unsigned char*)"foo",3,10);
+ *   uint64_t v;
+ *   if (countersFind(&c,(unsigned char*)"foo",3,&v)) ...
+ *   countersFree(&c);
+ *
+ * Values up to sizeof(void*) bytes are stored inline in the node value
+ * slot. Zero values are stored as NULL, that uses the 'isnull' encoding and
+ * takes no space at all in the node. Larger values are copied into a heap
+ * allocated buffer owned by the tree, which is released on removal,
+ * overwrite and free.
+ *
+ * RAX_DEFINE_FIXED(name,type,keylen) generates the same API for keys of a
+ * fixed length, so the length is not passed by the caller:
+ *
+ *   RAX_DEFINE_FIXED(ids,struct entry,16)
+ *   idsInsert(&t,id,entry);
+ *
+ * The generated functions are:
+ *
+ *   int  nameInit(name *t);                      0 on out of memory.
+ *   int  nameInsert(name *t, key, val);          Like raxInsert().
+ *   int  nameTryInsert(name *t, key, val);       Like raxTryInsert().
+ *   int  nameFind(name *t, key, type *val);      1 if found, 0 otherwise.
+ *   int  nameRemove(name *t, key, type *old);    Like raxRemove().
+ *   uint64_t nameSize(name *t);
+ *   void nameFree(name *t);
+ *   void nameStart(nameIterator *it, name *t);
+ *   int  nameSeek(nameIterator *it, op, key);
+ *   int  nameNext(nameIterator *it);             Sets it->key/len/val.
+ *   int  namePrev(nameIterator *it);
+ *   void nameStop(nameIterator *it);
+ *
+ * Where 'key' is 'unsigned char *key, size_t len' for RAX_DEFINE() and just
+ * 'unsigned char *key' for RAX_DEFINE_FIXED(). Note that the tree walk is
+ * still performed by rax.c: what gets specialized is the value handling.
+ */
+
+#ifndef RAX_TYPED_H
+#define RAX_TYPED_H
+
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include "rax.h"
+
+#ifndef RAX_MALLOC_INCLUDE
+#define RAX_MALLOC_INCLUDE "rax_malloc.h"
+#endif
+
+#include RAX_MALLOC_INCLUDE
+
+/* Key arguments of the generated functions, and the way they are passed
+ * along, for variable and fixed length keys. They are passed by name to
+ * RAX__DEFINE() so that the comma is only seen after argument
+ * substitution. */
+#define RAX__KEYARGS_VAR unsigned char *key, size_t len
+#define RAX__KEYPASS_VAR key,len
+#define RAX__KEYARGS_FIXED unsigned char *key
+#define RAX__KEYPASS_FIXED key
+
+#define RAX_DEFINE(name,type) \
+    RAX__DEFINE(name,type,RAX__KEYARGS_VAR,RAX__KEYPASS_VAR,len)
+
+#define RAX_DEFINE_FIXED(name,type,keylen) \
+    RAX__DEFINE(name,type,RAX__KEYARGS_FIXED,RAX__KEYPASS_FIXED,(keylen))
+
+#define RAX__DEFINE(name,type,KEYARGS,KEYPASS,KEYLEN) \
+typedef struct name { \
+    rax *rt; \
+} name; \
+\
+typedef struct name##Iterator { \
+    raxIterator ri; \
+    unsigned char *key; \
+    size_t key_len; \
+    type val; \
+} name##Iterator; \
+\
+/* Values that fit are stored inline, otherwise a copy is allocated. The \
+ * sizeof() test is a constant, so only one branch gets compiled. */ \
+static inline int name##Encode(const type *val, void **ptr) { \
+    if (sizeof(type) <= sizeof(void*)) { \
+        *ptr = NULL; \
+        memcpy(ptr,val,sizeof(type)); \
+    } else { \
+        *ptr = rax_malloc(sizeof(type)); \
+        if (*ptr == NULL) { \
+            errno = ENOMEM; \
+            return 0; \
+        } \
+        memcpy(*ptr,val,sizeof(type)); \
+    } \
+    return 1; \
+} \
+\
+static inline void name##Decode(void *ptr, type *val) { \
+    if (sizeof(type) <= sizeof(void*)) \
+        memcpy(val,&ptr,sizeof(type)); \
+    else \
+        memcpy(val,ptr,sizeof(type)); \
+} \
+\
+static inline void name##Release(void *ptr) { \
+    if (sizeof(type) > sizeof(void*)) rax_free(ptr); \
+} \
+\
+static inline int name##Init(name *t) { \
+    t->rt = raxNew(); \
+    return t->rt != NULL; \
+} \
+\
+static inline int name##GenericInsert(name *t, KEYARGS, type val, \
+                                      int overwrite) { \
+    void *ptr, *old = NULL; \
+    if (!name##Encode(&val,&ptr)) return 0; \
+    int retval = overwrite ? raxInsert(t->rt,key,KEYLEN,ptr,&old) : \
+                             raxTryInsert(t->rt,key,KEYLEN,ptr,&old); \
+    if (retval == 0) { \
+        /* Release the value that is no longer referenced by the tree: \
+         * the old one if it was overwritten, otherwise the new one. */ \
+        int saved_errno = errno; \
+        name##Release((overwrite && saved_errno == 0) ? old : ptr); \
+        errno = saved_errno; \
+    } \
+    return retval; \
+} \
+\
+static inline int name##Insert(name *t, KEYARGS, type val) { \
+    return name##GenericInsert(t,KEYPASS,val,1); \
+} \
+\
+static inline int name##TryInsert(name *t, KEYARGS, type val) { \
+    return name##GenericInsert(t,KEYPASS,val,0); \
+} \
+\
+static inline int name##Find(name *t, KEYARGS, type *val) { \
+    void *ptr = raxFind(t->rt,key,KEYLEN); \
+    if (ptr == raxNotFound) return 0; \
+    if (val) name##Decode(ptr,val); \
+    return 1; \
+} \
+\
+static inline int name##Remove(name *t, KEYARGS, type *old) { \
+    void *ptr; \
+    if (!raxRemove(t->rt,key,KEYLEN,&ptr)) return 0; \
+    if (old) name##Decode(ptr,old); \
+    name##Release(ptr); \
+    return 1; \
+} \
+\
+static inline uint64_t name##Size(name *t) { \
+    return raxSize(t->rt); \
+} \
+\
+static inline void name##FreeCallback(void *ptr) { \
+    name##Release(ptr); \
+} \
+\
+static inline void name##Free(name *t) { \
+    if (sizeof(type) > sizeof(void*)) \
+        raxFreeWithCallback(t->rt,name##FreeCallback); \
+    else \
+        raxFree(t->rt); \
+    t->rt = NULL; \
+} \
+\
+static inline void name##Start(name##Iterator *it, name *t) { \
+    raxStart(&it->ri,t->rt); \
+    it->key = NULL; \
+    it->key_len = 0; \
+} \
+\
+static inline int name##Seek(name##Iterator *it, const char *op, KEYARGS) { \
+    return raxSeek(&it->ri,op,key,KEYLEN); \
+} \
+\
+static inline int name##Fetch(name##Iterator *it, int retval) { \
+    if (retval) { \
+        it->key = it->ri.key; \
+        it->key_len = it->ri.key_len; \
+        name##Decode(it->ri.data,&it->val); \
+    } \
+    return retval; \
+} \
+\
+static inline int name##Next(name##Iterator *it) { \
+    return name##Fetch(it,raxNext(&it->ri)); \
+} \
+\
+static inline int name##Prev(name##Iterator *it) { \
+    return name##Fetch(it,raxPrev(&it->ri)); \
+} \
+\
+static inline void name##Stop(name##Iterator *it) { \
+    raxStop(&it->ri); \
+}
+
+#endif